@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file           : spi_acq.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_ACQ_H_
+#define INC_SPI_ACQ_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SPI_ACQ_Acq;
+
+/* Batch consumer: called from the RX DMA IRQ for every filled half of the ring */
+typedef void (*SPI_ACQ_Cb)(struct SPI_ACQ_Acq *acq, uint8_t *block, uint16_t len, void *ctx);
+
+/* Timer-triggered acquisition: TIM12 TRGO at rate_hz drives DMAMUX1 request generator 0, which
+   feeds one cmd frame per tick to the TX DMA; the SPI clocks one frame (= one sample, up to the
+   32-bit frame size) with hardware NSS pulsed around it, and the RX DMA fills buf circularly.
+   No CPU per sample. One acquisition at a time (TIM12 and the generator are shared). The handle
+   holds the command frame read by the DMA: keep it out of DTCM */
+typedef struct SPI_ACQ_Acq {
+    uint32_t cmd[SPI_APP_CACHE_LINE / 4u] __attribute__((aligned(SPI_APP_CACHE_LINE)));
+
+    SPI_APP_Device *dev;
+    uint8_t *buf;                      // ring: two halves of block frames
+    uint16_t block;
+    SPI_ACQ_Cb cb;
+    void *ctx;
+    uint32_t tx_request;               // TX stream request restored on stop
+    volatile uint8_t on;
+    volatile uint8_t pending;          // bit n: half n delivered and not yet released
+
+    /* Statistics */
+    volatile uint32_t blocks;
+    volatile uint32_t overruns;        // DMA wrapped into a half still held by the consumer
+    uint32_t first;                    // sample index of the first frame of the last batch
+} SPI_ACQ_Acq;
+
+/* buf holds 2 * block_len frames, each half cache-line safe (SPI_APP_DMA_BUFFER). Needs
+   spi_app_hw_nss_enable() and both DMA streams (SPI3 here); the device stays busy until stopped */
+HAL_StatusTypeDef spi_acq_start(SPI_ACQ_Acq *acq, SPI_APP_Device *dev, uint32_t rate_hz, uint32_t cmd,
+                                uint8_t *buf, uint16_t block_len, SPI_ACQ_Cb cb, void *ctx);
+
+/* Hand a batch back once consumed (one of the two halves passed to the callback) */
+HAL_StatusTypeDef spi_acq_release(SPI_ACQ_Acq *acq, const uint8_t *block);
+HAL_StatusTypeDef spi_acq_stop(SPI_ACQ_Acq *acq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_ACQ_H_ */
@@ -12,24 +12,225 @@
 #include <stdint.h>
 #include "stm32h7xx_hal.h"
 
-/* Generic SPI device handle (SPI + manual CS) */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Cortex-M7 D-cache line size: DMA RX buffers must own whole lines */
+#define SPI_APP_CACHE_LINE  32u
+
+/* Place a buffer in the DMA section (D2 SRAM, see STM32H753ZITX_FLASH.ld), cache-line aligned */
+#define SPI_APP_DMA_BUFFER  __attribute__((section(".dma_buffer"), aligned(SPI_APP_CACHE_LINE)))
+
+/* Largest chunk handed to the HAL: TSIZE and DMA NDTR are 16-bit. A multiple of the
+   cache line, so every chunk of a cache-safe RX buffer is cache-safe as well */
+#define SPI_APP_CHUNK_MAX   0xFFE0u
+
+/* Bounce buffer used for RX buffers that are not cache-line safe */
+#ifndef SPI_APP_BOUNCE_SIZE
+#define SPI_APP_BOUNCE_SIZE 256u
+#endif
+
+/* Transaction queue depth (per bus) */
+#ifndef SPI_APP_QUEUE_LEN
+#define SPI_APP_QUEUE_LEN   8u
+#endif
+
+/* Latency instrumentation (DWT CYCCNT): 0 compiles every timestamp out */
+#ifndef SPI_APP_STATS
+#define SPI_APP_STATS       0
+#endif
+
+/* Register-level fast path: blocking transfers up to this many frames bypass the HAL (0: off) */
+#ifndef SPI_APP_FAST_AUTO
+#define SPI_APP_FAST_AUTO   8u
+#endif
+
+/* Fast path timeout: polling iterations without progress (replaces the HAL_GetTick timeout) */
+#ifndef SPI_APP_FAST_SPIN
+#define SPI_APP_FAST_SPIN   100000u
+#endif
+
+/* spi_app_xfer() crossover points until spi_app_xfer_calibrate() has run (frames) */
+#ifndef SPI_APP_XFER_POLL_MAX
+#define SPI_APP_XFER_POLL_MAX   16u
+#endif
+#ifndef SPI_APP_XFER_IT_MAX
+#define SPI_APP_XFER_IT_MAX     64u
+#endif
+
+/* spi_app_wait(): sleep with WFI between checks (0: busy-wait, friendlier to some debug setups) */
+#ifndef SPI_APP_WAIT_WFI
+#define SPI_APP_WAIT_WFI    0
+#endif
+
+/* Event flags (SPI_APP_Device.events), set from the DMA callbacks */
+#define SPI_APP_EVT_DONE    (1u << 0)  // DMA transfer finished (also set on error)
+#define SPI_APP_EVT_ERROR   (1u << 1)  // DMA transfer failed
+#define SPI_APP_EVT_QUEUE   (1u << 2)  // transaction queue drained
+#define SPI_APP_EVT_BLOCK   (1u << 3)  // streaming: a half of the ring was delivered
+
+struct SPI_APP_Device;
+
+#if SPI_APP_STATS
+#define SPI_APP_HIST_BINS   32u
+
+/* log2 histograms in CPU cycles: bin n counts samples in [2^n, 2^(n+1)) (bin 0 also holds 0) */
 typedef struct {
+    uint32_t setup[SPI_APP_HIST_BINS];    // API entry -> CS asserted (lock, buffer checks, cache maintenance)
+    uint32_t wire[SPI_APP_HIST_BINS];     // CS asserted -> completion seen (includes DMA IRQ latency)
+    uint32_t cplt[SPI_APP_HIST_BINS];     // completion seen -> result published (CS release, MDMA copy)
+    uint32_t count;
+    uint32_t errors;
+} SPI_APP_Stats;
+#endif
+
+/* Completion callback: called from the DMA IRQ once the transfer is over (CS released) */
+typedef void (*SPI_APP_DoneCb)(struct SPI_APP_Device *dev, HAL_StatusTypeDef status, void *ctx);
+
+/* One queued DMA transaction */
+typedef struct {
+    GPIO_TypeDef *CS_Port;     // NULL: use the CS of the device owning the queue
+    uint16_t CS_Pin;
+    uint8_t cs_active_low;
+
+    uint8_t *tx;               // NULL: RX-only (simplex receiver)
+    uint8_t *rx;               // NULL: TX-only
+    uint32_t len;              // frames, no 64K limit
+
+    SPI_APP_DoneCb cb;         // optional, HAL_ERROR if the transaction failed or was dropped
+    void *ctx;
+} SPI_APP_Txn;
+
+/* One segment of a vectored transfer (e.g. opcode/address header, then payload) */
+typedef struct {
+    const uint8_t *tx;         // NULL: RX-only
+    uint8_t *rx;               // NULL: TX-only
+    uint32_t len;              // frames
+} SPI_APP_Seg;
+
+/* Chained DMA transaction queue: the next transaction is started from spi_app_dma_cplt() */
+typedef struct {
+    SPI_APP_Txn txn[SPI_APP_QUEUE_LEN];
+    volatile uint8_t head;     // slot in flight (or next to start)
+    volatile uint8_t count;    // queued transactions, including the one in flight
+    volatile uint8_t busy;     // 1 while the chain is running
+
+    volatile uint8_t done;     // 1 when the queue has drained
+    volatile uint8_t err;      // 1 if a transaction failed (remaining ones are dropped)
+    volatile uint32_t completed;
+    volatile uint32_t dropped;
+} SPI_APP_Queue;
+
+/* Per-device link parameters, loaded into the SPI registers when the device takes the bus */
+typedef struct {
+    uint32_t CLKPolarity;         // SPI_POLARITY_x
+    uint32_t CLKPhase;            // SPI_PHASE_x
+    uint32_t BaudRatePrescaler;   // SPI_BAUDRATEPRESCALER_x
+    uint32_t DataSize;            // SPI_DATASIZE_x
+    uint32_t FirstBit;            // SPI_FIRSTBIT_x
+    uint32_t CRCCalculation;      // SPI_CRCCALCULATION_x
+    uint32_t CRCLength;           // SPI_CRC_LENGTH_x
+    uint32_t CRCPolynomial;       // without the top bit (0x07: CRC-8, 0x1021: CRC-16/CCITT)
+    uint32_t CRCInitPattern;      // SPI_CRC_INITIALIZATION_x, TX and RX
+} SPI_APP_Config;
+
+/* Shared bus: owns the SPI handle, several devices with different settings take turns on it */
+typedef struct {
+    SPI_HandleTypeDef *hspi;
+    volatile uint8_t locked;
+    uint8_t depth;                       // nested acquisitions by the owner
+    struct SPI_APP_Device *volatile owner;
+    struct SPI_APP_Device *active;       // device whose settings are in the registers
+    uint32_t switches;                   // configuration switches performed
+} SPI_APP_Bus;
+
+/* Streaming consumer: called from the DMA IRQ for every filled half of the ring */
+typedef void (*SPI_APP_StreamCb)(struct SPI_APP_Device *dev, uint8_t *block, uint16_t len, void *ctx);
+
+/* Generic SPI device handle (SPI + manual CS) */
+typedef struct SPI_APP_Device {
     SPI_HandleTypeDef *hspi;
     GPIO_TypeDef *CS_Port;
     uint16_t CS_Pin;
 
     uint8_t cs_active_low;     // 1: CS active low (most common), 0: CS active high
+    uint8_t hw_nss;            // 1: CS driven by the SPI NSS output, spi_app_cs_low/high are no-ops
 
     /* DMA state (optional use) */
     volatile uint8_t dma_done; // 0 running, 1 done
     volatile uint8_t dma_err;  // 0 ok, 1 error
-    volatile uint32_t dma_hal_error;
+    volatile uint32_t dma_hal_error;   // HAL_SPI_ERROR_x (HAL_MDMA_ERROR_x for the DTCM stage)
+
+    /* Completion notification: callback for spi_app_*_dma() transfers, event flags for all */
+    SPI_APP_DoneCb done_cb;
+    void *done_ctx;
+    volatile uint32_t events;  // SPI_APP_EVT_x, cleared by spi_app_wait()
 
     /* Optional: store last transfer length for cache maintenance */
-    uint16_t last_len;
+    uint32_t last_len;
     uint8_t *last_rx;
     const uint8_t *last_tx;
 
+    /* DMA transfer still to be submitted (long transfers are chunked under one CS) */
+    const uint8_t *xfer_tx;
+    uint8_t *xfer_rx;
+    uint32_t xfer_left;
+    const SPI_APP_Seg *vec;            // vectored DMA transfer: next segment
+    uint8_t vec_left;                  // segments still to start
+    uint8_t xfer_it;                   // 1: interrupt-driven (no DMA, no cache maintenance)
+    uint8_t dma_pack;                  // 1: packed DMA (32-bit beats) for bulk transfers
+    uint32_t dma_requests;             // SPI DMA requests issued, both directions
+
+    /* spi_app_xfer(): polling up to xfer_poll_max frames, IT up to xfer_it_max, DMA above */
+    uint32_t xfer_poll_max;
+    uint32_t xfer_it_max;
+
+    /* Hardware CRC: the settings are kept in hspi->Init (and cfg on a shared bus) */
+    uint8_t crc_retries;               // repeats after a CRC mismatch
+    uint8_t crc_left;                  // repeats left for the DMA transfer in flight
+    uint8_t crc_it;
+    const uint8_t *crc_tx;             // DMA transfer to repeat
+    uint8_t *crc_rx;
+    uint32_t crc_len;
+    uint32_t crc_errors;               // CRC mismatches seen
+    uint32_t crc_failures;             // transfers still failing after the last repeat
+
+    /* Optional shared bus (NULL: exclusive use of hspi) */
+    SPI_APP_Bus *bus;
+    SPI_APP_Config cfg;
+
+    /* Optional MDMA stage: RX staged in D2 SRAM, copied to DTCM before completion is reported */
+    MDMA_HandleTypeDef *mdma;
+    const uint8_t *mdma_src;
+    uint8_t *mdma_dst;                 // NULL: no copy pending
+    uint32_t mdma_bytes;
+
+#if SPI_APP_STATS
+    /* Timestamps of the transaction being measured (single transfers, not the queue) */
+    SPI_APP_Stats stats;
+    uint32_t ts_start;
+    uint32_t ts_wire;
+    uint32_t ts_cplt;
+    volatile uint8_t ts_armed;
+#endif
+
+    /* RX redirected to the bounce buffer: user destination (NULL: not bounced) */
+    uint8_t *bounce_dst;
+
+    /* Optional transaction queue (NULL: single transfers only) */
+    SPI_APP_Queue *queue;
+
+    /* Circular RX streaming (ping-pong halves of stream_buf) */
+    uint8_t *stream_buf;
+    uint16_t stream_block;             // frames per half
+    SPI_APP_StreamCb stream_cb;
+    void *stream_ctx;
+    volatile uint8_t stream_on;
+    volatile uint8_t stream_pending;   // bit n: half n delivered and not yet released
+    volatile uint32_t stream_blocks;
+    volatile uint32_t stream_overruns; // DMA wrapped into a half still held by the consumer
+    uint32_t stream_first;             // index of the first frame of the last delivered block
 } SPI_APP_Device;
 
 /* Functions */
@@ -42,22 +243,146 @@ void spi_app_initStruct(SPI_APP_Device *dev,
 void spi_app_cs_low(SPI_APP_Device *dev);
 void spi_app_cs_high(SPI_APP_Device *dev);
 
-/* Blocking (polling) helpers */
-HAL_StatusTypeDef spi_app_write(SPI_APP_Device *dev, uint8_t *tx, uint16_t len, uint32_t timeout);
-HAL_StatusTypeDef spi_app_read(SPI_APP_Device *dev, uint8_t *rx, uint16_t len, uint32_t timeout);
-HAL_StatusTypeDef spi_app_transfer(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint16_t len, uint32_t timeout);
+/* Bytes per frame in memory (1, 2 or 4): for a SPI_DATASIZE_x, with the device settings */
+uint32_t spi_app_size_bytes(uint32_t size);
+uint32_t spi_app_frame_bytes(const SPI_APP_Device *dev);
+
+/* Blocking (polling) helpers - len in frames; reads are RX-only (MOSI not driven) */
+HAL_StatusTypeDef spi_app_write(SPI_APP_Device *dev, uint8_t *tx, uint32_t len, uint32_t timeout);
+HAL_StatusTypeDef spi_app_read(SPI_APP_Device *dev, uint8_t *rx, uint32_t len, uint32_t timeout);
+HAL_StatusTypeDef spi_app_transfer(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len, uint32_t timeout);
+
+#if SPI_APP_STATS
+/* Consistent copy of the histograms (optionally cleared), and the cycle bound under which pct %
+   of the samples of one histogram fall (upper edge of the bin) */
+void spi_app_stats_snapshot(SPI_APP_Device *dev, SPI_APP_Stats *out, uint8_t reset);
+uint32_t spi_app_stats_percentile(const uint32_t *hist, uint32_t pct);
+#endif
+
+/* Packed DMA: FIFO threshold raised to one 32-bit word, one word per DMA request and 4-beat
+   memory bursts through the DMA FIFO. Applies to 4-byte aligned buffers of 8/16-bit frames;
+   the part of a transfer that is not a multiple of 16 bytes runs unpacked under the same CS */
+void spi_app_dma_pack_enable(SPI_APP_Device *dev, uint8_t enable);
+
+/* Adaptive transfer: polling, IT or DMA chosen by length. Completion is always reported like
+   a DMA transfer (dma_done, SPI_APP_EVT_DONE, done callback), inline for the polling case.
+   IT needs the SPI IRQ enabled; without IRQ or DMA the next available method is used */
+HAL_StatusTypeDef spi_app_xfer(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len);
 
-/* DMA helpers (async) - requires SPI configured with DMA in CubeMX */
-HAL_StatusTypeDef spi_app_transfer_dma(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint16_t len);
-HAL_StatusTypeDef spi_app_write_dma(SPI_APP_Device *dev, uint8_t *tx, uint16_t len);
-HAL_StatusTypeDef spi_app_read_dma(SPI_APP_Device *dev, uint8_t *rx, uint16_t len);
+/* One transfer by a given method, reported the same way. spi_app_xfer_method() downgrades the
+   requested method to what the hardware setup supports (DMA also needs the SPI IRQ) */
+#define SPI_APP_XFER_POLL   0u
+#define SPI_APP_XFER_IT     1u
+#define SPI_APP_XFER_DMA    2u
+uint8_t spi_app_xfer_method(const SPI_APP_Device *dev, uint8_t method, const uint8_t *tx, const uint8_t *rx);
+HAL_StatusTypeDef spi_app_xfer_run(SPI_APP_Device *dev, uint8_t method, uint8_t *tx, uint8_t *rx, uint32_t len);
+
+/* Measure poll / IT / DMA for 1, 2, 4 .. max_len frames and store the crossover points (CPU
+   cycles spent per transfer, latency as tie-break). Buffers of max_len frames, SPI_APP_DMA_BUFFER */
+HAL_StatusTypeDef spi_app_xfer_calibrate(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t max_len);
+
+/* What the calibration measures (DWT running): cost of one idle-loop iteration in 1/16 cycle, and
+   the best of 3 runs of one transfer, CPU-busy cycles (idle-loop accounting for IT/DMA) and latency */
+uint32_t spi_app_xfer_idle_cost(void);
+HAL_StatusTypeDef spi_app_xfer_measure(SPI_APP_Device *dev, uint8_t method, uint8_t *tx, uint8_t *rx,
+                                       uint32_t len, uint32_t idle_cost, uint32_t *cpu, uint32_t *lat);
+
+/* Fast path on request (any length up to 64K frames): TXDR/RXDR driven directly from the
+   TXP/RXP flags, no HAL state, lock or tick bookkeeping. HAL_BUSY if the HAL handle is busy */
+HAL_StatusTypeDef spi_app_transfer_fast(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len);
+
+/* Hardware CRC: the SPI appends the CRC of the frames it sends and checks the one received after
+   them (length in frames unchanged, buffers hold data only). length: SPI_CRC_LENGTH_x, at least
+   the frame size (up to 32 bits on SPI1..3, 16 on SPI4..6); init_pattern: SPI_CRC_INITIALIZATION_x.
+   A mismatch is HAL_ERROR with HAL_SPI_ERROR_CRC; blocking and single DMA/IT transfers (up to
+   64K frames) are repeated under a new CS up to retries times first. spi_app_transfer_fast(),
+   vectored and queued transfers report it without repeat; circular streaming refuses CRC */
+HAL_StatusTypeDef spi_app_crc_enable(SPI_APP_Device *dev, uint32_t length, uint32_t polynomial,
+                                     uint32_t init_pattern, uint8_t retries);
+HAL_StatusTypeDef spi_app_crc_disable(SPI_APP_Device *dev);
+
+/* DMA helpers (async) - requires SPI configured with DMA in CubeMX.
+   Transfers above 64K frames are chunked from spi_app_dma_cplt() with CS kept low */
+HAL_StatusTypeDef spi_app_transfer_dma(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len);
+HAL_StatusTypeDef spi_app_write_dma(SPI_APP_Device *dev, uint8_t *tx, uint32_t len);
+HAL_StatusTypeDef spi_app_read_dma(SPI_APP_Device *dev, uint8_t *rx, uint32_t len);
+
+/* Vectored transfers: the segments run back to back under one CS assertion, no copy.
+   The DMA version chains the next segment from spi_app_dma_cplt(); seg must stay valid until
+   completion. Not available with hardware NSS (NSS would toggle between segments) */
+HAL_StatusTypeDef spi_app_transfer_vec(SPI_APP_Device *dev, const SPI_APP_Seg *seg, uint8_t count, uint32_t timeout);
+HAL_StatusTypeDef spi_app_transfer_vec_dma(SPI_APP_Device *dev, const SPI_APP_Seg *seg, uint8_t count);
+
+/* Completion: the callback applies to every following spi_app_*_dma() transfer (NULL: none).
+   spi_app_wait() returns (and clears) the events of mask that are set, 0 on timeout */
+void spi_app_set_callback(SPI_APP_Device *dev, SPI_APP_DoneCb cb, void *ctx);
+uint32_t spi_app_wait(SPI_APP_Device *dev, uint32_t mask, uint32_t timeout);
+void spi_app_events_clear(SPI_APP_Device *dev, uint32_t mask);
+HAL_StatusTypeDef spi_app_dma_wait(SPI_APP_Device *dev, uint32_t timeout);
+
+/* DTCM delivery: DMA1 fills stage (D2 SRAM, SPI_APP_DMA_BUFFER), then MDMA copies it to dst
+   (DTCM) and only then the transfer is reported done. tx == NULL: RX-only. Limits: 64 KB,
+   dst and size multiple of 4. MDMA_IRQn must be enabled and call HAL_MDMA_IRQHandler() */
+HAL_StatusTypeDef spi_app_mdma_attach(SPI_APP_Device *dev, MDMA_HandleTypeDef *hmdma,
+                                      MDMA_Channel_TypeDef *channel);
+HAL_StatusTypeDef spi_app_transfer_dma_dtcm(SPI_APP_Device *dev, uint8_t *tx, uint8_t *stage,
+                                            uint8_t *dst, uint32_t len);
+
+/* Shared bus: transfers acquire the bus and switch settings automatically (HAL_BUSY if
+   another device owns it). Explicit acquire/release groups several transfers */
+void spi_app_bus_init(SPI_APP_Bus *bus, SPI_HandleTypeDef *hspi);
+void spi_app_bus_attach(SPI_APP_Device *dev, SPI_APP_Bus *bus, const SPI_APP_Config *cfg);
+HAL_StatusTypeDef spi_app_bus_acquire(SPI_APP_Device *dev);
+void spi_app_bus_release(SPI_APP_Device *dev);
+
+/* Hardware NSS: the CS pin must be the NSS pin of the instance (SPI1: PG10 AF5, SPI2: PB12 AF5,
+   SPI3: PA15 AF6). One NSS assertion per HAL transfer, so use it for short transactions only */
+HAL_StatusTypeDef spi_app_hw_nss_enable(SPI_APP_Device *dev, uint8_t alternate,
+                                        uint32_t ss_idleness, uint32_t interdata_idleness);
+HAL_StatusTypeDef spi_app_hw_nss_disable(SPI_APP_Device *dev);
+
+/* Transaction queue (DMA, back-to-back on the same bus) */
+void spi_app_queue_attach(SPI_APP_Device *dev, SPI_APP_Queue *queue);
+HAL_StatusTypeDef spi_app_queue_submit(SPI_APP_Device *dev, const SPI_APP_Txn *txn, uint8_t count);
+uint8_t spi_app_queue_idle(const SPI_APP_Device *dev);
+
+/* Continuous RX streaming (circular DMA, RX-only, CS held low until stopped) */
+HAL_StatusTypeDef spi_app_stream_start(SPI_APP_Device *dev, uint8_t *buf, uint16_t block_len,
+                                       SPI_APP_StreamCb cb, void *ctx);
+HAL_StatusTypeDef spi_app_stream_release(SPI_APP_Device *dev, const uint8_t *block);
+HAL_StatusTypeDef spi_app_stream_stop(SPI_APP_Device *dev);
 
 /* To be called from HAL callbacks */
+void spi_app_dma_half_cplt(SPI_APP_Device *dev);
 void spi_app_dma_cplt(SPI_APP_Device *dev);
 void spi_app_dma_error(SPI_APP_Device *dev);
 
-/* STM32H7 cache helpers (Placeholders: maybe not needed) */
+/* Measurement helpers (DWT cycle counter) */
+void spi_app_cycles_init(void);
+uint32_t spi_app_cycles(void);
+
+/* For the modules built on the device (spi_acq, spi_slave, ...): raise events from an IRQ, DMA
+   reach of an address (not DTCM), DMA stream mode (re-initialised on change), packed DMA on/off,
+   SPI kernel clock (SCK = kernel clock / prescaler), nominal payload bytes/s of the device.
+   spi_app_hal_xfer() / spi_app_fast_xfer(): one blocking transfer through the HAL (split in
+   SPI_APP_CHUNK_MAX chunks) or the registers (len <= SPI_APP_CHUNK_MAX), bus and CS held by the caller */
+void spi_app_events_set(SPI_APP_Device *dev, uint32_t mask);
+uint8_t spi_app_dma_reachable(const void *addr);
+HAL_StatusTypeDef spi_app_dma_mode(DMA_HandleTypeDef *hdma, uint32_t mode);
+HAL_StatusTypeDef spi_app_dma_pack(SPI_APP_Device *dev, uint8_t on);
+uint32_t spi_app_kernel_clock(const SPI_APP_Device *dev);
+uint32_t spi_app_byte_rate(const SPI_APP_Device *dev);
+HAL_StatusTypeDef spi_app_hal_xfer(SPI_APP_Device *dev, const uint8_t *tx, uint8_t *rx, uint32_t len,
+                                   uint32_t timeout);
+HAL_StatusTypeDef spi_app_fast_xfer(SPI_APP_Device *dev, const uint8_t *tx, uint8_t *rx, uint32_t len);
+
+/* STM32H7 D-cache helpers (no-op while the D-cache is disabled) */
 void spi_app_cache_clean(const void *addr, uint32_t size);
 void spi_app_cache_invalidate(void *addr, uint32_t size);
+uint8_t spi_app_cache_rx_safe(const void *addr, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* INC_SPI_APP_H_ */
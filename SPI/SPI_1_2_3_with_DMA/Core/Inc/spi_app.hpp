@@ -0,0 +1,201 @@
+/**
+  ******************************************************************************
+  * @file           : spi_app.hpp
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_APP_HPP_
+#define INC_SPI_APP_HPP_
+
+#include <stdint.h>
+#include <type_traits>
+#include "spi_app.h"
+
+/* Compile-time specialized devices (header only). Instance, CS, polarity, mode and frame size
+   are template parameters: CS is a single BSRR store and the register-level transfer has no
+   runtime branch on the configuration. init() builds the matching SPI_APP_Device for the C API
+   (DMA, queue, streaming, shared bus); the template transfers take its bus lock too */
+namespace spi_app {
+
+/* Chip select: port base (GPIOx_BASE), pin (GPIO_PIN_x) and polarity fixed at compile time */
+template <uint32_t PortBase, uint16_t Pin, bool ActiveLow = true>
+struct Cs
+{
+    static constexpr uint16_t pin = Pin;
+    static constexpr uint8_t active_low = ActiveLow ? 1u : 0u;
+
+    /* BSRR: low half sets the pin, high half resets it */
+    static constexpr uint32_t assert_bits = ActiveLow ? ((uint32_t)Pin << 16) : Pin;
+    static constexpr uint32_t release_bits = ActiveLow ? Pin : ((uint32_t)Pin << 16);
+
+    static GPIO_TypeDef *port() { return reinterpret_cast<GPIO_TypeDef *>(PortBase); }
+
+    /* Same meaning as spi_app_cs_low() / spi_app_cs_high(): assert / release */
+    static inline void low() { port()->BSRR = assert_bits; }
+    static inline void high() { port()->BSRR = release_bits; }
+};
+
+template <uint32_t SpiBase, class CS, uint32_t DataSize = SPI_DATASIZE_8BIT,
+          uint32_t Polarity = SPI_POLARITY_LOW, uint32_t Phase = SPI_PHASE_1EDGE>
+struct Device
+{
+    typedef typename std::conditional<(DataSize <= SPI_DATASIZE_8BIT), uint8_t,
+            typename std::conditional<(DataSize <= SPI_DATASIZE_16BIT), uint16_t, uint32_t>::type>::type frame_t;
+
+    static SPI_TypeDef *spi() { return reinterpret_cast<SPI_TypeDef *>(SpiBase); }
+
+    /* C handle for the rest of the API, same CS. hspi->Init (or the SPI_APP_Config given to
+       spi_app_bus_attach() on a shared bus) must match the template settings. Required before the
+       first transfer: the HAL state and the bus lock live in this handle */
+    static void init(SPI_APP_Device *dev, SPI_HandleTypeDef *hspi)
+    {
+        spi_app_initStruct(dev, hspi, CS::port(), CS::pin, CS::active_low);
+        handle = dev;
+    }
+
+    /* Load frame size and mode (SPE off), for an instance shared with other settings. The C
+       shared bus does not track it: use it on an exclusive instance */
+    static void configure()
+    {
+        MODIFY_REG(spi()->CFG1, SPI_CFG1_DSIZE, DataSize);
+        MODIFY_REG(spi()->CFG2, SPI_CFG2_CPOL | SPI_CFG2_CPHA, Polarity | Phase);
+    }
+
+    /* Blocking register-level transfers with CS, len <= 0xFFFF frames. HAL_BUSY while a DMA,
+       IT or stream transfer of the C API holds the peripheral, or another device holds the shared
+       bus; the bus switches to this device's settings first, as in spi_app_transfer_fast() */
+    static HAL_StatusTypeDef transfer(const frame_t *tx, frame_t *rx, uint32_t len) { return run<true, true>(tx, rx, len); }
+    static HAL_StatusTypeDef write(const frame_t *tx, uint32_t len) { return run<true, false>(tx, 0, len); }
+    static HAL_StatusTypeDef read(frame_t *rx, uint32_t len) { return run<false, true>(0, rx, len); }
+
+    /* Cycles per iteration, [0] C API, [1] template: CS assert + release, and a full blocking
+       transaction (spi_app_transfer_fast() against transfer()) */
+    static HAL_StatusTypeDef bench(SPI_APP_Device *dev, frame_t *tx, frame_t *rx, uint32_t len, uint32_t count,
+                                   uint32_t cs[2], uint32_t xfer[2])
+    {
+        HAL_StatusTypeDef ret = HAL_OK;
+        uint32_t start;
+
+        if (count == 0)
+            return HAL_ERROR;
+
+        spi_app_cycles_init();
+
+        start = spi_app_cycles();
+        for (uint32_t i = 0; i < count; i++)
+        {
+            spi_app_cs_low(dev);
+            spi_app_cs_high(dev);
+        }
+        cs[0] = (spi_app_cycles() - start) / count;
+
+        start = spi_app_cycles();
+        for (uint32_t i = 0; i < count; i++)
+        {
+            CS::low();
+            CS::high();
+        }
+        cs[1] = (spi_app_cycles() - start) / count;
+
+        start = spi_app_cycles();
+        for (uint32_t i = 0; i < count && ret == HAL_OK; i++)
+            ret = spi_app_transfer_fast(dev, reinterpret_cast<uint8_t *>(tx), reinterpret_cast<uint8_t *>(rx), len);
+        xfer[0] = (spi_app_cycles() - start) / count;
+
+        start = spi_app_cycles();
+        for (uint32_t i = 0; i < count && ret == HAL_OK; i++)
+            ret = transfer(tx, rx, len);
+        xfer[1] = (spi_app_cycles() - start) / count;
+
+        return ret;
+    }
+
+private:
+    static SPI_APP_Device *handle;
+
+    /* COMM for the direction: full duplex, simplex transmitter or simplex receiver */
+    static constexpr uint32_t comm(bool tx, bool rx) { return (tx && rx) ? 0u : (tx ? SPI_CFG2_COMM_0 : SPI_CFG2_COMM_1); }
+
+    /* Same register sequence as spi_app_transfer_fast(), with access width, direction and
+       FIFO service resolved at compile time */
+    template <bool Tx, bool Rx>
+    static HAL_StatusTypeDef run(const frame_t *tx, frame_t *rx, uint32_t len)
+    {
+        SPI_TypeDef *s = spi();
+        uint32_t tx_left = Tx ? len : 0u;
+        uint32_t rx_left = Rx ? len : 0u;
+        uint32_t spin = SPI_APP_FAST_SPIN;
+        uint32_t sr;
+        HAL_StatusTypeDef ret = HAL_OK;
+
+        if (len == 0u || len > 0xFFFFu || handle == 0 || handle->hspi->Instance != s)
+            return HAL_ERROR;
+
+        /* A DMA, IT or stream transfer owns the peripheral */
+        if (handle->hspi->State != HAL_SPI_STATE_READY || (s->CR1 & SPI_CR1_SPE))
+            return HAL_BUSY;
+
+        ret = spi_app_bus_acquire(handle);
+        if (ret != HAL_OK)
+            return ret;
+
+        /* Frame width of the registers (the bus device's own settings) against the template */
+        if ((s->CFG1 & SPI_CFG1_DSIZE) != DataSize)
+        {
+            spi_app_bus_release(handle);
+            return HAL_ERROR;
+        }
+
+        MODIFY_REG(s->CFG2, SPI_CFG2_COMM, comm(Tx, Rx));
+        MODIFY_REG(s->CFG1, SPI_CFG1_FTHLV, SPI_FIFO_THRESHOLD_01DATA);
+        MODIFY_REG(s->CR2, SPI_CR2_TSIZE, len);
+
+        CS::low();
+        SET_BIT(s->CR1, SPI_CR1_SPE);
+        SET_BIT(s->CR1, SPI_CR1_CSTART);
+
+        while ((tx_left || rx_left) && spin)
+        {
+            sr = s->SR;
+            spin--;
+
+            if (Tx && tx_left && (sr & SPI_SR_TXP))
+            {
+                *(volatile frame_t *)&s->TXDR = *tx++;
+                tx_left--;
+                spin = SPI_APP_FAST_SPIN;
+            }
+
+            if (Rx && rx_left && (sr & (SPI_SR_RXP | SPI_SR_RXWNE | SPI_SR_RXPLVL)))
+            {
+                *rx++ = *(volatile frame_t *)&s->RXDR;
+                rx_left--;
+                spin = SPI_APP_FAST_SPIN;
+            }
+        }
+
+        while (spin && !(s->SR & SPI_SR_EOT))
+            spin--;
+
+        sr = s->SR;
+        if (spin == 0u) ret = HAL_TIMEOUT;
+        else if (sr & (SPI_SR_OVR | SPI_SR_UDR | SPI_SR_MODF | SPI_SR_CRCE)) ret = HAL_ERROR;
+
+        SET_BIT(s->IFCR, SPI_IFCR_EOTC | SPI_IFCR_TXTFC | SPI_IFCR_OVRC | SPI_IFCR_UDRC | SPI_IFCR_MODFC |
+                         SPI_IFCR_CRCEC);
+        CLEAR_BIT(s->CR1, SPI_CR1_SPE);
+        CS::high();
+
+        spi_app_bus_release(handle);
+        return ret;
+    }
+};
+
+template <uint32_t SpiBase, class CS, uint32_t DataSize, uint32_t Polarity, uint32_t Phase>
+SPI_APP_Device *Device<SpiBase, CS, DataSize, Polarity, Phase>::handle = 0;
+
+} // namespace spi_app
+
+#endif /* INC_SPI_APP_HPP_ */
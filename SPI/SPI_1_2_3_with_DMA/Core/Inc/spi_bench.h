@@ -0,0 +1,53 @@
+/**
+  ******************************************************************************
+  * @file           : spi_bench.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_BENCH_H_
+#define INC_SPI_BENCH_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Transfer directions of a suite row */
+#define SPI_BENCH_WRITE     0u
+#define SPI_BENCH_READ      1u
+#define SPI_BENCH_TRANSFER  2u
+
+/* Suite row: method x direction x length, DWT cycles (best of 3 runs) */
+typedef struct {
+    uint8_t method;            // SPI_APP_XFER_POLL / IT / DMA
+    uint8_t dir;               // SPI_BENCH_WRITE / READ / TRANSFER
+    uint32_t len;              // frames
+    uint32_t lat;              // call to completion
+    uint32_t cpu;              // CPU busy (all of lat when polling)
+    uint32_t overhead;         // lat beyond the SCK time of the payload: CS, setup, completion
+    uint32_t bytes_per_s;      // effective throughput
+} SPI_BENCH_Row;
+
+/* On-target benchmarks (DWT cycle counter), run on an idle device */
+uint32_t spi_bench_txn_rate(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len, uint32_t count);
+HAL_StatusTypeDef spi_bench_pack(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len,
+                                 uint32_t requests[2], uint32_t cycles[2]);
+HAL_StatusTypeDef spi_bench_fast(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len, uint32_t count,
+                                 uint32_t *hal_cycles, uint32_t *fast_cycles);
+
+/* Benchmark suite: write, read and transfer, each by polling, IT and DMA (methods the device
+   cannot run are skipped), for 1, 2, 4 .. max_len frames. Run it on each device (SPI1/2/3 with
+   their CubeMX frame size and mode). tx / rx: max_len frames, SPI_APP_DMA_BUFFER. cs: cycles of
+   one CS assert + release (may be NULL). Returns the rows filled (stops early on an error) */
+uint32_t spi_bench_suite(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t max_len,
+                         SPI_BENCH_Row *row, uint32_t max_rows, uint32_t *cs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_BENCH_H_ */
@@ -0,0 +1,112 @@
+/**
+  ******************************************************************************
+  * @file           : spi_link.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_LINK_H_
+#define INC_SPI_LINK_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Exchange slot (bytes, multiple of the cache line): both sides send and receive one per transaction */
+#ifndef SPI_LINK_SLOT
+#define SPI_LINK_SLOT       64u
+#endif
+
+/* Frames in flight per direction (power of 2, at most 8: selective ACK bitmap) */
+#ifndef SPI_LINK_WINDOW
+#define SPI_LINK_WINDOW     8u
+#endif
+
+/* Exchanges without ACK before a frame is sent again: the ACK of a frame comes back in the next
+   exchange, and is used for the one after it */
+#ifndef SPI_LINK_RTO
+#define SPI_LINK_RTO        2u
+#endif
+
+/* Timeout of one exchange (ms) */
+#ifndef SPI_LINK_TIMEOUT
+#define SPI_LINK_TIMEOUT    10u
+#endif
+
+/* Slot: flags, seq, ack, sack, len, payload, CRC-32. Error limit: at 64-byte slots the CRC-32 has
+   Hamming distance 5, so slots with up to 4 bit errors (or one burst up to 32 bits) are always
+   dropped. A slot with 5 or more (about (512 p)^5 / 120 of them at a bit error rate p) passes with
+   probability about 2^-32: some 7 * 10^-14 corrupted payloads delivered per slot at p = 1000 ppm */
+#define SPI_LINK_HDR        5u
+#define SPI_LINK_CRC        4u
+#define SPI_LINK_PAYLOAD    (SPI_LINK_SLOT - SPI_LINK_HDR - SPI_LINK_CRC)
+
+struct SPI_LINK_Endpoint;
+
+/* In-order delivery of a received payload (exchange context: thread for the master, IRQ for the slave) */
+typedef void (*SPI_LINK_RxCb)(struct SPI_LINK_Endpoint *link, const uint8_t *data, uint8_t len, void *ctx);
+
+/* One end of the link. Holds the DMA slots: keep it out of DTCM (DMA1/DMA2 cannot reach it) */
+typedef struct SPI_LINK_Endpoint {
+    uint8_t tx[SPI_LINK_SLOT] __attribute__((aligned(SPI_APP_CACHE_LINE)));
+    uint8_t rx[SPI_LINK_SLOT] __attribute__((aligned(SPI_APP_CACHE_LINE)));
+
+    SPI_LINK_RxCb cb;
+    void *ctx;
+    SPI_HandleTypeDef *hspi;           // slave side: handle re-armed after every exchange
+
+    /* Sender: frames [tx_base, tx_next) are queued, [tx_base, tx_unsent) have been sent */
+    uint8_t win[SPI_LINK_WINDOW][SPI_LINK_PAYLOAD];
+    uint8_t win_len[SPI_LINK_WINDOW];
+    uint32_t win_sent[SPI_LINK_WINDOW];    // exchange of the last send
+    uint8_t win_acked;                 // bit (seq % SPI_LINK_WINDOW): acknowledged
+    uint8_t tx_base;
+    uint8_t tx_unsent;
+    uint8_t tx_next;
+
+    /* Receiver: rx_next is the next sequence number delivered, later ones are held */
+    uint8_t held[SPI_LINK_WINDOW][SPI_LINK_PAYLOAD];
+    uint8_t held_len[SPI_LINK_WINDOW];
+    uint8_t held_map;                  // bit (seq % SPI_LINK_WINDOW): held
+    uint8_t rx_next;
+
+    /* Statistics */
+    uint32_t exchanges;
+    uint32_t frames;                   // data frames sent, retransmissions included
+    uint32_t retransmits;
+    uint32_t crc_errors;               // slots dropped
+    uint32_t duplicates;               // frames received again (their ACK was lost)
+    uint32_t delivered;                // payloads passed to cb
+    uint32_t acked_bytes;              // payload bytes confirmed by the peer
+} SPI_LINK_Endpoint;
+
+void spi_link_init(SPI_LINK_Endpoint *link, SPI_LINK_RxCb cb, void *ctx);
+
+/* Queue one payload (up to SPI_LINK_PAYLOAD bytes); HAL_BUSY while the window is full.
+   send() and unacked() are safe from thread context against the slave DMA IRQ */
+HAL_StatusTypeDef spi_link_send(SPI_LINK_Endpoint *link, const uint8_t *data, uint8_t len);
+
+/* Payloads queued and not acknowledged yet */
+uint8_t spi_link_unacked(const SPI_LINK_Endpoint *link);
+
+/* Master: one exchange, a single full-duplex transaction of SPI_LINK_SLOT bytes on dev (DMA,
+   IT or polling as spi_app_xfer() picks). Lost or corrupted slots are recovered by the peer's
+   selective ACK; the master must leave the slave time to re-arm between two exchanges */
+HAL_StatusTypeDef spi_link_exchange(SPI_LINK_Endpoint *link, SPI_APP_Device *dev);
+
+/* Slave: hspi configured as SPI slave with DMA on both directions. Arm once; then call
+   spi_link_slave_cplt() from HAL_SPI_TxRxCpltCallback and spi_link_slave_error() from
+   HAL_SPI_ErrorCallback, both re-arm the next exchange */
+HAL_StatusTypeDef spi_link_slave_arm(SPI_LINK_Endpoint *link, SPI_HandleTypeDef *hspi);
+void spi_link_slave_cplt(SPI_LINK_Endpoint *link);
+void spi_link_slave_error(SPI_LINK_Endpoint *link);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_LINK_H_ */
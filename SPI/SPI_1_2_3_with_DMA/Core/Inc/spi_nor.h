@@ -0,0 +1,97 @@
+/**
+  ******************************************************************************
+  * @file           : spi_nor.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_NOR_H_
+#define INC_SPI_NOR_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Geometry common to SPI NOR parts: program page and smallest erase unit (bytes) */
+#define SPI_NOR_PAGE        256u
+#define SPI_NOR_SECTOR      4096u
+
+/* Read-ahead window (bytes, multiple of the cache line): shorter reads go through two of them */
+#ifndef SPI_NOR_LINE
+#define SPI_NOR_LINE        512u
+#endif
+
+/* Timeouts (ms): one SPI transfer, page program, sector erase */
+#ifndef SPI_NOR_XFER_TIMEOUT
+#define SPI_NOR_XFER_TIMEOUT    100u
+#endif
+#ifndef SPI_NOR_PROG_TIMEOUT
+#define SPI_NOR_PROG_TIMEOUT    10u
+#endif
+#ifndef SPI_NOR_ERASE_TIMEOUT
+#define SPI_NOR_ERASE_TIMEOUT   500u
+#endif
+
+/* SPI NOR flash on an 8-bit SPI_APP_Device (software CS). The handle holds the DMA buffers:
+   keep it out of DTCM (DMA1/DMA2 cannot reach it) */
+typedef struct {
+    /* Read-ahead: two windows, the one after a sequential read is prefetched by DMA */
+    uint8_t line[2][SPI_NOR_LINE] __attribute__((aligned(SPI_APP_CACHE_LINE)));
+    /* Write-behind: one page is filled while the other one is being programmed */
+    uint8_t page[2][SPI_NOR_PAGE] __attribute__((aligned(SPI_APP_CACHE_LINE)));
+
+    SPI_APP_Device *dev;
+    uint32_t jedec_id;          // manufacturer, type, capacity
+    uint32_t size;              // bytes
+    uint8_t addr_bytes;         // 3, or 4 above 16 MB (4-byte address opcodes, no mode switch)
+    uint8_t op_read;            // FAST_READ, one dummy byte
+    uint8_t op_prog;
+    uint8_t op_erase;
+    uint8_t async;              // DMA streams available: programs and prefetches run in the background
+
+    /* Command header and segments of the transfer in flight */
+    uint8_t hdr[8];
+    SPI_APP_Seg seg[2];
+    uint8_t dma_busy;           // DMA started and not waited for yet
+    uint32_t wip;               // program / erase issued: busy-poll timeout (ms), 0: flash idle
+
+    uint32_t line_addr[2];      // flash address of each window (0xFFFFFFFF: empty)
+    int8_t fetch;               // window being prefetched (-1: none)
+    uint8_t line_mru;           // window used last
+    uint32_t next_addr;         // end of the last read (sequential detection)
+
+    uint32_t page_addr[2];      // page held by each buffer (0xFFFFFFFF: empty)
+    uint16_t page_lo[2];        // filled range [lo, hi) of each buffer
+    uint16_t page_hi[2];
+    uint8_t fill;               // buffer being filled
+
+    /* Statistics */
+    uint32_t hits;              // reads served by a window
+    uint32_t misses;            // windows loaded on demand
+    uint32_t prefetches;        // windows loaded ahead
+    uint32_t pages;             // page programs issued
+    uint32_t polls;             // status register reads
+} SPI_NOR_Flash;
+
+/* Reads the JEDEC ID; size 0: taken from its capacity code */
+HAL_StatusTypeDef spi_nor_init(SPI_NOR_Flash *nor, SPI_APP_Device *dev, uint32_t size);
+
+/* Reads up to SPI_NOR_LINE go through the read-ahead windows, longer ones go straight to buf.
+   Writes are buffered per page and programmed when the page changes or is full, so the next
+   page is filled while the flash programs the previous one; spi_nor_sync() flushes the last one.
+   Erase: addr and len multiples of SPI_NOR_SECTOR.
+   Fast read only: dual/quad output needs a QUADSPI/OCTOSPI interface, the SPI has a single MISO */
+HAL_StatusTypeDef spi_nor_read(SPI_NOR_Flash *nor, uint32_t addr, uint8_t *buf, uint32_t len);
+HAL_StatusTypeDef spi_nor_write(SPI_NOR_Flash *nor, uint32_t addr, const uint8_t *data, uint32_t len);
+HAL_StatusTypeDef spi_nor_erase(SPI_NOR_Flash *nor, uint32_t addr, uint32_t len);
+HAL_StatusTypeDef spi_nor_sync(SPI_NOR_Flash *nor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_NOR_H_ */
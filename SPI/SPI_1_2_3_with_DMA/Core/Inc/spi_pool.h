@@ -0,0 +1,73 @@
+/**
+  ******************************************************************************
+  * @file           : spi_pool.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_POOL_H_
+#define INC_SPI_POOL_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Block size (bytes, multiple of the cache line) and count (<= 32) */
+#ifndef SPI_POOL_BLOCK
+#define SPI_POOL_BLOCK      256u
+#endif
+#ifndef SPI_POOL_COUNT
+#define SPI_POOL_COUNT      8u
+#endif
+
+/* Submissions in flight at once (one per device) */
+#ifndef SPI_POOL_XFERS
+#define SPI_POOL_XFERS      4u
+#endif
+
+struct SPI_POOL_Pool;
+
+/* Submission in flight: its blocks and the device callback it chains to */
+typedef struct {
+    struct SPI_POOL_Pool *pool;
+    SPI_APP_Device *dev;               // 0: slot free
+    uint8_t *tx;
+    uint8_t *rx;
+    SPI_APP_DoneCb prev_cb;
+    void *prev_ctx;
+} SPI_POOL_Xfer;
+
+/* Zero-copy DMA buffers: whole cache lines, so no bounce and no partial-line maintenance.
+   Declare the pool SPI_APP_DMA_BUFFER */
+typedef struct SPI_POOL_Pool {
+    uint8_t mem[SPI_POOL_COUNT][SPI_POOL_BLOCK] __attribute__((aligned(SPI_APP_CACHE_LINE)));
+
+    volatile uint32_t used;            // bit n: block n acquired
+    volatile uint32_t driver;          // bit n: block n owned by the driver (in flight)
+    uint32_t peak;
+    SPI_POOL_Xfer xfer[SPI_POOL_XFERS];
+} SPI_POOL_Pool;
+
+/* All blocks free */
+void spi_pool_init(SPI_POOL_Pool *pool);
+
+/* Acquire a block, fill it, submit it; the driver owns the blocks until completion. The TX block
+   then goes back to the pool, the RX block is handed to the application (device callback), which
+   releases it once consumed. Release gives HAL_BUSY while the block is in flight */
+uint8_t *spi_pool_acquire(SPI_POOL_Pool *pool);
+HAL_StatusTypeDef spi_pool_release(SPI_POOL_Pool *pool, uint8_t *block);
+HAL_StatusTypeDef spi_pool_submit(SPI_POOL_Pool *pool, SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx,
+                                  uint32_t len);
+
+uint32_t spi_pool_in_use(const SPI_POOL_Pool *pool);
+uint32_t spi_pool_high_water(const SPI_POOL_Pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_POOL_H_ */
@@ -0,0 +1,84 @@
+/**
+  ******************************************************************************
+  * @file           : spi_reg.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_REG_H_
+#define INC_SPI_REG_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Registers covered by the map (addresses 0 .. SPI_REG_COUNT - 1) */
+#ifndef SPI_REG_COUNT
+#define SPI_REG_COUNT       128u
+#endif
+
+/* Clean cached registers a flush may write back to join two dirty runs in one burst */
+#ifndef SPI_REG_GAP
+#define SPI_REG_GAP         2u
+#endif
+
+/* Timeout of one SPI transaction (ms) */
+#ifndef SPI_REG_TIMEOUT
+#define SPI_REG_TIMEOUT     10u
+#endif
+
+#define SPI_REG_WORDS       ((SPI_REG_COUNT + 31u) / 32u)
+
+/* Register map of a sensor-style device on an 8-bit SPI_APP_Device: address byte (plus read and
+   auto-increment flags) followed by the data, one byte per register */
+typedef struct {
+    SPI_APP_Device *dev;
+    uint8_t read_bit;                  // address flag for reads (0x80 on most sensors)
+    uint8_t inc_bit;                   // address flag for bursts (0x40 on some ST parts, 0: always on)
+
+    uint8_t val[SPI_REG_COUNT];        // shadow values (pending ones for dirty registers)
+    uint32_t valid[SPI_REG_WORDS];     // bit: shadow holds the device value
+    uint32_t dirty[SPI_REG_WORDS];     // bit: written to the shadow, waiting for spi_reg_flush()
+    uint32_t volat[SPI_REG_WORDS];     // bit: never cached (status, data, self-clearing bits)
+
+    uint8_t hdr;
+    SPI_APP_Seg seg[2];
+
+    /* Statistics */
+    uint32_t xfers;                    // SPI transactions issued
+    uint32_t hits;                     // reads served by the shadow
+    uint32_t saved;                    // transactions avoided against one per register access
+} SPI_REG_Map;
+
+/* Empty cache, all registers cacheable. No SPI traffic */
+HAL_StatusTypeDef spi_reg_init(SPI_REG_Map *map, SPI_APP_Device *dev, uint8_t read_bit, uint8_t inc_bit);
+
+/* Registers the device changes by itself: always read from the device, writes never skipped */
+void spi_reg_volatile(SPI_REG_Map *map, uint8_t reg, uint8_t count);
+
+/* Forget the cached values (device reset); pending writes are dropped too */
+void spi_reg_invalidate(SPI_REG_Map *map);
+
+/* Reads: served by the shadow when cached. A burst always reads the device (one transaction)
+   and refreshes the shadow of the cacheable registers it covers */
+HAL_StatusTypeDef spi_reg_read(SPI_REG_Map *map, uint8_t reg, uint8_t *val);
+HAL_StatusTypeDef spi_reg_read_burst(SPI_REG_Map *map, uint8_t reg, uint8_t *buf, uint8_t len);
+
+/* Write-through: one transaction, skipped when the cached value is already val */
+HAL_StatusTypeDef spi_reg_write(SPI_REG_Map *map, uint8_t reg, uint8_t val);
+
+/* Deferred writes: only the shadow changes (update: read-modify-write of the bits in mask).
+   spi_reg_flush() writes each run of dirty registers as one auto-increment burst */
+HAL_StatusTypeDef spi_reg_stage(SPI_REG_Map *map, uint8_t reg, uint8_t val);
+HAL_StatusTypeDef spi_reg_update(SPI_REG_Map *map, uint8_t reg, uint8_t mask, uint8_t val);
+HAL_StatusTypeDef spi_reg_flush(SPI_REG_Map *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_REG_H_ */
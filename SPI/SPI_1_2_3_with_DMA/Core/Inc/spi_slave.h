@@ -0,0 +1,75 @@
+/**
+  ******************************************************************************
+  * @file           : spi_slave.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_SLAVE_H_
+#define INC_SPI_SLAVE_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SPI_SLAVE_Rx;
+
+/* Callback flags */
+#define SPI_SLAVE_PKT_END   (1u << 0)  // NSS released: last piece of the packet
+#define SPI_SLAVE_PKT_DROP  (1u << 1)  // packet lost (overrun / error): discard the pieces already received
+
+/* A piece of the current packet (len frames, in the ring, valid until return) */
+typedef void (*SPI_SLAVE_Cb)(struct SPI_SLAVE_Rx *slv, const uint8_t *data, uint32_t len, uint8_t flags, void *ctx);
+
+/* SPI slave receiving a continuous stream: circular RX DMA, packets delimited by NSS */
+typedef struct SPI_SLAVE_Rx {
+    SPI_HandleTypeDef *hspi;
+    GPIO_TypeDef *NSS_Port;
+    uint16_t NSS_Pin;
+
+    uint8_t *ring;
+    uint32_t ring_len;                 // frames
+    uint32_t frame_bytes;
+    uint32_t rd;                       // next frame to deliver
+    uint32_t pkt_len;                  // frames delivered for the packet in progress
+    SPI_SLAVE_Cb cb;
+    void *ctx;
+    volatile uint8_t on;
+    uint8_t resync;                    // data discarded until the next NSS release
+
+    /* Statistics (cleared by spi_slave_start) */
+    volatile uint32_t packets;
+    volatile uint32_t frames;
+    volatile uint32_t dropped;         // packets reported with SPI_SLAVE_PKT_DROP
+    volatile uint32_t fifo_overruns;   // SPI OVR: RX FIFO full before the DMA emptied it
+    volatile uint32_t ring_overruns;   // DMA went past the delivery point (IRQ held off too long)
+    volatile uint32_t errors;          // other SPI errors (MODF, FRE)
+} SPI_SLAVE_Rx;
+
+/* hspi becomes a slave with hardware NSS input (active low, pin in alternate
+   function alternate) and an EXTI on the NSS rising edge. The application enables the EXTI IRQ of
+   the pin and calls spi_slave_nss_edge() from HAL_GPIO_EXTI_Callback(), at the same priority
+   as the RX DMA IRQ. ring: ring_len frames (even), SPI_APP_DMA_BUFFER. cb gets every packet in
+   order, in pieces at half-ring boundaries and a last one (SPI_SLAVE_PKT_END) when NSS is released;
+   nothing is re-armed per packet */
+HAL_StatusTypeDef spi_slave_init(SPI_SLAVE_Rx *slv, SPI_HandleTypeDef *hspi,
+                                 GPIO_TypeDef *NSS_Port, uint16_t NSS_Pin, uint8_t alternate);
+HAL_StatusTypeDef spi_slave_start(SPI_SLAVE_Rx *slv, uint8_t *ring, uint16_t ring_len,
+                                  SPI_SLAVE_Cb cb, void *ctx);
+HAL_StatusTypeDef spi_slave_stop(SPI_SLAVE_Rx *slv);
+
+/* To be called from the HAL callbacks of the slave SPI and of its NSS EXTI line */
+void spi_slave_nss_edge(SPI_SLAVE_Rx *slv);
+void spi_slave_half_cplt(SPI_SLAVE_Rx *slv);
+void spi_slave_cplt(SPI_SLAVE_Rx *slv);
+void spi_slave_error(SPI_SLAVE_Rx *slv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_SLAVE_H_ */
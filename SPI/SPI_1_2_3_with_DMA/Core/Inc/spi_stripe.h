@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file           : spi_stripe.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_STRIPE_H_
+#define INC_SPI_STRIPE_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Devices per stripe set (one per SPI instance) */
+#ifndef SPI_STRIPE_MAX
+#define SPI_STRIPE_MAX      3u
+#endif
+
+struct SPI_STRIPE_Set;
+
+/* Striped transfer over: all stripes finished (HAL_ERROR if one of them failed) */
+typedef void (*SPI_STRIPE_Cb)(struct SPI_STRIPE_Set *s, HAL_StatusTypeDef status, void *ctx);
+
+/* One payload split over several devices that run in parallel, each on its own SPI and DMA
+   streams. Stripe sizes follow the payload rate of each device, so they finish together */
+typedef struct SPI_STRIPE_Set {
+    SPI_APP_Device *dev[SPI_STRIPE_MAX];
+    uint8_t count;
+
+    uint32_t rate[SPI_STRIPE_MAX];          // nominal payload bytes/s of each device
+    uint32_t off[SPI_STRIPE_MAX];           // bytes, last transfer
+    uint32_t len[SPI_STRIPE_MAX];           // bytes, last transfer (0: device not used)
+
+    SPI_STRIPE_Cb cb;
+    void *ctx;
+    SPI_APP_DoneCb prev_cb[SPI_STRIPE_MAX]; // device callbacks, restored at completion
+    void *prev_ctx[SPI_STRIPE_MAX];
+
+    volatile uint8_t pending;               // bit n: stripe n running
+    volatile uint8_t done;                  // 1 when all stripes finished
+    volatile uint8_t err;
+
+    /* DWT cycles: start of the last transfer, finish of each stripe (imbalance), total */
+    uint32_t t_start;
+    uint32_t t_done[SPI_STRIPE_MAX];
+    uint32_t cycles;
+    uint32_t bytes;
+} SPI_STRIPE_Set;
+
+/* Striped transfer: tx/rx (either may be NULL) split in cache-line aligned stripes sized by the
+   nominal payload rate of each device (kernel clock / prescaler, frame size). len must be a
+   multiple of the frame size of every device. Devices without DMA or SPI IRQ run their stripe
+   blocking, after the DMA stripes have been started. Completion: cb (from the last stripe IRQ)
+   and s->done. spi_stripe_throughput() reports the aggregate bytes/s of the last transfer */
+HAL_StatusTypeDef spi_stripe_init(SPI_STRIPE_Set *s, SPI_APP_Device *const *dev, uint8_t count);
+HAL_StatusTypeDef spi_stripe_transfer(SPI_STRIPE_Set *s, uint8_t *tx, uint8_t *rx, uint32_t len,
+                                      SPI_STRIPE_Cb cb, void *ctx);
+uint32_t spi_stripe_throughput(const SPI_STRIPE_Set *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_STRIPE_H_ */
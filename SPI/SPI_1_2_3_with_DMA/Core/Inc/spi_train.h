@@ -0,0 +1,47 @@
+/**
+  ******************************************************************************
+  * @file           : spi_train.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_TRAIN_H_
+#define INC_SPI_TRAIN_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Largest pattern (bytes) and prescaler steps backed off from the first failure */
+#ifndef SPI_TRAIN_MAX
+#define SPI_TRAIN_MAX       64u
+#endif
+#ifndef SPI_TRAIN_MARGIN
+#define SPI_TRAIN_MARGIN    1u
+#endif
+
+/* Result of the last training of a device: the prescaler itself is kept in hspi->Init (and cfg
+   on a shared bus) */
+typedef struct {
+    SPI_APP_Device *dev;
+    uint32_t hz;                       // trained SCK frequency (0: not trained)
+    uint8_t pass;                      // bit n: prescaler 2^(n+1) passed
+} SPI_TRAIN_Link;
+
+/* Prescalers are tried from /256 towards /2, each with rounds transfers of tx that must read
+   back expect (ID register read), or tx itself if expect is NULL (MOSI-MISO loopback). tx NULL:
+   built-in loopback pattern. The sweep stops at the first failure and the fastest passing
+   prescaler, backed off by SPI_TRAIN_MARGIN steps, is kept. max_hz: SCK limit of the slave
+   (0: none). The H7 SPI has no RX sampling delay, so the prescaler is the only knob */
+HAL_StatusTypeDef spi_train_run(SPI_TRAIN_Link *link, SPI_APP_Device *dev, const uint8_t *tx, const uint8_t *expect,
+                                uint32_t len, uint32_t rounds, uint32_t max_hz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_TRAIN_H_ */
@@ -0,0 +1,54 @@
+/**
+  ******************************************************************************
+  * @file           : spi_txs.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+
+#ifndef INC_SPI_TXS_H_
+#define INC_SPI_TXS_H_
+
+#include <stdint.h>
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SPI_TXS_Stream;
+
+/* Refill: called from the DMA IRQ with the buffer just sent, while the other one is being sent.
+   Returns 0 if no data was written (the old content goes out again) */
+typedef uint8_t (*SPI_TXS_RefillCb)(struct SPI_TXS_Stream *txs, uint8_t *block, uint16_t len, void *ctx);
+
+/* Continuous TX streaming (DMA double buffer: memory 0 / memory 1) */
+typedef struct SPI_TXS_Stream {
+    SPI_APP_Device *dev;
+    uint8_t *buf[2];
+    uint16_t block;                    // frames per buffer
+    SPI_TXS_RefillCb cb;
+    void *ctx;
+    volatile uint8_t on;
+    volatile uint8_t ready;            // bit n: buffer n refilled since it was last sent
+
+    /* Statistics (cleared by spi_txs_start) */
+    volatile uint32_t blocks;          // buffers sent
+    volatile uint32_t underruns;       // buffers sent again without a refill, or refilled too late
+} SPI_TXS_Stream;
+
+/* The TX DMA stream runs in double-buffer mode over buf0 / buf1 (block_len frames each,
+   SPI_APP_DMA_BUFFER) and the SPI transmits with no end (TSIZE = 0), CS held, no idle frame
+   between buffers: the DMA switches buffers in hardware and the SPI FIFO never runs dry. Both
+   buffers must hold data at start; cb refills each one as soon as it has been sent (cb NULL: the
+   two buffers are repeated). SPI_APP_EVT_BLOCK per buffer sent. One TX stream at a time (SPI3
+   here); the device stays busy until stopped */
+HAL_StatusTypeDef spi_txs_start(SPI_TXS_Stream *txs, SPI_APP_Device *dev, uint8_t *buf0, uint8_t *buf1,
+                                uint16_t block_len, SPI_TXS_RefillCb cb, void *ctx);
+HAL_StatusTypeDef spi_txs_stop(SPI_TXS_Stream *txs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_SPI_TXS_H_ */
@@ -24,6 +24,7 @@
 
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "spi_app.h"
 
 /* USER CODE END Includes */
 
@@ -34,6 +35,8 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+/* Longest transfer measured by the startup calibration of spi_app_xfer() (frames) */
+#define SPI_CAL_LEN 64u
 
 /* USER CODE END PD */
 
@@ -45,6 +48,12 @@
 /* Private variables ---------------------------------------------------------*/
 
 /* USER CODE BEGIN PV */
+SPI_APP_Device spi1_dev;
+SPI_APP_Device spi2_dev;
+SPI_APP_Device spi3_dev;
+
+/* Calibration reads only (MOSI not driven): up to 16-bit frames */
+static uint8_t spi_cal_rx[SPI_CAL_LEN * 2u] SPI_APP_DMA_BUFFER;
 
 /* USER CODE END PV */
 
@@ -74,6 +83,14 @@ int main(void)
   /* MPU Configuration--------------------------------------------------------*/
   MPU_Config();
 
+  /* Enable the CPU Cache */
+
+  /* Enable I-Cache---------------------------------------------------------*/
+  SCB_EnableICache();
+
+  /* Enable D-Cache---------------------------------------------------------*/
+  SCB_EnableDCache();
+
   /* MCU Configuration--------------------------------------------------------*/
 
   /* Reset of all peripherals, Initializes the Flash interface and the Systick. */
@@ -87,6 +104,10 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
+  /* D2 SRAM hosts the .dma_buffer section (SPI DMA buffers) */
+  __HAL_RCC_D2SRAM1_CLK_ENABLE();
+  __HAL_RCC_D2SRAM2_CLK_ENABLE();
+  __HAL_RCC_D2SRAM3_CLK_ENABLE();
 
   /* USER CODE END SysInit */
 
@@ -97,6 +118,15 @@ int main(void)
   MX_SPI2_Init();
   MX_SPI3_Init();
   /* USER CODE BEGIN 2 */
+  spi_app_initStruct(&spi1_dev, &hspi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin, 1);
+  spi_app_initStruct(&spi2_dev, &hspi2, SPI2_CS_GPIO_Port, SPI2_CS_Pin, 1);
+  spi_app_initStruct(&spi3_dev, &hspi3, SPI3_CS_GPIO_Port, SPI3_CS_Pin, 1);
+
+  /* Poll / IT / DMA crossover points of spi_app_xfer() measured on this board; on failure the
+     SPI_APP_XFER_POLL_MAX / SPI_APP_XFER_IT_MAX defaults stay */
+  (void)spi_app_xfer_calibrate(&spi1_dev, 0, spi_cal_rx, SPI_CAL_LEN);
+  (void)spi_app_xfer_calibrate(&spi2_dev, 0, spi_cal_rx, SPI_CAL_LEN);
+  (void)spi_app_xfer_calibrate(&spi3_dev, 0, spi_cal_rx, SPI_CAL_LEN);
 
   /* USER CODE END 2 */
 
@@ -170,6 +200,44 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
+/* IT and DMA completions of the spi_app devices (SPI3 is the only one with its IRQ enabled) */
+static SPI_APP_Device *spi_dev_of(SPI_HandleTypeDef *hspi)
+{
+  if (hspi == &hspi1) return &spi1_dev;
+  if (hspi == &hspi2) return &spi2_dev;
+  if (hspi == &hspi3) return &spi3_dev;
+  return 0;
+}
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  SPI_APP_Device *dev = spi_dev_of(hspi);
+  if (dev) spi_app_dma_cplt(dev);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  SPI_APP_Device *dev = spi_dev_of(hspi);
+  if (dev) spi_app_dma_cplt(dev);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  SPI_APP_Device *dev = spi_dev_of(hspi);
+  if (dev) spi_app_dma_cplt(dev);
+}
+
+void HAL_SPI_RxHalfCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  SPI_APP_Device *dev = spi_dev_of(hspi);
+  if (dev) spi_app_dma_half_cplt(dev);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+  SPI_APP_Device *dev = spi_dev_of(hspi);
+  if (dev) spi_app_dma_error(dev);
+}
 
 /* USER CODE END 4 */
 
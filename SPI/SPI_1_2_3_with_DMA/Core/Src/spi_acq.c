@@ -0,0 +1,260 @@
+/**
+  ******************************************************************************
+  * @file           : spi_acq.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * TIM12 -> DMAMUX1 request generator 0 -> TX DMA -> SPI -> RX DMA
+*/
+
+/* Includes */
+#include "spi_acq.h"
+
+#define SPI_ACQ_IFCR_ALL    (SPI_IFCR_EOTC | SPI_IFCR_TXTFC | SPI_IFCR_UDRC | SPI_IFCR_OVRC | SPI_IFCR_CRCEC | \
+                             SPI_IFCR_TIFREC | SPI_IFCR_MODFC | SPI_IFCR_TSERFC | SPI_IFCR_SUSPC)
+
+/* The DMA callbacks only get the stream handle */
+static SPI_ACQ_Acq *spi_acq_active = 0;
+
+/* Half n of the ring is full; the DMA is now writing into the other one */
+static void spi_acq_deliver(SPI_ACQ_Acq *acq, uint8_t half)
+{
+    uint32_t bytes = acq->block * spi_app_frame_bytes(acq->dev);
+    uint8_t *block = acq->buf + half * bytes;
+
+    if (acq->pending & (1u << (half ^ 1u)))
+        acq->overruns++;
+
+    acq->pending |= (uint8_t)(1u << half);
+    acq->first = acq->blocks * acq->block;
+    acq->blocks++;
+    spi_app_events_set(acq->dev, SPI_APP_EVT_BLOCK);
+
+    spi_app_cache_invalidate(block, bytes);
+
+    if (acq->cb)
+        acq->cb(acq, block, acq->block, acq->ctx);
+}
+
+static void spi_acq_half(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+    spi_acq_deliver(spi_acq_active, 0);
+}
+
+static void spi_acq_full(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+    spi_acq_deliver(spi_acq_active, 1);
+}
+
+static void spi_acq_error(DMA_HandleTypeDef *hdma)
+{
+    SPI_ACQ_Acq *acq = spi_acq_active;
+    SPI_APP_Device *dev = acq->dev;
+
+    (void)hdma;
+    (void)spi_acq_stop(acq);
+
+    dev->dma_err = 1;
+    dev->dma_hal_error = HAL_SPI_ERROR_DMA;
+    spi_app_events_set(dev, SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR);
+}
+
+/* TIM12 (APB1, D2 domain): timer clock is PCLK1, doubled when APB1 is divided */
+static HAL_StatusTypeDef spi_acq_timer(uint32_t rate_hz)
+{
+    uint32_t clk = HAL_RCC_GetPCLK1Freq();
+    uint32_t ticks, psc;
+
+    if ((RCC->D2CFGR & RCC_D2CFGR_D2PPRE1) != RCC_APB1_DIV1)
+        clk *= 2u;
+
+    ticks = clk / rate_hz;
+    if (ticks < 2u)
+        return HAL_ERROR;
+
+    psc = (ticks - 1u) / 65536u;
+    ticks /= (psc + 1u);
+    if (psc > 0xFFFFu)
+        return HAL_ERROR;
+
+    __HAL_RCC_TIM12_CLK_ENABLE();
+    TIM12->CR1 = 0;
+    TIM12->PSC = psc;
+    TIM12->ARR = ticks - 1u;
+    TIM12->CNT = 0;
+    MODIFY_REG(TIM12->CR2, TIM_CR2_MMS, TIM_CR2_MMS_1);  // TRGO = update
+    TIM12->EGR = TIM_EGR_UG;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_acq_start(SPI_ACQ_Acq *acq, SPI_APP_Device *dev, uint32_t rate_hz, uint32_t cmd,
+                                uint8_t *buf, uint16_t block_len, SPI_ACQ_Cb cb, void *ctx)
+{
+    SPI_HandleTypeDef *hspi = dev->hspi;
+    SPI_TypeDef *spi = hspi->Instance;
+    HAL_DMA_MuxRequestGeneratorConfigTypeDef gen = {0};
+    uint32_t bytes;
+    HAL_StatusTypeDef ret;
+
+    if (buf == 0 || block_len == 0 || block_len > 0x7FFFu || rate_hz == 0 || !dev->hw_nss ||
+        hspi->hdmarx == 0 || hspi->hdmatx == 0 || spi_acq_active != 0 || !spi_app_dma_reachable(acq->cmd))
+        return HAL_ERROR;
+
+    if (!dev->dma_done || dev->stream_on || !spi_app_queue_idle(dev) || hspi->State != HAL_SPI_STATE_READY)
+        return HAL_BUSY;
+
+    ret = spi_app_bus_acquire(dev);
+    if (ret != HAL_OK)
+        return ret;
+
+    bytes = block_len * spi_app_frame_bytes(dev);
+    if (!spi_app_dma_reachable(buf) || !spi_app_cache_rx_safe(buf, bytes) || spi_acq_timer(rate_hz) != HAL_OK)
+    {
+        spi_app_bus_release(dev);
+        return HAL_ERROR;
+    }
+
+    spi_acq_active = acq;
+    acq->dev = dev;
+    acq->buf = buf;
+    acq->block = block_len;
+    acq->cb = cb;
+    acq->ctx = ctx;
+    acq->pending = 0;
+    acq->blocks = 0;
+    acq->overruns = 0;
+    acq->first = 0;
+    spi_app_events_clear(dev, SPI_APP_EVT_BLOCK | SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR);
+
+    acq->cmd[0] = cmd;
+    spi_app_cache_clean(acq->cmd, sizeof(acq->cmd));
+    spi_app_cache_invalidate(buf, 2u * bytes);
+
+    /* One frame per DMA request on both sides, both streams circular; TX paced by the generator */
+    acq->tx_request = hspi->hdmatx->Init.Request;
+    hspi->hdmatx->Init.Request = DMA_REQUEST_GENERATOR0;
+    hspi->hdmatx->Init.Mode = DMA_CIRCULAR;
+
+    ret = spi_app_dma_pack(dev, 0);
+    if (ret == HAL_OK) ret = HAL_DMA_Init(hspi->hdmatx);
+    if (ret == HAL_OK) ret = spi_app_dma_mode(hspi->hdmarx, DMA_CIRCULAR);
+
+    gen.SignalID = HAL_DMAMUX1_REQ_GEN_TIM12_TRGO;
+    gen.Polarity = HAL_DMAMUX_REQ_GEN_RISING;
+    gen.RequestNumber = 1;
+    if (ret == HAL_OK) ret = HAL_DMAEx_ConfigMuxRequestGenerator(hspi->hdmatx, &gen);
+
+    hspi->hdmarx->XferHalfCpltCallback = spi_acq_half;
+    hspi->hdmarx->XferCpltCallback = spi_acq_full;
+    hspi->hdmarx->XferErrorCallback = spi_acq_error;
+    hspi->hdmarx->XferAbortCallback = 0;
+    hspi->hdmatx->XferHalfCpltCallback = 0;
+    hspi->hdmatx->XferCpltCallback = 0;
+    hspi->hdmatx->XferErrorCallback = spi_acq_error;
+    hspi->hdmatx->XferAbortCallback = 0;
+
+    /* SPI (SPE off): endless full duplex, NSS pulsed inactive between frames (SSOM needs MIDI > 0) */
+    MODIFY_REG(spi->CFG2, SPI_CFG2_COMM, 0u);
+    SET_BIT(spi->CFG2, SPI_CFG2_SSOM);
+    if ((spi->CFG2 & SPI_CFG2_MIDI) == 0u)
+        MODIFY_REG(spi->CFG2, SPI_CFG2_MIDI, SPI_MASTER_INTERDATA_IDLENESS_01CYCLE);
+    MODIFY_REG(spi->CR2, SPI_CR2_TSIZE, 0u);
+    MODIFY_REG(spi->CFG1, SPI_CFG1_FTHLV, SPI_FIFO_THRESHOLD_01DATA);
+    SET_BIT(spi->IFCR, SPI_ACQ_IFCR_ALL);
+
+    /* The device reports busy to every other transfer until spi_acq_stop() */
+    dev->dma_done = 0;
+    dev->dma_err = 0;
+    dev->dma_hal_error = 0;
+    acq->on = 1;
+    hspi->State = HAL_SPI_STATE_BUSY_TX_RX;    // keeps the HAL and spi_app fast paths off the SPI
+
+    if (ret == HAL_OK)
+    {
+        SET_BIT(spi->CFG1, SPI_CFG1_RXDMAEN);
+        ret = HAL_DMA_Start_IT(hspi->hdmarx, (uint32_t)&spi->RXDR, (uint32_t)buf, 2u * block_len);
+    }
+    if (ret == HAL_OK) ret = HAL_DMA_Start(hspi->hdmatx, (uint32_t)acq->cmd, (uint32_t)&spi->TXDR, 1);
+    if (ret == HAL_OK) ret = HAL_DMAEx_EnableMuxRequestGenerator(hspi->hdmatx);
+
+    if (ret != HAL_OK)
+    {
+        (void)spi_acq_stop(acq);
+        dev->dma_err = 1;
+        return HAL_ERROR;
+    }
+
+    /* Master with an empty TX FIFO waits: every timer tick releases exactly one frame */
+    SET_BIT(spi->CFG1, SPI_CFG1_TXDMAEN);
+    SET_BIT(spi->CR1, SPI_CR1_SPE);
+    SET_BIT(spi->CR1, SPI_CR1_CSTART);
+    SET_BIT(TIM12->CR1, TIM_CR1_CEN);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_acq_release(SPI_ACQ_Acq *acq, const uint8_t *block)
+{
+    uint32_t primask;
+    uint8_t bit;
+
+    if (acq->buf == 0)
+        return HAL_ERROR;
+
+    if (block == acq->buf)
+        bit = 0x01u;
+    else if (block == acq->buf + acq->block * spi_app_frame_bytes(acq->dev))
+        bit = 0x02u;
+    else
+        return HAL_ERROR;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    acq->pending &= (uint8_t)~bit;
+    __set_PRIMASK(primask);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_acq_stop(SPI_ACQ_Acq *acq)
+{
+    SPI_APP_Device *dev = acq->dev;
+    SPI_HandleTypeDef *hspi;
+    SPI_TypeDef *spi;
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    if (!acq->on)
+        return HAL_OK;
+
+    hspi = dev->hspi;
+    spi = hspi->Instance;
+
+    CLEAR_BIT(TIM12->CR1, TIM_CR1_CEN);
+    (void)HAL_DMAEx_DisableMuxRequestGenerator(hspi->hdmatx);
+
+    /* Same teardown order as the HAL abort: SPI first, then the streams */
+    CLEAR_BIT(spi->CR1, SPI_CR1_SPE);
+    CLEAR_BIT(spi->CFG1, SPI_CFG1_TXDMAEN | SPI_CFG1_RXDMAEN);
+    if (HAL_DMA_Abort(hspi->hdmatx) != HAL_OK) ret = HAL_ERROR;
+    if (HAL_DMA_Abort(hspi->hdmarx) != HAL_OK) ret = HAL_ERROR;
+    SET_BIT(spi->IFCR, SPI_ACQ_IFCR_ALL);
+
+    /* Back to the HAL settings */
+    MODIFY_REG(spi->CFG2, SPI_CFG2_SSOM | SPI_CFG2_MIDI,
+               ((hspi->Init.NSSPMode == SPI_NSS_PULSE_ENABLE) ? SPI_CFG2_SSOM : 0u) | hspi->Init.MasterInterDataIdleness);
+    MODIFY_REG(spi->CFG1, SPI_CFG1_FTHLV, hspi->Init.FifoThreshold);
+
+    hspi->hdmatx->Init.Request = acq->tx_request;
+    hspi->hdmatx->Init.Mode = DMA_NORMAL;
+    if (HAL_DMA_Init(hspi->hdmatx) != HAL_OK) ret = HAL_ERROR;
+    if (spi_app_dma_mode(hspi->hdmarx, DMA_NORMAL) != HAL_OK) ret = HAL_ERROR;
+
+    hspi->State = HAL_SPI_STATE_READY;
+    acq->on = 0;
+    dev->dma_done = 1;
+    spi_acq_active = 0;
+    spi_app_bus_release(dev);
+
+    return ret;
+}
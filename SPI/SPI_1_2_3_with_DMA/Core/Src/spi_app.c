@@ -9,8 +9,27 @@
 #include "spi_app.h"
 #include <string.h>
 
-/* Local dummy TX buffer used to clock RX-only operations */
-static uint8_t spi_app_dummy_tx[256];
+/* Shared RX bounce buffer for receive buffers that are not cache-line safe */
+static uint8_t spi_app_bounce_rx[SPI_APP_BOUNCE_SIZE] SPI_APP_DMA_BUFFER;
+static volatile uint8_t spi_app_bounce_busy = 0;
+
+static HAL_StatusTypeDef spi_app_queue_start(SPI_APP_Device *dev);
+
+/* Latency timestamps: plain CYCCNT reads when enabled, nothing otherwise */
+#if SPI_APP_STATS
+static void spi_app_stats_record(SPI_APP_Device *dev, uint8_t err);
+#define SPI_APP_TS_START(dev)       ((dev)->ts_start = DWT->CYCCNT)
+#define SPI_APP_TS_WIRE(dev)        do { (dev)->ts_wire = DWT->CYCCNT; (dev)->ts_armed = 1; } while (0)
+#define SPI_APP_TS_CPLT(dev)        ((dev)->ts_cplt = DWT->CYCCNT)
+#define SPI_APP_TS_DISARM(dev)      ((dev)->ts_armed = 0)
+#define SPI_APP_TS_RECORD(dev, err) spi_app_stats_record((dev), (err))
+#else
+#define SPI_APP_TS_START(dev)       ((void)0)
+#define SPI_APP_TS_WIRE(dev)        ((void)0)
+#define SPI_APP_TS_CPLT(dev)        ((void)0)
+#define SPI_APP_TS_DISARM(dev)      ((void)0)
+#define SPI_APP_TS_RECORD(dev, err) ((void)0)
+#endif
 
 /* Functions */
 void spi_app_initStruct(SPI_APP_Device *dev,
@@ -23,22 +42,72 @@ void spi_app_initStruct(SPI_APP_Device *dev,
     dev->CS_Port = CS_Port;
     dev->CS_Pin = CS_Pin;
     dev->cs_active_low = cs_active_low;
+    dev->hw_nss = 0;
 
     dev->dma_done = 1;
     dev->dma_err = 0;
     dev->dma_hal_error = 0;
 
+    dev->done_cb = 0;
+    dev->done_ctx = 0;
+    dev->events = 0;
+
     dev->last_len = 0;
     dev->last_rx = 0;
     dev->last_tx = 0;
 
-    memset(spi_app_dummy_tx, 0xFF, sizeof(spi_app_dummy_tx));
+    dev->xfer_tx = 0;
+    dev->xfer_rx = 0;
+    dev->xfer_left = 0;
+    dev->vec = 0;
+    dev->vec_left = 0;
+    dev->xfer_it = 0;
+    dev->dma_pack = 0;
+    dev->dma_requests = 0;
+    dev->xfer_poll_max = SPI_APP_XFER_POLL_MAX;
+    dev->xfer_it_max = SPI_APP_XFER_IT_MAX;
+
+    dev->crc_retries = 0;
+    dev->crc_left = 0;
+    dev->crc_errors = 0;
+    dev->crc_failures = 0;
+
+    dev->bus = 0;
+    memset(&dev->cfg, 0, sizeof(dev->cfg));
+
+    dev->mdma = 0;
+    dev->mdma_src = 0;
+    dev->mdma_dst = 0;
+    dev->mdma_bytes = 0;
+
+
+#if SPI_APP_STATS
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    dev->ts_armed = 0;
+    spi_app_cycles_init();
+#endif
+
+    dev->bounce_dst = 0;
+    dev->queue = 0;
+
+    dev->stream_buf = 0;
+    dev->stream_block = 0;
+    dev->stream_cb = 0;
+    dev->stream_ctx = 0;
+    dev->stream_on = 0;
+    dev->stream_pending = 0;
+    dev->stream_blocks = 0;
+    dev->stream_overruns = 0;
+    dev->stream_first = 0;
 
     spi_app_cs_high(dev);
 }
 
 void spi_app_cs_low(SPI_APP_Device *dev)
 {
+    if (dev->hw_nss)
+        return;
+
     if (dev->cs_active_low)
         HAL_GPIO_WritePin(dev->CS_Port, dev->CS_Pin, GPIO_PIN_RESET);
     else
@@ -47,175 +116,1903 @@ void spi_app_cs_low(SPI_APP_Device *dev)
 
 void spi_app_cs_high(SPI_APP_Device *dev)
 {
+    if (dev->hw_nss)
+        return;
+
     if (dev->cs_active_low)
         HAL_GPIO_WritePin(dev->CS_Port, dev->CS_Pin, GPIO_PIN_SET);
     else
         HAL_GPIO_WritePin(dev->CS_Port, dev->CS_Pin, GPIO_PIN_RESET);
 }
 
-HAL_StatusTypeDef spi_app_write(SPI_APP_Device *dev, uint8_t *tx, uint16_t len, uint32_t timeout)
+/* Completion notification */
+void spi_app_events_set(SPI_APP_Device *dev, uint32_t mask)
 {
-    HAL_StatusTypeDef ret;
+    uint32_t primask = __get_PRIMASK();
 
-    spi_app_cs_low(dev);
-    ret = HAL_SPI_Transmit(dev->hspi, tx, len, timeout);
-    spi_app_cs_high(dev);
+    __disable_irq();
+    dev->events |= mask;
+    __set_PRIMASK(primask);
+}
 
-    return ret;
+void spi_app_events_clear(SPI_APP_Device *dev, uint32_t mask)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    dev->events &= ~mask;
+    __set_PRIMASK(primask);
 }
 
-HAL_StatusTypeDef spi_app_read(SPI_APP_Device *dev, uint8_t *rx, uint16_t len, uint32_t timeout)
+void spi_app_set_callback(SPI_APP_Device *dev, SPI_APP_DoneCb cb, void *ctx)
 {
-    HAL_StatusTypeDef ret = HAL_OK;
-    uint16_t remaining = len;
-    uint16_t offset = 0;
+    uint32_t primask = __get_PRIMASK();
 
-    spi_app_cs_low(dev);
+    __disable_irq();
+    dev->done_cb = cb;
+    dev->done_ctx = ctx;
+    __set_PRIMASK(primask);
+}
+
+/* timeout in ms (HAL tick), HAL_MAX_DELAY: forever */
+uint32_t spi_app_wait(SPI_APP_Device *dev, uint32_t mask, uint32_t timeout)
+{
+    uint32_t start = HAL_GetTick();
+    uint32_t primask;
+    uint32_t hit;
 
-    while (remaining > 0 && ret == HAL_OK)
+    for (;;)
     {
-        uint16_t chunk;
-        if (remaining > sizeof(spi_app_dummy_tx)) chunk = sizeof(spi_app_dummy_tx);
-        else chunk = remaining;
-        ret = HAL_SPI_TransmitReceive(dev->hspi, spi_app_dummy_tx, &rx[offset], chunk, timeout);
-        offset += chunk;
-        remaining -= chunk;
+        primask = __get_PRIMASK();
+        __disable_irq();
+
+        hit = dev->events & mask;
+        if (hit)
+        {
+            dev->events &= ~hit;
+            __set_PRIMASK(primask);
+            return hit;
+        }
+
+#if SPI_APP_WAIT_WFI
+        /* IRQs masked: a completion between the check and WFI still wakes the core.
+           The SysTick IRQ wakes it at least once per ms for the timeout check */
+        __DSB();
+        __WFI();
+#endif
+        __set_PRIMASK(primask);
+
+        if (timeout != HAL_MAX_DELAY && (HAL_GetTick() - start) >= timeout)
+            return 0;
     }
+}
 
-    spi_app_cs_high(dev);
-    return ret;
+/* Wait for the spi_app_*_dma() transfer in flight */
+HAL_StatusTypeDef spi_app_dma_wait(SPI_APP_Device *dev, uint32_t timeout)
+{
+    uint32_t ev = spi_app_wait(dev, SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR, timeout);
+
+    if (ev == 0)
+        return HAL_TIMEOUT;
+
+    return (ev & SPI_APP_EVT_ERROR) ? HAL_ERROR : HAL_OK;
+}
+
+#if SPI_APP_STATS
+/* Latency histograms */
+static void spi_app_stats_bin(uint32_t *hist, uint32_t cycles)
+{
+    hist[cycles ? (31u - __CLZ(cycles)) : 0u]++;
+}
+
+/* Transaction over: fold its timestamps into the histograms (once) */
+static void spi_app_stats_record(SPI_APP_Device *dev, uint8_t err)
+{
+    uint32_t now = DWT->CYCCNT;
+
+    if (!dev->ts_armed)
+        return;
+    dev->ts_armed = 0;
+
+    spi_app_stats_bin(dev->stats.setup, dev->ts_wire - dev->ts_start);
+    spi_app_stats_bin(dev->stats.wire, dev->ts_cplt - dev->ts_wire);
+    spi_app_stats_bin(dev->stats.cplt, now - dev->ts_cplt);
+
+    dev->stats.count++;
+    if (err)
+        dev->stats.errors++;
+}
+
+void spi_app_stats_snapshot(SPI_APP_Device *dev, SPI_APP_Stats *out, uint8_t reset)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    *out = dev->stats;
+    if (reset)
+        memset(&dev->stats, 0, sizeof(dev->stats));
+    __set_PRIMASK(primask);
+}
+
+uint32_t spi_app_stats_percentile(const uint32_t *hist, uint32_t pct)
+{
+    uint64_t total = 0, acc = 0;
+
+    for (uint32_t i = 0; i < SPI_APP_HIST_BINS; i++)
+        total += hist[i];
+
+    if (total == 0)
+        return 0;
+
+    for (uint32_t i = 0; i < SPI_APP_HIST_BINS; i++)
+    {
+        acc += hist[i];
+        if (acc * 100u >= total * pct)
+            return (i >= 31u) ? 0xFFFFFFFFu : (2u << i) - 1u;
+    }
+
+    return 0xFFFFFFFFu;
+}
+#endif
+
+/* Shared bus */
+void spi_app_bus_init(SPI_APP_Bus *bus, SPI_HandleTypeDef *hspi)
+{
+    bus->hspi = hspi;
+    bus->locked = 0;
+    bus->depth = 0;
+    bus->owner = 0;
+    bus->active = 0;
+    bus->switches = 0;
+}
+
+/* cfg == NULL: use the settings currently in hspi->Init (MX_SPIx_Init) */
+void spi_app_bus_attach(SPI_APP_Device *dev, SPI_APP_Bus *bus, const SPI_APP_Config *cfg)
+{
+    SPI_InitTypeDef *init = &bus->hspi->Init;
+
+    dev->hspi = bus->hspi;
+    dev->bus = bus;
+
+    if (cfg)
+    {
+        dev->cfg = *cfg;
+    }
+    else
+    {
+        dev->cfg.CLKPolarity = init->CLKPolarity;
+        dev->cfg.CLKPhase = init->CLKPhase;
+        dev->cfg.BaudRatePrescaler = init->BaudRatePrescaler;
+        dev->cfg.DataSize = init->DataSize;
+        dev->cfg.FirstBit = init->FirstBit;
+        dev->cfg.CRCCalculation = init->CRCCalculation;
+        dev->cfg.CRCLength = init->CRCLength;
+        dev->cfg.CRCPolynomial = init->CRCPolynomial;
+        dev->cfg.CRCInitPattern = init->TxCRCInitializationPattern;
+    }
+}
+
+/* DMA element size follows the frame size (DMA1/DMA2 stream, stream disabled between transfers) */
+static void spi_app_bus_dma_width(DMA_HandleTypeDef *hdma, uint32_t data_size)
+{
+    uint32_t psize, msize;
+
+    if (hdma == 0 || !IS_DMA_STREAM_INSTANCE(hdma->Instance))
+        return;
+
+    if (data_size <= SPI_DATASIZE_8BIT) { psize = DMA_PDATAALIGN_BYTE; msize = DMA_MDATAALIGN_BYTE; }
+    else if (data_size <= SPI_DATASIZE_16BIT) { psize = DMA_PDATAALIGN_HALFWORD; msize = DMA_MDATAALIGN_HALFWORD; }
+    else { psize = DMA_PDATAALIGN_WORD; msize = DMA_MDATAALIGN_WORD; }
+
+    if (hdma->Init.PeriphDataAlignment == psize && hdma->Init.MemDataAlignment == msize)
+        return;
+
+    hdma->Init.PeriphDataAlignment = psize;
+    hdma->Init.MemDataAlignment = msize;
+    MODIFY_REG(((DMA_Stream_TypeDef *)hdma->Instance)->CR, DMA_SxCR_PSIZE | DMA_SxCR_MSIZE, psize | msize);
+}
+
+/* CRC unit (SPE off): same register values as HAL_SPI_Init, Init updated for the HAL close path.
+   Disabled: CRCSIZE follows the frame size, as HAL_SPI_Init leaves it */
+static void spi_app_crc_load(SPI_HandleTypeDef *hspi, const SPI_APP_Config *c)
+{
+    SPI_TypeDef *spi = hspi->Instance;
+    uint32_t full = IS_SPI_HIGHEND_INSTANCE(spi) ? SPI_CRC_LENGTH_32BIT : SPI_CRC_LENGTH_16BIT;
+    uint32_t init = (c->CRCInitPattern == SPI_CRC_INITIALIZATION_ALL_ONE_PATTERN) ?
+                    (SPI_CR1_TCRCINI | SPI_CR1_RCRCINI) : 0u;
+
+    if (c->CRCCalculation == SPI_CRCCALCULATION_ENABLE)
+    {
+        MODIFY_REG(spi->CFG1, SPI_CFG1_CRCEN | SPI_CFG1_CRCSIZE, SPI_CFG1_CRCEN | c->CRCLength);
+
+        /* Full-width CRC: 17/33-bit polynomial, the top bit is implicit. Shorter ones: set it */
+        if (c->CRCLength == full)
+        {
+            MODIFY_REG(spi->CR1, SPI_CR1_TCRCINI | SPI_CR1_RCRCINI | SPI_CR1_CRC33_17, init | SPI_CR1_CRC33_17);
+            WRITE_REG(spi->CRCPOLY, c->CRCPolynomial);
+        }
+        else
+        {
+            MODIFY_REG(spi->CR1, SPI_CR1_TCRCINI | SPI_CR1_RCRCINI | SPI_CR1_CRC33_17, init);
+            WRITE_REG(spi->CRCPOLY, c->CRCPolynomial | (1UL << ((c->CRCLength >> SPI_CFG1_CRCSIZE_Pos) + 1u)));
+        }
+    }
+    else
+    {
+        MODIFY_REG(spi->CFG1, SPI_CFG1_CRCEN | SPI_CFG1_CRCSIZE, hspi->Init.DataSize << SPI_CFG1_CRCSIZE_Pos);
+    }
+
+    hspi->Init.CRCCalculation = c->CRCCalculation;
+    hspi->Init.CRCLength = c->CRCLength;
+    hspi->Init.CRCPolynomial = c->CRCPolynomial;
+    hspi->Init.TxCRCInitializationPattern = c->CRCInitPattern;
+    hspi->Init.RxCRCInitializationPattern = c->CRCInitPattern;
+}
+
+/* Load the device settings: only the fields that differ from the active ones are written,
+   straight into CFG1/CFG2 (SPE is off between HAL transfers), no HAL_SPI_Init */
+static void spi_app_bus_switch(SPI_APP_Bus *bus, SPI_APP_Device *dev)
+{
+    SPI_HandleTypeDef *hspi = bus->hspi;
+    SPI_InitTypeDef *init = &hspi->Init;
+    const SPI_APP_Config *c = &dev->cfg;
+    uint32_t cfg1_mask = 0, cfg1_val = 0;
+    uint32_t cfg2_mask = 0, cfg2_val = 0;
+
+    if (init->BaudRatePrescaler != c->BaudRatePrescaler)
+    {
+        cfg1_mask |= SPI_CFG1_MBR;
+        cfg1_val |= c->BaudRatePrescaler;
+    }
+    if (init->DataSize != c->DataSize)
+    {
+        cfg1_mask |= SPI_CFG1_DSIZE;
+        cfg1_val |= c->DataSize;
+    }
+    if (init->CLKPolarity != c->CLKPolarity)
+    {
+        cfg2_mask |= SPI_CFG2_CPOL;
+        cfg2_val |= c->CLKPolarity;
+    }
+    if (init->CLKPhase != c->CLKPhase)
+    {
+        cfg2_mask |= SPI_CFG2_CPHA;
+        cfg2_val |= c->CLKPhase;
+    }
+    if (init->FirstBit != c->FirstBit)
+    {
+        cfg2_mask |= SPI_CFG2_LSBFRST;
+        cfg2_val |= c->FirstBit;
+    }
+
+    if (cfg1_mask) MODIFY_REG(hspi->Instance->CFG1, cfg1_mask, cfg1_val);
+    if (cfg2_mask) MODIFY_REG(hspi->Instance->CFG2, cfg2_mask, cfg2_val);
+
+    if (cfg1_mask & SPI_CFG1_DSIZE)
+    {
+        spi_app_bus_dma_width(hspi->hdmarx, c->DataSize);
+        spi_app_bus_dma_width(hspi->hdmatx, c->DataSize);
+    }
+
+    /* The HAL reads DataSize (packing, FIFO handling) from Init */
+    init->BaudRatePrescaler = c->BaudRatePrescaler;
+    init->DataSize = c->DataSize;
+    init->CLKPolarity = c->CLKPolarity;
+    init->CLKPhase = c->CLKPhase;
+    init->FirstBit = c->FirstBit;
+
+    if (init->CRCCalculation != c->CRCCalculation || init->CRCLength != c->CRCLength ||
+        init->CRCPolynomial != c->CRCPolynomial || init->TxCRCInitializationPattern != c->CRCInitPattern ||
+        ((cfg1_mask & SPI_CFG1_DSIZE) && c->CRCCalculation != SPI_CRCCALCULATION_ENABLE))
+        spi_app_crc_load(hspi, c);
+
+    bus->active = dev;
+    bus->switches++;
+}
+
+/* Non-blocking, usable from thread and ISR context (LDREX/STREX). Re-entrant for the owner */
+HAL_StatusTypeDef spi_app_bus_acquire(SPI_APP_Device *dev)
+{
+    SPI_APP_Bus *bus = dev->bus;
+
+    if (bus == 0)
+        return HAL_OK;
+
+    if (bus->locked && bus->owner == dev)
+    {
+        bus->depth++;
+        return HAL_OK;
+    }
+
+    do
+    {
+        if (__LDREXB(&bus->locked))
+        {
+            __CLREX();
+            return HAL_BUSY;
+        }
+    } while (__STREXB(1u, &bus->locked));
+    __DMB();
+
+    bus->owner = dev;
+    bus->depth = 1;
+
+    if (bus->active != dev)
+        spi_app_bus_switch(bus, dev);
+
+    return HAL_OK;
+}
+
+void spi_app_bus_release(SPI_APP_Device *dev)
+{
+    SPI_APP_Bus *bus = dev->bus;
+
+    if (bus == 0 || !bus->locked || bus->owner != dev)
+        return;
+
+    if (--bus->depth == 0)
+    {
+        bus->owner = 0;
+        __DMB();
+        bus->locked = 0;
+    }
 }
 
-HAL_StatusTypeDef spi_app_transfer(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint16_t len, uint32_t timeout)
+/* Hardware NSS: the SPI drives CS for the whole transfer (SPE on -> SPE off), no CPU involvement.
+   ss_idleness: SPI_MASTER_SS_IDLENESS_xxCYCLE (CS assert to first SCK edge),
+   interdata_idleness: SPI_MASTER_INTERDATA_IDLENESS_xxCYCLE (gap between frames) */
+HAL_StatusTypeDef spi_app_hw_nss_enable(SPI_APP_Device *dev, uint8_t alternate,
+                                        uint32_t ss_idleness, uint32_t interdata_idleness)
 {
+    SPI_HandleTypeDef *hspi = dev->hspi;
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
     HAL_StatusTypeDef ret;
 
-    spi_app_cs_low(dev);
-    ret = HAL_SPI_TransmitReceive(dev->hspi, tx, rx, len, timeout);
+    if (hspi->State != HAL_SPI_STATE_READY || !dev->dma_done)
+        return HAL_BUSY;
+
+    hspi->Init.NSS = SPI_NSS_HARD_OUTPUT;
+    hspi->Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+    hspi->Init.NSSPolarity = dev->cs_active_low ? SPI_NSS_POLARITY_LOW : SPI_NSS_POLARITY_HIGH;
+    hspi->Init.MasterSSIdleness = ss_idleness;
+    hspi->Init.MasterInterDataIdleness = interdata_idleness;
+    /* Keep NSS driven (inactive) while the SPI is disabled between transfers */
+    hspi->Init.MasterKeepIOState = SPI_MASTER_KEEP_IO_STATE_ENABLE;
+
+    ret = HAL_SPI_Init(hspi);
+    if (ret != HAL_OK)
+        return ret;
+
+    GPIO_InitStruct.Pin = dev->CS_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.Alternate = alternate;
+    HAL_GPIO_Init(dev->CS_Port, &GPIO_InitStruct);
+
+    dev->hw_nss = 1;
+
+    return HAL_OK;
+}
+
+/* Back to GPIO chip select (multi-segment transactions, long chunked transfers) */
+HAL_StatusTypeDef spi_app_hw_nss_disable(SPI_APP_Device *dev)
+{
+    SPI_HandleTypeDef *hspi = dev->hspi;
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+    if (!dev->hw_nss)
+        return HAL_OK;
+
+    if (hspi->State != HAL_SPI_STATE_READY || !dev->dma_done)
+        return HAL_BUSY;
+
+    dev->hw_nss = 0;
     spi_app_cs_high(dev);
 
-    return ret;
+    GPIO_InitStruct.Pin = dev->CS_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+    HAL_GPIO_Init(dev->CS_Port, &GPIO_InitStruct);
+
+    /* Same NSS settings as MX_SPIx_Init */
+    hspi->Init.NSS = SPI_NSS_SOFT;
+    hspi->Init.NSSPMode = SPI_NSS_PULSE_ENABLE;
+    hspi->Init.NSSPolarity = SPI_NSS_POLARITY_LOW;
+    hspi->Init.MasterSSIdleness = SPI_MASTER_SS_IDLENESS_00CYCLE;
+    hspi->Init.MasterInterDataIdleness = SPI_MASTER_INTERDATA_IDLENESS_00CYCLE;
+    hspi->Init.MasterKeepIOState = SPI_MASTER_KEEP_IO_STATE_DISABLE;
+
+    return HAL_SPI_Init(hspi);
 }
 
-HAL_StatusTypeDef spi_app_transfer_dma(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint16_t len)
+/* Bytes per SPI frame (DMA memory side, no packing) */
+uint32_t spi_app_size_bytes(uint32_t size)
 {
-    HAL_StatusTypeDef ret;
+    if (size <= SPI_DATASIZE_8BIT) return 1u;
+    if (size <= SPI_DATASIZE_16BIT) return 2u;
+    return 4u;
+}
 
-    dev->dma_done = 0;
-    dev->dma_err = 0;
-    dev->dma_hal_error = 0;
+uint32_t spi_app_frame_bytes(const SPI_APP_Device *dev)
+{
+    /* On a shared bus hspi->Init holds the settings of the last owner */
+    return spi_app_size_bytes(dev->bus ? dev->cfg.DataSize : dev->hspi->Init.DataSize);
+}
 
-    dev->last_len = len;
-    dev->last_tx = tx;
-    dev->last_rx = rx;
+/* SPI kernel clock (SCK = kernel clock / prescaler) */
+uint32_t spi_app_kernel_clock(const SPI_APP_Device *dev)
+{
+    SPI_TypeDef *spi = dev->hspi->Instance;
 
-    if (tx) spi_app_cache_clean(tx, len);
+    if (spi == SPI1 || spi == SPI2 || spi == SPI3) return HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SPI123);
+    if (spi == SPI4 || spi == SPI5) return HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SPI45);
+    return HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SPI6);
+}
 
-    spi_app_cs_low(dev);
-    ret = HAL_SPI_TransmitReceive_DMA(dev->hspi, tx, rx, len);
+/* Nominal payload bytes per second: bit rate (kernel clock / prescaler) scaled by the frame
+   bytes carried per frame bits. Inter-frame gaps and DMA latency are not taken into account */
+uint32_t spi_app_byte_rate(const SPI_APP_Device *dev)
+{
+    uint32_t presc = dev->bus ? dev->cfg.BaudRatePrescaler : dev->hspi->Init.BaudRatePrescaler;
+    uint32_t size = dev->bus ? dev->cfg.DataSize : dev->hspi->Init.DataSize;
+    uint32_t bit_rate = spi_app_kernel_clock(dev) >> ((presc >> SPI_CFG1_MBR_Pos) + 1u);
 
-    if (ret != HAL_OK)
+    return (uint32_t)(((uint64_t)bit_rate * spi_app_size_bytes(size)) / (size + 1u));
+}
+
+/* HAL blocking transfer, split in HAL-sized chunks (CS handled by the caller).
+   tx == NULL: RX-only (simplex receiver), rx == NULL: TX-only */
+HAL_StatusTypeDef spi_app_hal_xfer(SPI_APP_Device *dev, const uint8_t *tx, uint8_t *rx, uint32_t len,
+                                   uint32_t timeout)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t step = spi_app_frame_bytes(dev);
+
+    while (len > 0 && ret == HAL_OK)
     {
-        spi_app_cs_high(dev);
-        dev->dma_done = 1;
-        dev->dma_err = 1;
-        dev->dma_hal_error = dev->hspi->ErrorCode;
+        uint16_t chunk = (len > SPI_APP_CHUNK_MAX) ? SPI_APP_CHUNK_MAX : (uint16_t)len;
+
+        if (tx && rx) ret = HAL_SPI_TransmitReceive(dev->hspi, tx, rx, chunk, timeout);
+        else if (tx) ret = HAL_SPI_Transmit(dev->hspi, tx, chunk, timeout);
+        else ret = HAL_SPI_Receive(dev->hspi, rx, chunk, timeout);
+
+        if (tx) tx += chunk * step;
+        if (rx) rx += chunk * step;
+        len -= chunk;
     }
 
     return ret;
 }
 
-HAL_StatusTypeDef spi_app_write_dma(SPI_APP_Device *dev, uint8_t *tx, uint16_t len)
+/* Register-level transfer (len <= SPI_APP_CHUNK_MAX, HAL handle idle, CS handled by the caller).
+   Same sequence as the HAL: COMM and TSIZE while SPE = 0, SPE, CSTART, FIFO service, EOT,
+   flags cleared and SPE off again, so the HAL finds the peripheral as it left it */
+HAL_StatusTypeDef spi_app_fast_xfer(SPI_APP_Device *dev, const uint8_t *tx, uint8_t *rx, uint32_t len)
 {
-    HAL_StatusTypeDef ret;
+    SPI_TypeDef *spi = dev->hspi->Instance;
+    uint32_t step = spi_app_frame_bytes(dev);
+    uint32_t tx_left = tx ? len : 0;
+    uint32_t rx_left = rx ? len : 0;
+    uint32_t spin = SPI_APP_FAST_SPIN;
+    uint32_t sr;
+    HAL_StatusTypeDef ret = HAL_OK;
 
-    dev->dma_done = 0;
-    dev->dma_err = 0;
-    dev->dma_hal_error = 0;
+    if (tx && rx) SPI_2LINES(dev->hspi);
+    else if (tx) SPI_2LINES_TX(dev->hspi);
+    else SPI_2LINES_RX(dev->hspi);
 
-    dev->last_len = len;
-    dev->last_tx = tx;
-    dev->last_rx = 0;
+    MODIFY_REG(spi->CR2, SPI_CR2_TSIZE, len);
+    SET_BIT(spi->CR1, SPI_CR1_SPE);
+    SET_BIT(spi->CR1, SPI_CR1_CSTART);
+
+    while ((tx_left || rx_left) && spin)
+    {
+        sr = spi->SR;
+        spin--;
 
-    spi_app_cache_clean(tx, len);
+        if (tx_left && (sr & SPI_SR_TXP))
+        {
+            if (step == 1u) *(__IO uint8_t *)&spi->TXDR = *tx;
+            else if (step == 2u) *(__IO uint16_t *)&spi->TXDR = *(const uint16_t *)tx;
+            else spi->TXDR = *(const uint32_t *)tx;
 
-    spi_app_cs_low(dev);
-    ret = HAL_SPI_Transmit_DMA(dev->hspi, tx, len);
+            tx += step;
+            tx_left--;
+            spin = SPI_APP_FAST_SPIN;
+        }
+
+        /* Any frame in the FIFO, whatever the FIFO threshold (RXP alone would wait for FTHLV) */
+        if (rx_left && (sr & (SPI_SR_RXP | SPI_SR_RXWNE | SPI_SR_RXPLVL)))
+        {
+            if (step == 1u) *rx = *(__IO uint8_t *)&spi->RXDR;
+            else if (step == 2u) *(uint16_t *)rx = *(__IO uint16_t *)&spi->RXDR;
+            else *(uint32_t *)rx = spi->RXDR;
+
+            rx += step;
+            rx_left--;
+            spin = SPI_APP_FAST_SPIN;
+        }
+    }
+
+    while (spin && !(spi->SR & SPI_SR_EOT))
+        spin--;
+
+    /* EOT comes after the CRC frame: CRCE is valid here */
+    sr = spi->SR;
+    if (spin == 0) ret = HAL_TIMEOUT;
+    else if (sr & (SPI_SR_OVR | SPI_SR_UDR | SPI_SR_MODF | SPI_SR_CRCE)) ret = HAL_ERROR;
+
+    /* Error code as the HAL reports it, for the callers that look at it */
+    if (ret == HAL_ERROR)
+        dev->hspi->ErrorCode = (sr & SPI_SR_CRCE) ? HAL_SPI_ERROR_CRC : HAL_SPI_ERROR_FLAG;
+
+    SET_BIT(spi->IFCR, SPI_IFCR_EOTC | SPI_IFCR_TXTFC | SPI_IFCR_OVRC | SPI_IFCR_UDRC | SPI_IFCR_MODFC |
+                       SPI_IFCR_CRCEC);
+    CLEAR_BIT(spi->CR1, SPI_CR1_SPE);
+
+    return ret;
+}
 
+/* Blocking transfer under a single CS assertion: fast path for short ones, HAL otherwise */
+static HAL_StatusTypeDef spi_app_poll(SPI_APP_Device *dev, const uint8_t *tx, uint8_t *rx,
+                                      uint32_t len, uint32_t timeout)
+{
+    uint8_t retries = dev->crc_retries;
+    HAL_StatusTypeDef ret;
+
+    SPI_APP_TS_START(dev);
+
+    ret = spi_app_bus_acquire(dev);
     if (ret != HAL_OK)
+        return ret;
+
+    /* A packed DMA transfer may have left a higher FIFO threshold behind (SPE is off when idle) */
+    if (dev->hspi->State == HAL_SPI_STATE_READY)
+        MODIFY_REG(dev->hspi->Instance->CFG1, SPI_CFG1_FTHLV, dev->hspi->Init.FifoThreshold);
+
+    SPI_APP_TS_WIRE(dev);
+
+    for (;;)
     {
+        spi_app_cs_low(dev);
+
+        if (len != 0 && len <= SPI_APP_FAST_AUTO && dev->hspi->State == HAL_SPI_STATE_READY)
+            ret = spi_app_fast_xfer(dev, tx, rx, len);
+        else
+            ret = spi_app_hal_xfer(dev, tx, rx, len, timeout);
+
         spi_app_cs_high(dev);
-        dev->dma_done = 1;
-        dev->dma_err = 1;
-        dev->dma_hal_error = dev->hspi->ErrorCode;
+
+        if (ret != HAL_ERROR || !(dev->hspi->ErrorCode & HAL_SPI_ERROR_CRC))
+            break;
+
+        /* CRC mismatch: the whole transfer again, under a new CS assertion */
+        dev->crc_errors++;
+        if (retries == 0)
+        {
+            dev->crc_failures++;
+            break;
+        }
+        retries--;
     }
 
+    SPI_APP_TS_CPLT(dev);
+    spi_app_bus_release(dev);
+
+    SPI_APP_TS_RECORD(dev, ret != HAL_OK);
     return ret;
 }
 
-HAL_StatusTypeDef spi_app_read_dma(SPI_APP_Device *dev, uint8_t *rx, uint16_t len)
+HAL_StatusTypeDef spi_app_write(SPI_APP_Device *dev, uint8_t *tx, uint32_t len, uint32_t timeout)
+{
+    return spi_app_poll(dev, tx, 0, len, timeout);
+}
+
+HAL_StatusTypeDef spi_app_read(SPI_APP_Device *dev, uint8_t *rx, uint32_t len, uint32_t timeout)
+{
+    return spi_app_poll(dev, 0, rx, len, timeout);
+}
+
+HAL_StatusTypeDef spi_app_transfer(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len, uint32_t timeout)
+{
+    return spi_app_poll(dev, tx, rx, len, timeout);
+}
+
+HAL_StatusTypeDef spi_app_transfer_fast(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len)
 {
     HAL_StatusTypeDef ret;
 
-    if (len > sizeof(spi_app_dummy_tx))
+    if ((tx == 0 && rx == 0) || len == 0 || len > SPI_APP_CHUNK_MAX)
         return HAL_ERROR;
 
-    dev->dma_done = 0;
-    dev->dma_err = 0;
-    dev->dma_hal_error = 0;
+    /* A DMA or stream transfer owns the peripheral */
+    if (dev->hspi->State != HAL_SPI_STATE_READY)
+        return HAL_BUSY;
 
-    dev->last_len = len;
-    dev->last_tx = spi_app_dummy_tx;
-    dev->last_rx = rx;
+    ret = spi_app_bus_acquire(dev);
+    if (ret != HAL_OK)
+        return ret;
 
     spi_app_cs_low(dev);
-    ret = HAL_SPI_TransmitReceive_DMA(dev->hspi, spi_app_dummy_tx, rx, len);
+    ret = spi_app_fast_xfer(dev, tx, rx, len);
+    spi_app_cs_high(dev);
+
+    spi_app_bus_release(dev);
+    return ret;
+}
 
+/* Hardware CRC */
+
+/* New CRC settings into the device (and the registers when it holds them) */
+static HAL_StatusTypeDef spi_app_crc_set(SPI_APP_Device *dev, const SPI_APP_Config *c)
+{
+    HAL_StatusTypeDef ret;
+
+    if (dev->hspi->State != HAL_SPI_STATE_READY || !dev->dma_done || dev->stream_on)
+        return HAL_BUSY;
+
+    ret = spi_app_bus_acquire(dev);
     if (ret != HAL_OK)
+        return ret;
+
+    if (dev->bus)
     {
-        spi_app_cs_high(dev);
-        dev->dma_done = 1;
-        dev->dma_err = 1;
-        dev->dma_hal_error = dev->hspi->ErrorCode;
+        dev->cfg.CRCCalculation = c->CRCCalculation;
+        dev->cfg.CRCLength = c->CRCLength;
+        dev->cfg.CRCPolynomial = c->CRCPolynomial;
+        dev->cfg.CRCInitPattern = c->CRCInitPattern;
     }
+    spi_app_crc_load(dev->hspi, c);
 
-    return ret;
+    spi_app_bus_release(dev);
+    return HAL_OK;
 }
 
-/* Call this from HAL_SPI_TxRxCpltCallback / TxCplt / RxCplt */
-void spi_app_dma_cplt(SPI_APP_Device *dev)
+HAL_StatusTypeDef spi_app_crc_enable(SPI_APP_Device *dev, uint32_t length, uint32_t polynomial,
+                                     uint32_t init_pattern, uint8_t retries)
 {
-    if (dev->last_rx)
-        spi_app_cache_invalidate(dev->last_rx, dev->last_len);
+    uint32_t size = dev->bus ? dev->cfg.DataSize : dev->hspi->Init.DataSize;
+    uint32_t full = IS_SPI_HIGHEND_INSTANCE(dev->hspi->Instance) ? SPI_CRC_LENGTH_32BIT : SPI_CRC_LENGTH_16BIT;
+    SPI_APP_Config c;
+    HAL_StatusTypeDef ret;
 
-    spi_app_cs_high(dev);
+    if (length == SPI_CRC_LENGTH_DATASIZE)
+        length = size << SPI_CFG1_CRCSIZE_Pos;
 
-    dev->dma_done = 1;
-    dev->dma_err = 0;
-    dev->dma_hal_error = 0;
+    /* The CRC is at least one frame wide, the polynomial fits the CRC (top bit implicit) */
+    if ((length & ~SPI_CFG1_CRCSIZE) != 0u || length > full || (length >> SPI_CFG1_CRCSIZE_Pos) < size ||
+        polynomial == 0u || (polynomial >> ((length >> SPI_CFG1_CRCSIZE_Pos) + 1u)) != 0u)
+        return HAL_ERROR;
+
+    c.CRCCalculation = SPI_CRCCALCULATION_ENABLE;
+    c.CRCLength = length;
+    c.CRCPolynomial = polynomial;
+    c.CRCInitPattern = init_pattern ? SPI_CRC_INITIALIZATION_ALL_ONE_PATTERN : SPI_CRC_INITIALIZATION_ALL_ZERO_PATTERN;
+
+    ret = spi_app_crc_set(dev, &c);
+    if (ret == HAL_OK)
+        dev->crc_retries = retries;
+
+    return ret;
 }
 
-/* Call this from HAL_SPI_ErrorCallback */
-void spi_app_dma_error(SPI_APP_Device *dev)
+HAL_StatusTypeDef spi_app_crc_disable(SPI_APP_Device *dev)
 {
-    spi_app_cs_high(dev);
+    SPI_APP_Config c;
+    HAL_StatusTypeDef ret;
 
-    dev->dma_done = 1;
-    dev->dma_err = 1;
-    dev->dma_hal_error = dev->hspi->ErrorCode;
+    memset(&c, 0, sizeof(c));
+    c.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+
+    ret = spi_app_crc_set(dev, &c);
+    if (ret == HAL_OK)
+        dev->crc_retries = 0;
+
+    return ret;
 }
 
-/* Cache helpers (STM32H7) */
-void spi_app_cache_clean(const void *addr, uint32_t size)
+/* DTCM is not reachable by DMA1/DMA2 */
+uint8_t spi_app_dma_reachable(const void *addr)
 {
-    /* Placeholder: On STM32H7 this may be required before DMA TX to ensure data coherency with D-Cache. I do not implement this */
-    (void)addr;
-    (void)size;
+    return !((uint32_t)addr >= 0x20000000u && (uint32_t)addr < 0x20020000u);
 }
 
-void spi_app_cache_invalidate(void *addr, uint32_t size)
+/* Make a DMA RX buffer cache-safe: use it as is, redirect it to the bounce buffer, or reject it */
+static HAL_StatusTypeDef spi_app_rx_prepare(SPI_APP_Device *dev, uint8_t **rx, uint32_t bytes)
 {
-    /* Placeholder: On STM32H7 this may be required before DMA TX to ensure data coherency with D-Cache. I do not implement this */
-    (void)addr;
-    (void)size;
+    uint32_t primask;
+
+    dev->bounce_dst = 0;
+
+    if (!spi_app_dma_reachable(*rx))
+        return HAL_ERROR;
+
+    if (!spi_app_cache_rx_safe(*rx, bytes))
+    {
+        if (bytes > sizeof(spi_app_bounce_rx))
+            return HAL_ERROR;
+
+        primask = __get_PRIMASK();
+        __disable_irq();
+        if (spi_app_bounce_busy)
+        {
+            __set_PRIMASK(primask);
+            return HAL_BUSY;
+        }
+        spi_app_bounce_busy = 1;
+        __set_PRIMASK(primask);
+
+        dev->bounce_dst = *rx;
+        *rx = spi_app_bounce_rx;
+    }
+
+    /* Drop stale lines now, so no dirty line is evicted on top of the DMA data */
+    spi_app_cache_invalidate(*rx, bytes);
+
+    return HAL_OK;
+}
+
+/* RX chunk done (or aborted): make the data visible to the CPU and release the bounce buffer */
+static void spi_app_rx_finish(SPI_APP_Device *dev, uint8_t copy)
+{
+    uint32_t bytes = dev->last_len * spi_app_frame_bytes(dev);
+
+    if (dev->last_rx)
+        spi_app_cache_invalidate(dev->last_rx, bytes);
+
+    /* A bounced transfer is always a single chunk */
+    if (dev->bounce_dst)
+    {
+        if (copy) memcpy(dev->bounce_dst, spi_app_bounce_rx, bytes);
+        dev->bounce_dst = 0;
+        spi_app_bounce_busy = 0;
+    }
+}
+
+/* Validate buffers, do cache maintenance and set up dev->xfer_* for spi_app_dma_chunk() */
+static HAL_StatusTypeDef spi_app_dma_begin(SPI_APP_Device *dev, const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    uint32_t bytes = len * spi_app_frame_bytes(dev);
+    HAL_StatusTypeDef ret;
+
+    if (len == 0 || (tx == 0 && rx == 0))
+        return HAL_ERROR;
+
+    if (tx && !spi_app_dma_reachable(tx))
+        return HAL_ERROR;
+
+    dev->bounce_dst = 0;
+    if (rx)
+    {
+        ret = spi_app_rx_prepare(dev, &rx, bytes);
+        if (ret != HAL_OK)
+            return ret;
+    }
+
+    if (tx) spi_app_cache_clean(tx, bytes);
+
+    dev->xfer_tx = tx;
+    dev->xfer_rx = rx;
+    dev->xfer_left = len;
+    dev->xfer_it = 0;
+
+    return HAL_OK;
+}
+
+/* Interrupt-driven variant: the CPU moves the data, any buffer, no cache maintenance */
+static HAL_StatusTypeDef spi_app_it_begin(SPI_APP_Device *dev, const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    if (len == 0 || (tx == 0 && rx == 0))
+        return HAL_ERROR;
+
+    dev->bounce_dst = 0;
+    dev->xfer_tx = tx;
+    dev->xfer_rx = rx;
+    dev->xfer_left = len;
+    dev->xfer_it = 1;
+
+    return HAL_OK;
+}
+
+void spi_app_dma_pack_enable(SPI_APP_Device *dev, uint8_t enable)
+{
+    dev->dma_pack = enable ? 1u : 0u;
+}
+
+/* Switch SPI FIFO threshold and DMA streams between packed and one-frame-per-request operation.
+   SPE and the streams are off between transfers; the streams are only re-initialised on change */
+HAL_StatusTypeDef spi_app_dma_pack(SPI_APP_Device *dev, uint8_t on)
+{
+    SPI_HandleTypeDef *hspi = dev->hspi;
+    DMA_HandleTypeDef *hdma[2] = { hspi->hdmarx, hspi->hdmatx };
+    uint32_t frame = spi_app_frame_bytes(dev);
+    uint32_t fth, psize, msize, fifo;
+
+    if (!on) fth = hspi->Init.FifoThreshold;
+    else fth = (frame == 1u) ? SPI_FIFO_THRESHOLD_04DATA : SPI_FIFO_THRESHOLD_02DATA;
+    MODIFY_REG(hspi->Instance->CFG1, SPI_CFG1_FTHLV, fth);
+
+    if (on || frame == 4u) { psize = DMA_PDATAALIGN_WORD; msize = DMA_MDATAALIGN_WORD; }
+    else if (frame == 2u) { psize = DMA_PDATAALIGN_HALFWORD; msize = DMA_MDATAALIGN_HALFWORD; }
+    else { psize = DMA_PDATAALIGN_BYTE; msize = DMA_MDATAALIGN_BYTE; }
+    fifo = on ? DMA_FIFOMODE_ENABLE : DMA_FIFOMODE_DISABLE;
+
+    for (uint8_t i = 0; i < 2u; i++)
+    {
+        DMA_HandleTypeDef *h = hdma[i];
+
+        if (h == 0 || !IS_DMA_STREAM_INSTANCE(h->Instance))
+            continue;
+
+        if (h->Init.PeriphDataAlignment == psize && h->Init.MemDataAlignment == msize &&
+            h->Init.FIFOMode == fifo)
+            continue;
+
+        h->Init.PeriphDataAlignment = psize;
+        h->Init.MemDataAlignment = msize;
+        h->Init.FIFOMode = fifo;
+        h->Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+        h->Init.MemBurst = on ? DMA_MBURST_INC4 : DMA_MBURST_SINGLE;
+        h->Init.PeriphBurst = DMA_PBURST_SINGLE;
+
+        if (HAL_DMA_Init(h) != HAL_OK)
+            return HAL_ERROR;
+    }
+
+    return HAL_OK;
+}
+
+/* Start the next chunk of dev->xfer_* (CS already asserted). Called again from
+   spi_app_dma_cplt() until xfer_left is 0, so CS stays low across chunks */
+static HAL_StatusTypeDef spi_app_dma_chunk(SPI_APP_Device *dev)
+{
+    uint32_t step = spi_app_frame_bytes(dev);
+    uint16_t chunk = (dev->xfer_left > SPI_APP_CHUNK_MAX) ? SPI_APP_CHUNK_MAX : (uint16_t)dev->xfer_left;
+    uint32_t unit = 16u / step;    // frames per 4-beat burst
+    uint8_t pack;
+    HAL_StatusTypeDef ret;
+
+    /* Packed: whole bursts only (the DMA FIFO needs NDTR to be a multiple of the burst),
+       the remainder goes out unpacked as the last chunk */
+    pack = dev->dma_pack && !dev->xfer_it && step < 4u && chunk >= unit &&
+           ((((uint32_t)dev->xfer_tx) | ((uint32_t)dev->xfer_rx)) & 3u) == 0u;
+    if (pack)
+        chunk = (uint16_t)(chunk - (chunk % unit));
+
+    if (dev->xfer_it)
+        MODIFY_REG(dev->hspi->Instance->CFG1, SPI_CFG1_FTHLV, dev->hspi->Init.FifoThreshold);
+    else if (spi_app_dma_pack(dev, pack) != HAL_OK)
+    {
+        dev->xfer_left = 0;
+        dev->dma_hal_error = HAL_SPI_ERROR_DMA;
+        return HAL_ERROR;
+    }
+
+    dev->last_len = chunk;
+    dev->last_tx = dev->xfer_tx;
+    dev->last_rx = dev->xfer_it ? 0 : dev->xfer_rx;    // nothing to invalidate after IT
+
+    if (dev->xfer_it)
+    {
+        if (dev->xfer_tx && dev->xfer_rx)
+            ret = HAL_SPI_TransmitReceive_IT(dev->hspi, dev->xfer_tx, dev->xfer_rx, chunk);
+        else if (dev->xfer_tx)
+            ret = HAL_SPI_Transmit_IT(dev->hspi, dev->xfer_tx, chunk);
+        else
+            ret = HAL_SPI_Receive_IT(dev->hspi, dev->xfer_rx, chunk);
+    }
+    else if (dev->xfer_tx && dev->xfer_rx)
+        ret = HAL_SPI_TransmitReceive_DMA(dev->hspi, dev->xfer_tx, dev->xfer_rx, chunk);
+    else if (dev->xfer_tx)
+        ret = HAL_SPI_Transmit_DMA(dev->hspi, dev->xfer_tx, chunk);
+    else
+        ret = HAL_SPI_Receive_DMA(dev->hspi, dev->xfer_rx, chunk);
+
+    if (ret != HAL_OK)
+    {
+        dev->xfer_left = 0;
+        dev->dma_hal_error = dev->hspi->ErrorCode;
+        return ret;
+    }
+
+    if (!dev->xfer_it)
+    {
+        uint32_t beats = pack ? (chunk * step) / 4u : chunk;
+        dev->dma_requests += (dev->xfer_tx ? beats : 0u) + (dev->xfer_rx ? beats : 0u);
+    }
+
+    if (dev->xfer_tx) dev->xfer_tx += chunk * step;
+    if (dev->xfer_rx) dev->xfer_rx += chunk * step;
+    dev->xfer_left -= chunk;
+
+    return HAL_OK;
+}
+
+/* Single DMA (or IT) transfer on the device CS. repeat: a CRC mismatch may start it again */
+static HAL_StatusTypeDef spi_app_dma_run(SPI_APP_Device *dev, const uint8_t *tx, uint8_t *rx, uint32_t len,
+                                         uint8_t it, uint8_t repeat)
+{
+    HAL_StatusTypeDef ret;
+
+    if (!dev->dma_done || (dev->queue && dev->queue->busy))
+        return HAL_BUSY;
+
+    SPI_APP_TS_START(dev);
+
+    /* Held until spi_app_dma_cplt() / spi_app_dma_error() */
+    ret = spi_app_bus_acquire(dev);
+    if (ret != HAL_OK)
+        return ret;
+
+    ret = it ? spi_app_it_begin(dev, tx, rx, len) : spi_app_dma_begin(dev, tx, rx, len);
+    if (ret != HAL_OK)
+    {
+        spi_app_bus_release(dev);
+        return ret;
+    }
+
+    /* Single chunk with CRC: kept for a repeat from spi_app_dma_error() */
+    dev->crc_left = (repeat && dev->hspi->Init.CRCCalculation == SPI_CRCCALCULATION_ENABLE &&
+                     len <= SPI_APP_CHUNK_MAX) ? dev->crc_retries : 0u;
+    dev->crc_it = it;
+    dev->crc_tx = tx;
+    dev->crc_rx = rx;
+    dev->crc_len = len;
+
+    dev->dma_done = 0;
+    dev->dma_err = 0;
+    dev->dma_hal_error = 0;
+    spi_app_events_clear(dev, SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR);
+
+    spi_app_cs_low(dev);
+    SPI_APP_TS_WIRE(dev);
+    ret = spi_app_dma_chunk(dev);
+
+    if (ret != HAL_OK)
+    {
+        SPI_APP_TS_DISARM(dev);
+        dev->crc_left = 0;
+        spi_app_cs_high(dev);
+        spi_app_rx_finish(dev, 0);
+        dev->dma_done = 1;
+        dev->dma_err = 1;
+        spi_app_bus_release(dev);
+        spi_app_events_set(dev, SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR);
+    }
+
+    return ret;
+}
+
+HAL_StatusTypeDef spi_app_transfer_dma(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    if (tx == 0 || rx == 0)
+        return HAL_ERROR;
+
+    return spi_app_dma_run(dev, tx, rx, len, 0, 1);
+}
+
+HAL_StatusTypeDef spi_app_write_dma(SPI_APP_Device *dev, uint8_t *tx, uint32_t len)
+{
+    if (tx == 0)
+        return HAL_ERROR;
+
+    return spi_app_dma_run(dev, tx, 0, len, 0, 1);
+}
+
+/* RX-only (simplex receiver): no TX dummy buffer, any length, CS held low across chunks */
+HAL_StatusTypeDef spi_app_read_dma(SPI_APP_Device *dev, uint8_t *rx, uint32_t len)
+{
+    if (rx == 0)
+        return HAL_ERROR;
+
+    return spi_app_dma_run(dev, 0, rx, len, 0, 1);
+}
+
+/* Vectored transfers */
+static HAL_StatusTypeDef spi_app_vec_check(const SPI_APP_Device *dev, const SPI_APP_Seg *seg, uint8_t count)
+{
+    if (seg == 0 || count == 0 || dev->hw_nss)
+        return HAL_ERROR;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (seg[i].len == 0 || (seg[i].tx == 0 && seg[i].rx == 0))
+            return HAL_ERROR;
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_app_transfer_vec(SPI_APP_Device *dev, const SPI_APP_Seg *seg, uint8_t count, uint32_t timeout)
+{
+    HAL_StatusTypeDef ret = spi_app_vec_check(dev, seg, count);
+
+    if (ret != HAL_OK)
+        return ret;
+
+    SPI_APP_TS_START(dev);
+
+    ret = spi_app_bus_acquire(dev);
+    if (ret != HAL_OK)
+        return ret;
+
+    if (dev->hspi->State == HAL_SPI_STATE_READY)
+        MODIFY_REG(dev->hspi->Instance->CFG1, SPI_CFG1_FTHLV, dev->hspi->Init.FifoThreshold);
+
+    spi_app_cs_low(dev);
+    SPI_APP_TS_WIRE(dev);
+
+    for (uint8_t i = 0; i < count && ret == HAL_OK; i++)
+    {
+        if (seg[i].len <= SPI_APP_FAST_AUTO && dev->hspi->State == HAL_SPI_STATE_READY)
+            ret = spi_app_fast_xfer(dev, seg[i].tx, seg[i].rx, seg[i].len);
+        else
+            ret = spi_app_hal_xfer(dev, seg[i].tx, seg[i].rx, seg[i].len, timeout);
+    }
+
+    SPI_APP_TS_CPLT(dev);
+    spi_app_cs_high(dev);
+    spi_app_bus_release(dev);
+
+    SPI_APP_TS_RECORD(dev, ret != HAL_OK);
+    return ret;
+}
+
+HAL_StatusTypeDef spi_app_transfer_vec_dma(SPI_APP_Device *dev, const SPI_APP_Seg *seg, uint8_t count)
+{
+    HAL_StatusTypeDef ret = spi_app_vec_check(dev, seg, count);
+
+    if (ret != HAL_OK)
+        return ret;
+
+    /* Reject unreachable buffers now rather than halfway through with CS asserted */
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if ((seg[i].tx && !spi_app_dma_reachable(seg[i].tx)) || (seg[i].rx && !spi_app_dma_reachable(seg[i].rx)))
+            return HAL_ERROR;
+    }
+
+    if (!dev->dma_done)
+        return HAL_BUSY;
+
+    dev->vec = &seg[1];
+    dev->vec_left = (uint8_t)(count - 1u);
+
+    /* No repeat: a CRC mismatch in a later segment would resend segment 0 and skip that one */
+    ret = spi_app_dma_run(dev, seg[0].tx, seg[0].rx, seg[0].len, 0, 0);
+    if (ret != HAL_OK)
+        dev->vec_left = 0;
+
+    return ret;
+}
+
+/* Next segment of a vectored transfer (from the DMA IRQ, CS still asserted) */
+static HAL_StatusTypeDef spi_app_vec_next(SPI_APP_Device *dev)
+{
+    const SPI_APP_Seg *seg = dev->vec++;
+    HAL_StatusTypeDef ret;
+
+    dev->vec_left--;
+
+    ret = spi_app_dma_begin(dev, seg->tx, seg->rx, seg->len);
+    if (ret == HAL_OK)
+        ret = spi_app_dma_chunk(dev);
+
+    return ret;
+}
+
+/* Transaction queue */
+void spi_app_queue_attach(SPI_APP_Device *dev, SPI_APP_Queue *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->done = 1;
+
+    dev->queue = queue;
+}
+
+/* CS of a queued transaction (falls back to the device CS) */
+static void spi_app_txn_cs(SPI_APP_Device *dev, const SPI_APP_Txn *t, uint8_t assert)
+{
+    GPIO_PinState level;
+
+    if (t->CS_Port == 0)
+    {
+        if (assert) spi_app_cs_low(dev);
+        else spi_app_cs_high(dev);
+        return;
+    }
+
+    if (t->cs_active_low) level = assert ? GPIO_PIN_RESET : GPIO_PIN_SET;
+    else level = assert ? GPIO_PIN_SET : GPIO_PIN_RESET;
+
+    HAL_GPIO_WritePin(t->CS_Port, t->CS_Pin, level);
+}
+
+/* Start the transaction at the queue head (caller guarantees count > 0) */
+static HAL_StatusTypeDef spi_app_queue_start(SPI_APP_Device *dev)
+{
+    SPI_APP_Queue *q = dev->queue;
+    SPI_APP_Txn *t = &q->txn[q->head];
+    HAL_StatusTypeDef ret;
+
+    ret = spi_app_dma_begin(dev, t->tx, t->rx, t->len);
+    if (ret != HAL_OK)
+        return ret;
+
+    spi_app_txn_cs(dev, t, 1);
+    ret = spi_app_dma_chunk(dev);
+
+    if (ret != HAL_OK)
+    {
+        spi_app_txn_cs(dev, t, 0);
+        spi_app_rx_finish(dev, 0);
+    }
+
+    return ret;
+}
+
+/* Drop everything still queued and mark the chain as finished */
+static void spi_app_queue_finish(SPI_APP_Device *dev, uint8_t err)
+{
+    SPI_APP_Queue *q = dev->queue;
+    SPI_APP_Txn dropped[SPI_APP_QUEUE_LEN];
+    uint8_t n = 0;
+
+    if (err)
+    {
+        /* Callbacks run once the queue is consistent again (they may submit) */
+        for (n = 0; n < q->count; n++)
+            dropped[n] = q->txn[(q->head + n) % SPI_APP_QUEUE_LEN];
+
+        q->dropped += q->count;
+        q->head = (uint8_t)((q->head + q->count) % SPI_APP_QUEUE_LEN);
+        q->count = 0;
+    }
+
+    q->busy = 0;
+    q->err = err;
+    q->done = 1;
+
+    dev->dma_err = err;
+    dev->dma_done = 1;
+
+    spi_app_bus_release(dev);
+    spi_app_events_set(dev, err ? (SPI_APP_EVT_QUEUE | SPI_APP_EVT_ERROR) : SPI_APP_EVT_QUEUE);
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        if (dropped[i].cb)
+            dropped[i].cb(dev, HAL_ERROR, dropped[i].ctx);
+    }
+}
+
+/* Copies the descriptors, so the caller array can be reused right away */
+HAL_StatusTypeDef spi_app_queue_submit(SPI_APP_Device *dev, const SPI_APP_Txn *txn, uint8_t count)
+{
+    SPI_APP_Queue *q = dev->queue;
+    uint32_t primask;
+    uint8_t kick;
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    if (q == 0 || txn == 0 || count == 0)
+        return HAL_ERROR;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (txn[i].len == 0 || (txn[i].tx == 0 && txn[i].rx == 0))
+            return HAL_ERROR;
+    }
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    /* A plain spi_app_*_dma() transfer owns the bus */
+    if ((!q->busy && !dev->dma_done) || (q->count + count > SPI_APP_QUEUE_LEN))
+    {
+        __set_PRIMASK(primask);
+        return HAL_BUSY;
+    }
+
+    /* Idle queue: take the shared bus (if any), it is held until the queue drains */
+    if (!q->busy && spi_app_bus_acquire(dev) != HAL_OK)
+    {
+        __set_PRIMASK(primask);
+        return HAL_BUSY;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+        q->txn[(q->head + q->count + i) % SPI_APP_QUEUE_LEN] = txn[i];
+    q->count += count;
+
+    kick = !q->busy;
+    if (kick)
+    {
+        q->busy = 1;
+        q->done = 0;
+        q->err = 0;
+
+        dev->dma_done = 0;
+        dev->dma_err = 0;
+        dev->dma_hal_error = 0;
+        dev->events &= ~(SPI_APP_EVT_QUEUE | SPI_APP_EVT_ERROR);
+    }
+
+    __set_PRIMASK(primask);
+
+    /* Idle bus: start the first transaction, the rest is chained from the DMA callback */
+    if (kick)
+    {
+        ret = spi_app_queue_start(dev);
+        if (ret != HAL_OK)
+        {
+            primask = __get_PRIMASK();
+            __disable_irq();
+            spi_app_queue_finish(dev, 1);
+            __set_PRIMASK(primask);
+        }
+    }
+
+    return ret;
+}
+
+uint8_t spi_app_queue_idle(const SPI_APP_Device *dev)
+{
+    return (dev->queue == 0) || (dev->queue->busy == 0);
+}
+
+/* Completion of the transaction in flight: release its CS and chain the next one */
+static void spi_app_queue_cplt(SPI_APP_Device *dev)
+{
+    SPI_APP_Queue *q = dev->queue;
+    SPI_APP_DoneCb cb = q->txn[q->head].cb;
+    void *ctx = q->txn[q->head].ctx;
+    uint32_t primask;
+    uint8_t more;
+
+    spi_app_txn_cs(dev, &q->txn[q->head], 0);
+
+    q->completed++;
+    q->head = (uint8_t)((q->head + 1u) % SPI_APP_QUEUE_LEN);
+    q->count--;
+
+    /* Last one: its callback runs before the queue reports drained and lets the bus go. It may
+       submit more (appended to the busy queue), which is then chained instead */
+    if (q->count == 0)
+    {
+        if (cb)
+            cb(dev, HAL_OK, ctx);
+
+        primask = __get_PRIMASK();
+        __disable_irq();
+        more = q->count != 0;
+        if (!more)
+            spi_app_queue_finish(dev, 0);
+        __set_PRIMASK(primask);
+
+        if (more && spi_app_queue_start(dev) != HAL_OK)
+            spi_app_queue_finish(dev, 1);
+        return;
+    }
+
+    /* Chain first, the callback runs while the next transaction is on the wire */
+    if (spi_app_queue_start(dev) != HAL_OK)
+    {
+        /* This one completed before the rest is dropped: callbacks stay in submission order */
+        if (cb)
+            cb(dev, HAL_OK, ctx);
+        spi_app_queue_finish(dev, 1);
+        return;
+    }
+
+    if (cb)
+        cb(dev, HAL_OK, ctx);
+}
+
+/* Streaming */
+HAL_StatusTypeDef spi_app_dma_mode(DMA_HandleTypeDef *hdma, uint32_t mode)
+{
+    if (hdma->Init.Mode == mode)
+        return HAL_OK;
+
+    hdma->Init.Mode = mode;
+    return HAL_DMA_Init(hdma);
+}
+
+static HAL_StatusTypeDef spi_app_rx_dma_mode(SPI_APP_Device *dev, uint32_t mode)
+{
+    return spi_app_dma_mode(dev->hspi->hdmarx, mode);
+}
+
+/* buf holds 2 * block_len frames; each half must be cache-line safe (see SPI_APP_DMA_BUFFER) */
+HAL_StatusTypeDef spi_app_stream_start(SPI_APP_Device *dev, uint8_t *buf, uint16_t block_len,
+                                       SPI_APP_StreamCb cb, void *ctx)
+{
+    uint32_t bytes;
+    HAL_StatusTypeDef ret;
+
+    /* The HAL does not manage the CRC in circular mode */
+    if (buf == 0 || block_len == 0 || block_len > 0x7FFFu || dev->hspi->hdmarx == 0 ||
+        dev->hspi->Init.CRCCalculation == SPI_CRCCALCULATION_ENABLE)
+        return HAL_ERROR;
+
+    if (!dev->dma_done || dev->stream_on || !spi_app_queue_idle(dev))
+        return HAL_BUSY;
+
+    /* A stream keeps the shared bus until spi_app_stream_stop() */
+    ret = spi_app_bus_acquire(dev);
+    if (ret != HAL_OK)
+        return ret;
+
+    bytes = block_len * spi_app_frame_bytes(dev);
+    if (!spi_app_dma_reachable(buf) || !spi_app_cache_rx_safe(buf, bytes))
+    {
+        spi_app_bus_release(dev);
+        return HAL_ERROR;
+    }
+
+    ret = spi_app_dma_pack(dev, 0);
+    if (ret == HAL_OK)
+        ret = spi_app_rx_dma_mode(dev, DMA_CIRCULAR);
+    if (ret != HAL_OK)
+    {
+        spi_app_bus_release(dev);
+        return ret;
+    }
+
+    dev->stream_buf = buf;
+    dev->stream_block = block_len;
+    dev->stream_cb = cb;
+    dev->stream_ctx = ctx;
+    dev->stream_pending = 0;
+    dev->stream_blocks = 0;
+    dev->stream_overruns = 0;
+    spi_app_events_clear(dev, SPI_APP_EVT_BLOCK | SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR);
+
+    dev->dma_done = 0;
+    dev->dma_err = 0;
+    dev->dma_hal_error = 0;
+
+    dev->last_len = 0;
+    dev->last_tx = 0;
+    dev->last_rx = 0;
+
+    spi_app_cache_invalidate(buf, 2u * bytes);
+
+    dev->stream_on = 1;
+    spi_app_cs_low(dev);
+
+    /* RX-only (simplex receiver): no TX DMA and no dummy buffer, TSIZE = 0 for circular DMA */
+    ret = HAL_SPI_Receive_DMA(dev->hspi, buf, (uint16_t)(2u * block_len));
+
+    if (ret != HAL_OK)
+    {
+        spi_app_cs_high(dev);
+        dev->stream_on = 0;
+        (void)spi_app_rx_dma_mode(dev, DMA_NORMAL);
+        dev->dma_done = 1;
+        dev->dma_err = 1;
+        dev->dma_hal_error = dev->hspi->ErrorCode;
+        spi_app_bus_release(dev);
+    }
+
+    return ret;
+}
+
+/* Hand a block back to the driver once the consumer is done with it: block must be one of the two
+   halves passed to the callback, anything else is refused and leaves both pending */
+HAL_StatusTypeDef spi_app_stream_release(SPI_APP_Device *dev, const uint8_t *block)
+{
+    uint32_t primask;
+    uint8_t bit;
+
+    if (dev->stream_buf == 0)
+        return HAL_ERROR;
+
+    if (block == dev->stream_buf)
+        bit = 0x01u;
+    else if (block == dev->stream_buf + dev->stream_block * spi_app_frame_bytes(dev))
+        bit = 0x02u;
+    else
+        return HAL_ERROR;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    dev->stream_pending &= (uint8_t)~bit;
+    __set_PRIMASK(primask);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_app_stream_stop(SPI_APP_Device *dev)
+{
+    HAL_StatusTypeDef ret;
+
+    if (!dev->stream_on)
+        return HAL_OK;
+
+    ret = HAL_SPI_Abort(dev->hspi);
+    spi_app_cs_high(dev);
+
+    dev->stream_on = 0;
+    if (spi_app_rx_dma_mode(dev, DMA_NORMAL) != HAL_OK)
+        ret = HAL_ERROR;
+
+    dev->dma_done = 1;
+    spi_app_bus_release(dev);
+
+    return ret;
+}
+
+/* Half n of the ring is full; the DMA is now writing into the other one */
+static void spi_app_stream_deliver(SPI_APP_Device *dev, uint8_t half)
+{
+    uint32_t bytes = dev->stream_block * spi_app_frame_bytes(dev);
+    uint8_t *block = dev->stream_buf + half * bytes;
+
+    if (dev->stream_pending & (1u << (half ^ 1u)))
+        dev->stream_overruns++;
+
+    dev->stream_pending |= (uint8_t)(1u << half);
+    dev->stream_first = dev->stream_blocks * dev->stream_block;
+    dev->stream_blocks++;
+    spi_app_events_set(dev, SPI_APP_EVT_BLOCK);
+
+    spi_app_cache_invalidate(block, bytes);
+
+    if (dev->stream_cb)
+        dev->stream_cb(dev, block, dev->stream_block, dev->stream_ctx);
+}
+
+/* Transfer over (CS and bus released): publish the result */
+static void spi_app_dma_notify(SPI_APP_Device *dev, uint8_t err, uint32_t hal_error)
+{
+    SPI_APP_TS_RECORD(dev, err);
+
+    dev->dma_done = 1;
+    dev->dma_err = err;
+    dev->dma_hal_error = hal_error;
+    spi_app_events_set(dev, err ? (SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR) : SPI_APP_EVT_DONE);
+
+    if (dev->done_cb)
+        dev->done_cb(dev, err ? HAL_ERROR : HAL_OK, dev->done_ctx);
+}
+
+/* DTCM stage (MDMA) */
+static void spi_app_mdma_cplt(MDMA_HandleTypeDef *hmdma)
+{
+    SPI_APP_Device *dev = (SPI_APP_Device *)hmdma->Parent;
+
+    dev->mdma_dst = 0;
+    spi_app_dma_notify(dev, 0, 0);
+}
+
+static void spi_app_mdma_error(MDMA_HandleTypeDef *hmdma)
+{
+    SPI_APP_Device *dev = (SPI_APP_Device *)hmdma->Parent;
+
+    dev->mdma_dst = 0;
+    spi_app_dma_notify(dev, 1, hmdma->ErrorCode);
+}
+
+/* SW-triggered block copy, 32-bit beats in 32-beat bursts */
+HAL_StatusTypeDef spi_app_mdma_attach(SPI_APP_Device *dev, MDMA_HandleTypeDef *hmdma,
+                                      MDMA_Channel_TypeDef *channel)
+{
+    HAL_StatusTypeDef ret;
+
+    __HAL_RCC_MDMA_CLK_ENABLE();
+
+    hmdma->Instance = channel;
+    hmdma->Init.Request = MDMA_REQUEST_SW;
+    hmdma->Init.TransferTriggerMode = MDMA_BLOCK_TRANSFER;
+    hmdma->Init.Priority = MDMA_PRIORITY_HIGH;
+    hmdma->Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    hmdma->Init.SourceInc = MDMA_SRC_INC_WORD;
+    hmdma->Init.DestinationInc = MDMA_DEST_INC_WORD;
+    hmdma->Init.SourceDataSize = MDMA_SRC_DATASIZE_WORD;
+    hmdma->Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    hmdma->Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    hmdma->Init.BufferTransferLength = 128;
+    hmdma->Init.SourceBurst = MDMA_SOURCE_BURST_32BEATS;
+    hmdma->Init.DestBurst = MDMA_DEST_BURST_32BEATS;
+    hmdma->Init.SourceBlockAddressOffset = 0;
+    hmdma->Init.DestBlockAddressOffset = 0;
+
+    ret = HAL_MDMA_Init(hmdma);
+    if (ret != HAL_OK)
+        return ret;
+
+    hmdma->Parent = dev;
+    (void)HAL_MDMA_RegisterCallback(hmdma, HAL_MDMA_XFER_CPLT_CB_ID, spi_app_mdma_cplt);
+    (void)HAL_MDMA_RegisterCallback(hmdma, HAL_MDMA_XFER_ERROR_CB_ID, spi_app_mdma_error);
+
+    dev->mdma = hmdma;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_app_transfer_dma_dtcm(SPI_APP_Device *dev, uint8_t *tx, uint8_t *stage,
+                                            uint8_t *dst, uint32_t len)
+{
+    uint32_t bytes;
+    HAL_StatusTypeDef ret;
+
+    if (dev->mdma == 0 || stage == 0 || dst == 0 || len == 0)
+        return HAL_ERROR;
+
+    /* No bounce buffer here: MDMA must read what DMA1 wrote */
+    bytes = len * spi_app_frame_bytes(dev);
+    if (bytes > 65536u || (bytes & 3u) || ((uint32_t)dst & 3u) || spi_app_dma_reachable(dst) ||
+        !spi_app_dma_reachable(stage) || !spi_app_cache_rx_safe(stage, bytes))
+        return HAL_ERROR;
+
+    if (!dev->dma_done || dev->mdma_dst)
+        return HAL_BUSY;
+
+    dev->mdma_src = stage;
+    dev->mdma_bytes = bytes;
+    dev->mdma_dst = dst;
+
+    ret = spi_app_dma_run(dev, tx, stage, len, 0, 1);
+    if (ret != HAL_OK)
+        dev->mdma_dst = 0;
+
+    return ret;
+}
+
+/* Call this from HAL_SPI_RxHalfCpltCallback / TxRxHalfCplt (circular streaming only) */
+void spi_app_dma_half_cplt(SPI_APP_Device *dev)
+{
+    if (dev->stream_on)
+        spi_app_stream_deliver(dev, 0);
+}
+
+/* Call this from HAL_SPI_TxRxCpltCallback / TxCplt / RxCplt */
+void spi_app_dma_cplt(SPI_APP_Device *dev)
+{
+    if (dev->stream_on)
+    {
+        spi_app_stream_deliver(dev, 1);
+        return;
+    }
+
+    SPI_APP_TS_CPLT(dev);
+
+    spi_app_rx_finish(dev, 1);
+
+    /* Long transfer: resubmit the next chunk, CS stays asserted */
+    if (dev->xfer_left)
+    {
+        if (spi_app_dma_chunk(dev) != HAL_OK)
+            spi_app_dma_error(dev);
+        return;
+    }
+
+    /* Vectored transfer: next segment, same CS assertion */
+    if (dev->vec_left)
+    {
+        if (spi_app_vec_next(dev) != HAL_OK)
+            spi_app_dma_error(dev);
+        return;
+    }
+
+    if (dev->queue && dev->queue->busy)
+    {
+        spi_app_queue_cplt(dev);
+        return;
+    }
+
+    dev->crc_left = 0;
+    spi_app_cs_high(dev);
+    spi_app_bus_release(dev);
+
+    /* DTCM stage: the SPI is free, completion is reported by the MDMA callback */
+    if (dev->mdma_dst)
+    {
+        if (HAL_MDMA_Start_IT(dev->mdma, (uint32_t)dev->mdma_src, (uint32_t)dev->mdma_dst,
+                              dev->mdma_bytes, 1) != HAL_OK)
+        {
+            dev->mdma_dst = 0;
+            spi_app_dma_notify(dev, 1, dev->mdma->ErrorCode);
+        }
+        return;
+    }
+
+    spi_app_dma_notify(dev, 0, 0);
+}
+
+/* CRC mismatch on a single DMA/IT transfer: start it again under a new CS (bus still held) */
+static HAL_StatusTypeDef spi_app_crc_repeat(SPI_APP_Device *dev)
+{
+    HAL_StatusTypeDef ret;
+
+    dev->crc_left--;
+    spi_app_cs_high(dev);
+    spi_app_rx_finish(dev, 0);
+
+    ret = dev->crc_it ? spi_app_it_begin(dev, dev->crc_tx, dev->crc_rx, dev->crc_len) :
+                        spi_app_dma_begin(dev, dev->crc_tx, dev->crc_rx, dev->crc_len);
+    if (ret != HAL_OK)
+        return ret;
+
+    spi_app_cs_low(dev);
+    return spi_app_dma_chunk(dev);
+}
+
+/* Call this from HAL_SPI_ErrorCallback */
+void spi_app_dma_error(SPI_APP_Device *dev)
+{
+    uint8_t crc = (dev->hspi->ErrorCode & HAL_SPI_ERROR_CRC) != 0u;
+
+    if (crc)
+    {
+        dev->crc_errors++;
+        if (dev->crc_left && !dev->stream_on && spi_app_crc_repeat(dev) == HAL_OK)
+            return;
+        dev->crc_failures++;
+    }
+    dev->crc_left = 0;
+
+    SPI_APP_TS_CPLT(dev);
+
+    if (dev->stream_on)
+    {
+        dev->stream_on = 0;
+        (void)spi_app_rx_dma_mode(dev, DMA_NORMAL);
+    }
+
+    spi_app_rx_finish(dev, 0);
+    dev->xfer_left = 0;
+    dev->vec_left = 0;
+
+    if (dev->queue && dev->queue->busy)
+    {
+        spi_app_txn_cs(dev, &dev->queue->txn[dev->queue->head], 0);
+        dev->dma_hal_error = dev->hspi->ErrorCode;
+        spi_app_queue_finish(dev, 1);
+        return;
+    }
+
+    spi_app_cs_high(dev);
+    spi_app_bus_release(dev);
+
+    dev->mdma_dst = 0;
+    spi_app_dma_notify(dev, 1, dev->hspi->ErrorCode);
+}
+
+/* Adaptive transfer */
+static uint8_t spi_app_irq_enabled(const SPI_APP_Device *dev)
+{
+    SPI_TypeDef *spi = dev->hspi->Instance;
+    IRQn_Type irq;
+
+    if (spi == SPI1) irq = SPI1_IRQn;
+    else if (spi == SPI2) irq = SPI2_IRQn;
+    else if (spi == SPI3) irq = SPI3_IRQn;
+    else if (spi == SPI4) irq = SPI4_IRQn;
+    else if (spi == SPI5) irq = SPI5_IRQn;
+    else irq = SPI6_IRQn;
+
+    return NVIC_GetEnableIRQ(irq) != 0u;
+}
+
+/* Requested method, downgraded to what the hardware setup supports (DMA also needs the SPI IRQ) */
+uint8_t spi_app_xfer_method(const SPI_APP_Device *dev, uint8_t method, const uint8_t *tx, const uint8_t *rx)
+{
+    uint8_t irq = spi_app_irq_enabled(dev);
+    uint8_t dma = irq && (tx == 0 || dev->hspi->hdmatx) && (rx == 0 || dev->hspi->hdmarx);
+
+    if (method == SPI_APP_XFER_DMA && !dma) method = SPI_APP_XFER_IT;
+    if (method == SPI_APP_XFER_IT && !irq) method = SPI_APP_XFER_POLL;
+
+    return method;
+}
+
+HAL_StatusTypeDef spi_app_xfer_run(SPI_APP_Device *dev, uint8_t method, uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    HAL_StatusTypeDef ret;
+
+    if (method != SPI_APP_XFER_POLL)
+        return spi_app_dma_run(dev, tx, rx, len, method == SPI_APP_XFER_IT, 1);
+
+    if (!dev->dma_done || (dev->queue && dev->queue->busy))
+        return HAL_BUSY;
+
+    spi_app_events_clear(dev, SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR);
+
+    ret = spi_app_poll(dev, tx, rx, len, HAL_MAX_DELAY);
+    if (ret == HAL_BUSY)
+        return ret;
+
+    spi_app_dma_notify(dev, ret != HAL_OK, (ret != HAL_OK) ? dev->hspi->ErrorCode : 0);
+    return ret;
+}
+
+HAL_StatusTypeDef spi_app_xfer(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    uint8_t method;
+
+    if (len == 0 || (tx == 0 && rx == 0))
+        return HAL_ERROR;
+
+    if (len <= dev->xfer_poll_max) method = SPI_APP_XFER_POLL;
+    else if (len <= dev->xfer_it_max) method = SPI_APP_XFER_IT;
+    else method = SPI_APP_XFER_DMA;
+
+    return spi_app_xfer_run(dev, spi_app_xfer_method(dev, method, tx, rx), tx, rx, len);
+}
+
+/* Idle loop while an async transfer runs: the iterations it completes measure the free CPU */
+static uint32_t spi_app_xfer_idle(volatile uint8_t *done, uint32_t limit)
+{
+    uint32_t n = 0;
+
+    while (!*done && n < limit)
+        n++;
+
+    return n;
+}
+
+/* Cost of one idle-loop iteration, in 1/16 cycle (DWT running) */
+uint32_t spi_app_xfer_idle_cost(void)
+{
+    volatile uint8_t never = 0;
+    uint32_t start = spi_app_cycles();
+
+    (void)spi_app_xfer_idle(&never, 4096u);
+    return (spi_app_cycles() - start) / 256u;
+}
+
+/* Best of a few runs: CPU cycles spent by the transfer (all of it when polling) and latency */
+HAL_StatusTypeDef spi_app_xfer_measure(SPI_APP_Device *dev, uint8_t method, uint8_t *tx, uint8_t *rx,
+                                       uint32_t len, uint32_t idle_cost, uint32_t *cpu, uint32_t *lat)
+{
+    const uint32_t limit = 0x01000000u;
+    uint32_t start, t, n;
+    HAL_StatusTypeDef ret;
+
+    *cpu = 0xFFFFFFFFu;
+    *lat = 0xFFFFFFFFu;
+
+    for (uint8_t i = 0; i < 3u; i++)
+    {
+        start = spi_app_cycles();
+        ret = spi_app_xfer_run(dev, method, tx, rx, len);
+        n = (ret == HAL_OK && method != SPI_APP_XFER_POLL) ? spi_app_xfer_idle(&dev->dma_done, limit) : 0;
+        t = spi_app_cycles() - start;
+
+        if (ret != HAL_OK || n == limit || dev->dma_err)
+            return HAL_ERROR;
+
+        n = (n * idle_cost) / 16u;
+        if (n > t) n = t;
+        if (t - n < *cpu) *cpu = t - n;
+        if (t < *lat) *lat = t;
+    }
+
+    return HAL_OK;
+}
+
+/* CPU cost first, latency as tie-break */
+static uint8_t spi_app_xfer_better(uint32_t cpu_a, uint32_t lat_a, uint32_t cpu_b, uint32_t lat_b)
+{
+    return (cpu_a < cpu_b) || (cpu_a == cpu_b && lat_a <= lat_b);
+}
+
+HAL_StatusTypeDef spi_app_xfer_calibrate(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t max_len)
+{
+    uint32_t cpu[3], lat[3];
+    uint32_t idle_cost;
+    uint32_t poll_max = 0, it_max = 0;
+    uint8_t it_ok, dma_ok;
+    uint8_t poll_wins = 1, it_wins = 1;
+    HAL_StatusTypeDef ret;
+
+    if (max_len == 0 || max_len > SPI_APP_CHUNK_MAX || (tx == 0 && rx == 0))
+        return HAL_ERROR;
+
+    if (!dev->dma_done || (dev->queue && dev->queue->busy) || dev->stream_on)
+        return HAL_BUSY;
+
+    it_ok = spi_app_xfer_method(dev, SPI_APP_XFER_IT, tx, rx) == SPI_APP_XFER_IT;
+    dma_ok = spi_app_xfer_method(dev, SPI_APP_XFER_DMA, tx, rx) == SPI_APP_XFER_DMA;
+
+    spi_app_cycles_init();
+    idle_cost = spi_app_xfer_idle_cost();
+
+    for (uint32_t len = 1; len <= max_len; len = (len < max_len && len * 2u > max_len) ? max_len : len * 2u)
+    {
+        ret = spi_app_xfer_measure(dev, SPI_APP_XFER_POLL, tx, rx, len, idle_cost, &cpu[0], &lat[0]);
+        if (ret != HAL_OK)
+            return ret;
+
+        cpu[1] = cpu[2] = lat[1] = lat[2] = 0xFFFFFFFFu;
+        if (it_ok && spi_app_xfer_measure(dev, SPI_APP_XFER_IT, tx, rx, len, idle_cost, &cpu[1], &lat[1]) != HAL_OK)
+            return HAL_ERROR;
+        if (dma_ok && spi_app_xfer_measure(dev, SPI_APP_XFER_DMA, tx, rx, len, idle_cost, &cpu[2], &lat[2]) != HAL_OK)
+            return HAL_ERROR;
+
+        /* Crossovers: the cheaper method must win on every length from 1 up to the threshold */
+        poll_wins = poll_wins && spi_app_xfer_better(cpu[0], lat[0], cpu[1], lat[1]) &&
+                    spi_app_xfer_better(cpu[0], lat[0], cpu[2], lat[2]);
+        it_wins = it_wins && it_ok && spi_app_xfer_better(cpu[1], lat[1], cpu[2], lat[2]);
+
+        if (poll_wins) poll_max = len;
+        if (it_wins) it_max = len;
+
+        if (len == max_len)
+            break;
+    }
+
+    if (it_max < poll_max)
+        it_max = poll_max;
+
+    dev->xfer_poll_max = poll_max;
+    dev->xfer_it_max = it_max;
+
+    return HAL_OK;
+}
+
+/* Measurement helpers */
+/* Enables the counter once and never resets it: the latency stats, stripes and benchmarks all take
+   differences of the same free-running CYCCNT, a reset would corrupt the ones in flight */
+void spi_app_cycles_init(void)
+{
+    if (!(CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk))
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk))
+    {
+        DWT->LAR = 0xC5ACCE55u;    // Cortex-M7: unlock DWT write access
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+}
+
+uint32_t spi_app_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+/* Cache helpers (STM32H7) */
+static uint8_t spi_app_dcache_enabled(void)
+{
+    return (SCB->CCR & SCB_CCR_DC_Msk) != 0u;
+}
+
+/* Write back the cache lines covering [addr, addr + size) before the DMA reads them */
+void spi_app_cache_clean(const void *addr, uint32_t size)
+{
+    uint32_t start, end;
+
+    if (size == 0 || !spi_app_dcache_enabled())
+        return;
+
+    start = (uint32_t)addr & ~(SPI_APP_CACHE_LINE - 1u);
+    end = ((uint32_t)addr + size + SPI_APP_CACHE_LINE - 1u) & ~(SPI_APP_CACHE_LINE - 1u);
+
+    SCB_CleanDCache_by_Addr((uint32_t *)start, (int32_t)(end - start));
+}
+
+/* Discard the cache lines covering [addr, addr + size): the range must own whole lines
+   (see spi_app_cache_rx_safe), otherwise neighbouring CPU writes may be lost */
+void spi_app_cache_invalidate(void *addr, uint32_t size)
+{
+    uint32_t start, end;
+
+    if (size == 0 || !spi_app_dcache_enabled())
+        return;
+
+    start = (uint32_t)addr & ~(SPI_APP_CACHE_LINE - 1u);
+    end = ((uint32_t)addr + size + SPI_APP_CACHE_LINE - 1u) & ~(SPI_APP_CACHE_LINE - 1u);
+
+    SCB_InvalidateDCache_by_Addr((uint32_t *)start, (int32_t)(end - start));
+}
+
+/* 1 if a DMA RX buffer can be invalidated without touching foreign data */
+uint8_t spi_app_cache_rx_safe(const void *addr, uint32_t size)
+{
+    if (!spi_app_dcache_enabled())
+        return 1;
+
+    return (((uint32_t)addr | size) & (SPI_APP_CACHE_LINE - 1u)) == 0u;
 }
@@ -0,0 +1,173 @@
+/**
+  ******************************************************************************
+  * @file           : spi_bench.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_bench.h"
+
+/* Blocking transactions per second (SystemCoreClock based): run it with and without
+   spi_app_hw_nss_enable() to compare the GPIO and hardware chip select paths */
+uint32_t spi_bench_txn_rate(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len, uint32_t count)
+{
+    uint32_t start, cycles;
+
+    if (count == 0)
+        return 0;
+
+    spi_app_cycles_init();
+
+    start = spi_app_cycles();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (spi_app_transfer(dev, tx, rx, len, 10) != HAL_OK)
+            return 0;
+    }
+    cycles = spi_app_cycles() - start;
+
+    if (cycles == 0)
+        return 0;
+
+    return (uint32_t)(((uint64_t)count * SystemCoreClock) / cycles);
+}
+
+/* Same DMA transfer unpacked ([0]) and packed ([1]): SPI DMA requests and cycles to completion.
+   The requests are the bus-matrix transactions on the peripheral side, the figure to compare
+   against the ADC DMA traffic (the Cortex-M7 has no AHB load counter) */
+HAL_StatusTypeDef spi_bench_pack(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len,
+                                 uint32_t requests[2], uint32_t cycles[2])
+{
+    uint8_t saved = dev->dma_pack;
+    uint32_t start, spin;
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    spi_app_cycles_init();
+
+    for (uint8_t i = 0; i < 2u && ret == HAL_OK; i++)
+    {
+        spi_app_dma_pack_enable(dev, i);
+        dev->dma_requests = 0;
+
+        start = spi_app_cycles();
+        ret = spi_app_xfer_run(dev, SPI_APP_XFER_DMA, tx, rx, len);
+
+        for (spin = 0x01000000u; ret == HAL_OK && !dev->dma_done && spin; spin--)
+            ;
+        cycles[i] = spi_app_cycles() - start;
+        requests[i] = dev->dma_requests;
+
+        if (ret == HAL_OK && (spin == 0 || dev->dma_err))
+            ret = HAL_ERROR;
+    }
+
+    spi_app_dma_pack_enable(dev, saved);
+    return ret;
+}
+
+/* Average cycles per blocking transaction (CS included) through the HAL and through the fast
+   path, same buffers and length. Run it on each device to compare the SPI1/2/3 settings */
+HAL_StatusTypeDef spi_bench_fast(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t len, uint32_t count,
+                                 uint32_t *hal_cycles, uint32_t *fast_cycles)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    uint32_t start;
+
+    if (count == 0 || len == 0 || len > SPI_APP_CHUNK_MAX || (tx == 0 && rx == 0))
+        return HAL_ERROR;
+
+    if (dev->hspi->State != HAL_SPI_STATE_READY)
+        return HAL_BUSY;
+
+    ret = spi_app_bus_acquire(dev);
+    if (ret != HAL_OK)
+        return ret;
+
+    spi_app_cycles_init();
+
+    start = spi_app_cycles();
+    for (uint32_t i = 0; i < count && ret == HAL_OK; i++)
+    {
+        spi_app_cs_low(dev);
+        ret = spi_app_hal_xfer(dev, tx, rx, len, 10);
+        spi_app_cs_high(dev);
+    }
+    *hal_cycles = (spi_app_cycles() - start) / count;
+
+    start = spi_app_cycles();
+    for (uint32_t i = 0; i < count && ret == HAL_OK; i++)
+    {
+        spi_app_cs_low(dev);
+        ret = spi_app_fast_xfer(dev, tx, rx, len);
+        spi_app_cs_high(dev);
+    }
+    *fast_cycles = (spi_app_cycles() - start) / count;
+
+    spi_app_bus_release(dev);
+    return ret;
+}
+
+uint32_t spi_bench_suite(SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx, uint32_t max_len,
+                         SPI_BENCH_Row *row, uint32_t max_rows, uint32_t *cs)
+{
+    uint32_t rate = spi_app_byte_rate(dev);
+    uint32_t fb = spi_app_frame_bytes(dev);
+    uint32_t idle_cost, start, n = 0;
+
+    if (max_len == 0 || max_len > SPI_APP_CHUNK_MAX || tx == 0 || rx == 0 || rate == 0u)
+        return 0;
+
+    if (!dev->dma_done || (dev->queue && dev->queue->busy) || dev->stream_on)
+        return 0;
+
+    spi_app_cycles_init();
+    idle_cost = spi_app_xfer_idle_cost();
+
+    if (cs)
+    {
+        start = spi_app_cycles();
+        for (uint32_t i = 0; i < 64u; i++)
+        {
+            spi_app_cs_low(dev);
+            spi_app_cs_high(dev);
+        }
+        *cs = (spi_app_cycles() - start) / 64u;
+    }
+
+    for (uint32_t len = 1; len <= max_len; len = (len < max_len && len * 2u > max_len) ? max_len : len * 2u)
+    {
+        uint32_t bytes = len * fb;
+        uint32_t wire = (uint32_t)(((uint64_t)bytes * SystemCoreClock) / rate);
+
+        for (uint8_t dir = SPI_BENCH_WRITE; dir <= SPI_BENCH_TRANSFER; dir++)
+        {
+            uint8_t *t = (dir == SPI_BENCH_READ) ? 0 : tx;
+            uint8_t *r = (dir == SPI_BENCH_WRITE) ? 0 : rx;
+
+            /* Methods this device cannot run (no IRQ, no DMA stream) are left out */
+            for (uint8_t m = SPI_APP_XFER_POLL; m <= SPI_APP_XFER_DMA; m++)
+            {
+                SPI_BENCH_Row *b = &row[n];
+
+                if (spi_app_xfer_method(dev, m, t, r) != m)
+                    continue;
+
+                if (n == max_rows || spi_app_xfer_measure(dev, m, t, r, len, idle_cost, &b->cpu, &b->lat) != HAL_OK)
+                    return n;
+
+                b->method = m;
+                b->dir = dir;
+                b->len = len;
+                b->overhead = (b->lat > wire) ? b->lat - wire : 0u;
+                b->bytes_per_s = b->lat ? (uint32_t)(((uint64_t)bytes * SystemCoreClock) / b->lat) : 0u;
+                n++;
+            }
+        }
+
+        if (len == max_len)
+            break;
+    }
+
+    return n;
+}
@@ -0,0 +1,286 @@
+/**
+  ******************************************************************************
+  * @file           : spi_link.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_link.h"
+#include <string.h>
+
+#if (SPI_LINK_SLOT % SPI_APP_CACHE_LINE) != 0 || SPI_LINK_SLOT > 255u + SPI_LINK_HDR + SPI_LINK_CRC
+#error "SPI_LINK_SLOT must be a multiple of SPI_APP_CACHE_LINE, with a payload below 256 bytes"
+#endif
+#if SPI_LINK_WINDOW > 8u || (SPI_LINK_WINDOW & (SPI_LINK_WINDOW - 1u)) != 0
+#error "SPI_LINK_WINDOW must be a power of 2, at most 8"
+#endif
+
+#define SPI_LINK_DATA       0x01u      // flags: the slot carries a payload
+
+#define SPI_LINK_IDX(seq)   ((uint8_t)(seq) & (SPI_LINK_WINDOW - 1u))
+
+/* CRC-32 (IEEE 802.3, reflected), nibble table */
+static uint32_t spi_link_crc(const uint8_t *p, uint32_t len)
+{
+    static const uint32_t tab[16] = {
+        0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu, 0x76DC4190u, 0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu,
+        0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu, 0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu
+    };
+    uint32_t crc = 0xFFFFFFFFu;
+
+    while (len--)
+    {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ tab[crc & 0x0Fu];
+        crc = (crc >> 4) ^ tab[crc & 0x0Fu];
+    }
+
+    return ~crc;
+}
+
+/* CRC field, LSB first */
+static void spi_link_crc_put(uint8_t *s, uint32_t crc)
+{
+    for (uint8_t k = 0; k < SPI_LINK_CRC; k++)
+        s[SPI_LINK_SLOT - SPI_LINK_CRC + k] = (uint8_t)(crc >> (8u * k));
+}
+
+static uint32_t spi_link_crc_get(const uint8_t *s)
+{
+    uint32_t crc = 0;
+
+    for (uint8_t k = 0; k < SPI_LINK_CRC; k++)
+        crc |= (uint32_t)s[SPI_LINK_SLOT - SPI_LINK_CRC + k] << (8u * k);
+
+    return crc;
+}
+
+void spi_link_init(SPI_LINK_Endpoint *link, SPI_LINK_RxCb cb, void *ctx)
+{
+    memset(link, 0, sizeof(*link));
+    link->cb = cb;
+    link->ctx = ctx;
+}
+
+/* Thread context; on the slave the window is also read and slid by the DMA IRQ (prepare, ack):
+   the slot is filled and published (win_acked, tx_next) with the IRQs masked */
+HAL_StatusTypeDef spi_link_send(SPI_LINK_Endpoint *link, const uint8_t *data, uint8_t len)
+{
+    uint32_t primask;
+    uint8_t i;
+
+    if (len > SPI_LINK_PAYLOAD || (len && data == 0))
+        return HAL_ERROR;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    if ((uint8_t)(link->tx_next - link->tx_base) >= SPI_LINK_WINDOW)
+    {
+        __set_PRIMASK(primask);
+        return HAL_BUSY;
+    }
+
+    i = SPI_LINK_IDX(link->tx_next);
+    memcpy(link->win[i], data, len);
+    link->win_len[i] = len;
+    link->win_acked &= (uint8_t)~(1u << i);
+    link->tx_next++;
+
+    __set_PRIMASK(primask);
+    return HAL_OK;
+}
+
+uint8_t spi_link_unacked(const SPI_LINK_Endpoint *link)
+{
+    uint32_t primask;
+    uint8_t n;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    n = (uint8_t)(link->tx_next - link->tx_base);
+    __set_PRIMASK(primask);
+
+    return n;
+}
+
+/* Outgoing slot: a frame past its ACK timeout first, else the next new one, else ACK only */
+static void spi_link_prepare(SPI_LINK_Endpoint *link)
+{
+    uint8_t *s = link->tx;
+    uint8_t sent = (uint8_t)(link->tx_unsent - link->tx_base);
+    uint8_t sack = 0;
+    int16_t seq = -1;
+
+    for (uint8_t k = 0; k < sent; k++)
+    {
+        uint8_t i = SPI_LINK_IDX(link->tx_base + k);
+
+        if (!(link->win_acked & (1u << i)) && (link->exchanges - link->win_sent[i]) >= SPI_LINK_RTO)
+        {
+            seq = (uint8_t)(link->tx_base + k);
+            link->retransmits++;
+            break;
+        }
+    }
+
+    if (seq < 0 && link->tx_unsent != link->tx_next)
+        seq = link->tx_unsent++;
+
+    /* Bit n: rx_next + 1 + n is held */
+    for (uint8_t n = 0; n + 1u < SPI_LINK_WINDOW; n++)
+        if (link->held_map & (1u << SPI_LINK_IDX(link->rx_next + 1u + n)))
+            sack |= (uint8_t)(1u << n);
+
+    s[1] = 0;
+    s[2] = link->rx_next;
+    s[3] = sack;
+    s[4] = 0;
+
+    if (seq >= 0)
+    {
+        uint8_t i = SPI_LINK_IDX(seq);
+
+        s[0] = SPI_LINK_DATA;
+        s[1] = (uint8_t)seq;
+        s[4] = link->win_len[i];
+        memcpy(&s[SPI_LINK_HDR], link->win[i], link->win_len[i]);
+        link->win_sent[i] = link->exchanges;
+        link->frames++;
+    }
+    else
+        s[0] = 0;
+
+    spi_link_crc_put(s, spi_link_crc(s, SPI_LINK_SLOT - SPI_LINK_CRC));
+}
+
+/* Peer ACK: cumulative up to ack, selective above it; the window slides over acknowledged frames */
+static void spi_link_ack(SPI_LINK_Endpoint *link, uint8_t ack, uint8_t sack)
+{
+    uint8_t sent = (uint8_t)(link->tx_unsent - link->tx_base);
+    uint8_t upto = (uint8_t)(ack - link->tx_base);
+
+    if (upto > sent)
+        return;
+
+    for (uint8_t k = 0; k < sent; k++)
+    {
+        uint8_t seq = (uint8_t)(link->tx_base + k);
+        uint8_t d = (uint8_t)(seq - ack - 1u);
+
+        if (k < upto || (d < 8u && (sack & (1u << d))))
+            link->win_acked |= (uint8_t)(1u << SPI_LINK_IDX(seq));
+    }
+
+    while (link->tx_base != link->tx_unsent && (link->win_acked & (1u << SPI_LINK_IDX(link->tx_base))))
+    {
+        link->acked_bytes += link->win_len[SPI_LINK_IDX(link->tx_base)];
+        link->tx_base++;
+    }
+}
+
+/* Incoming slot: dropped on CRC mismatch, else ACK processed and the payload delivered in order */
+static void spi_link_input(SPI_LINK_Endpoint *link)
+{
+    const uint8_t *s = link->rx;
+    uint8_t d, i;
+
+    link->exchanges++;
+
+    if (spi_link_crc(s, SPI_LINK_SLOT - SPI_LINK_CRC) != spi_link_crc_get(s) || s[4] > SPI_LINK_PAYLOAD)
+    {
+        link->crc_errors++;
+        return;
+    }
+
+    spi_link_ack(link, s[2], s[3]);
+
+    if (!(s[0] & SPI_LINK_DATA))
+        return;
+
+    d = (uint8_t)(s[1] - link->rx_next);
+    i = SPI_LINK_IDX(s[1]);
+
+    if (d >= SPI_LINK_WINDOW || (d && (link->held_map & (1u << i))))
+    {
+        link->duplicates++;
+        return;
+    }
+
+    if (d)
+    {
+        memcpy(link->held[i], &s[SPI_LINK_HDR], s[4]);
+        link->held_len[i] = s[4];
+        link->held_map |= (uint8_t)(1u << i);
+        return;
+    }
+
+    link->delivered++;
+    if (link->cb) link->cb(link, &s[SPI_LINK_HDR], s[4], link->ctx);
+    link->rx_next++;
+
+    /* Frames held behind it */
+    while (link->held_map & (1u << SPI_LINK_IDX(link->rx_next)))
+    {
+        i = SPI_LINK_IDX(link->rx_next);
+        link->held_map &= (uint8_t)~(1u << i);
+        link->delivered++;
+        if (link->cb) link->cb(link, link->held[i], link->held_len[i], link->ctx);
+        link->rx_next++;
+    }
+}
+
+/* Master */
+HAL_StatusTypeDef spi_link_exchange(SPI_LINK_Endpoint *link, SPI_APP_Device *dev)
+{
+    HAL_StatusTypeDef ret;
+
+    spi_link_prepare(link);
+
+    ret = spi_app_xfer(dev, link->tx, link->rx, SPI_LINK_SLOT);
+    if (ret == HAL_OK)
+        ret = spi_app_dma_wait(dev, SPI_LINK_TIMEOUT);
+
+    /* A failed transfer is a lost slot: the retransmit timer covers it */
+    if (ret == HAL_OK)
+        spi_link_input(link);
+    else
+        link->exchanges++;
+
+    return ret;
+}
+
+/* Slave */
+static HAL_StatusTypeDef spi_link_slave_start(SPI_LINK_Endpoint *link)
+{
+    spi_link_prepare(link);
+    spi_app_cache_clean(link->tx, SPI_LINK_SLOT);
+    spi_app_cache_invalidate(link->rx, SPI_LINK_SLOT);
+
+    return HAL_SPI_TransmitReceive_DMA(link->hspi, link->tx, link->rx, SPI_LINK_SLOT);
+}
+
+HAL_StatusTypeDef spi_link_slave_arm(SPI_LINK_Endpoint *link, SPI_HandleTypeDef *hspi)
+{
+    if (hspi->Init.Mode != SPI_MODE_SLAVE || hspi->Init.DataSize != SPI_DATASIZE_8BIT ||
+        hspi->hdmatx == 0 || hspi->hdmarx == 0)
+        return HAL_ERROR;
+
+    link->hspi = hspi;
+    return spi_link_slave_start(link);
+}
+
+void spi_link_slave_cplt(SPI_LINK_Endpoint *link)
+{
+    spi_app_cache_invalidate(link->rx, SPI_LINK_SLOT);
+    spi_link_input(link);
+    (void)spi_link_slave_start(link);
+}
+
+void spi_link_slave_error(SPI_LINK_Endpoint *link)
+{
+    link->exchanges++;
+    (void)spi_link_slave_start(link);
+}
+
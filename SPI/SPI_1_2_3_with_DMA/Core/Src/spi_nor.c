@@ -0,0 +1,481 @@
+/**
+  ******************************************************************************
+  * @file           : spi_nor.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_nor.h"
+#include <string.h>
+
+#if (SPI_NOR_LINE % SPI_APP_CACHE_LINE) != 0 || SPI_NOR_LINE < SPI_NOR_PAGE
+#error "SPI_NOR_LINE must be a multiple of SPI_APP_CACHE_LINE and at least SPI_NOR_PAGE"
+#endif
+
+#define SPI_NOR_NONE        0xFFFFFFFFu
+
+/* Opcodes */
+#define SPI_NOR_WREN        0x06u
+#define SPI_NOR_RDSR        0x05u
+#define SPI_NOR_RDID        0x9Fu
+#define SPI_NOR_FAST_READ   0x0Bu
+#define SPI_NOR_FAST_READ4  0x0Cu
+#define SPI_NOR_PP          0x02u
+#define SPI_NOR_PP4         0x12u
+#define SPI_NOR_SE          0x20u
+#define SPI_NOR_SE4         0x21u
+
+#define SPI_NOR_SR_WIP      0x01u
+
+/* JEDEC capacity code: 2^code bytes; 0x20.. is used by several vendors for 64 MB and above */
+static uint32_t spi_nor_jedec_size(uint8_t code)
+{
+    if (code >= 0x10u && code <= 0x1Fu) return 1u << code;
+    if (code >= 0x20u && code <= 0x22u) return 1u << (code - 6u);
+    return 0;
+}
+
+/* Opcode + address (+ dummy byte for reads) */
+static uint8_t spi_nor_hdr(SPI_NOR_Flash *nor, uint8_t op, uint32_t addr)
+{
+    uint8_t n = 0;
+
+    nor->hdr[n++] = op;
+    if (nor->addr_bytes == 4u)
+        nor->hdr[n++] = (uint8_t)(addr >> 24);
+    nor->hdr[n++] = (uint8_t)(addr >> 16);
+    nor->hdr[n++] = (uint8_t)(addr >> 8);
+    nor->hdr[n++] = (uint8_t)addr;
+    if (op == nor->op_read)
+        nor->hdr[n++] = 0;
+
+    return n;
+}
+
+/* Wait for the DMA in flight (page program or prefetch) */
+static HAL_StatusTypeDef spi_nor_dma_sync(SPI_NOR_Flash *nor)
+{
+    HAL_StatusTypeDef ret;
+
+    if (!nor->dma_busy)
+        return HAL_OK;
+
+    ret = spi_app_dma_wait(nor->dev, SPI_NOR_XFER_TIMEOUT);
+    nor->dma_busy = 0;
+
+    if (nor->fetch >= 0)
+    {
+        if (ret != HAL_OK)
+            nor->line_addr[nor->fetch] = SPI_NOR_NONE;
+        nor->fetch = -1;
+    }
+
+    return ret;
+}
+
+/* Header then data under one CS: DMA when async (returns once started), blocking otherwise */
+static HAL_StatusTypeDef spi_nor_run(SPI_NOR_Flash *nor, uint8_t hdr_len, const uint8_t *tx, uint8_t *rx,
+                                     uint32_t len, uint8_t async)
+{
+    HAL_StatusTypeDef ret = spi_nor_dma_sync(nor);
+
+    if (ret != HAL_OK)
+        return ret;
+
+    nor->seg[0].tx = nor->hdr;
+    nor->seg[0].rx = 0;
+    nor->seg[0].len = hdr_len;
+    nor->seg[1].tx = tx;
+    nor->seg[1].rx = rx;
+    nor->seg[1].len = len;
+
+    if (!async || !nor->async)
+        return spi_app_transfer_vec(nor->dev, nor->seg, 2, SPI_NOR_XFER_TIMEOUT);
+
+    ret = spi_app_transfer_vec_dma(nor->dev, nor->seg, 2);
+    if (ret == HAL_OK)
+        nor->dma_busy = 1;
+
+    return ret;
+}
+
+/* Busy-poll the status register until the program / erase in progress is over */
+static HAL_StatusTypeDef spi_nor_ready(SPI_NOR_Flash *nor)
+{
+    uint8_t tx[2] = { SPI_NOR_RDSR, 0 };
+    uint8_t rx[2];
+    uint32_t start;
+    HAL_StatusTypeDef ret = spi_nor_dma_sync(nor);
+
+    if (ret != HAL_OK || nor->wip == 0u)
+        return ret;
+
+    start = HAL_GetTick();
+
+    for (;;)
+    {
+        ret = spi_app_transfer(nor->dev, tx, rx, 2, SPI_NOR_XFER_TIMEOUT);
+        nor->polls++;
+        if (ret != HAL_OK)
+            return ret;
+
+        if (!(rx[1] & SPI_NOR_SR_WIP))
+            break;
+
+        if ((HAL_GetTick() - start) >= nor->wip)
+            return HAL_TIMEOUT;
+    }
+
+    nor->wip = 0;
+    return HAL_OK;
+}
+
+static HAL_StatusTypeDef spi_nor_wren(SPI_NOR_Flash *nor)
+{
+    uint8_t op = SPI_NOR_WREN;
+
+    return spi_app_write(nor->dev, &op, 1, SPI_NOR_XFER_TIMEOUT);
+}
+
+HAL_StatusTypeDef spi_nor_init(SPI_NOR_Flash *nor, SPI_APP_Device *dev, uint32_t size)
+{
+    uint8_t tx[4] = { SPI_NOR_RDID, 0, 0, 0 };
+    uint8_t rx[4];
+    uint32_t data_size = dev->bus ? dev->cfg.DataSize : dev->hspi->Init.DataSize;
+    HAL_StatusTypeDef ret;
+
+    if (data_size != SPI_DATASIZE_8BIT)
+        return HAL_ERROR;
+
+    memset(nor, 0, sizeof(*nor));
+    nor->dev = dev;
+    nor->async = (dev->hspi->hdmatx != 0 && dev->hspi->hdmarx != 0);
+    nor->fetch = -1;
+    nor->line_addr[0] = nor->line_addr[1] = SPI_NOR_NONE;
+    nor->page_addr[0] = nor->page_addr[1] = SPI_NOR_NONE;
+    nor->next_addr = SPI_NOR_NONE;
+
+    ret = spi_app_transfer(dev, tx, rx, 4, SPI_NOR_XFER_TIMEOUT);
+    if (ret != HAL_OK)
+        return ret;
+
+    nor->jedec_id = ((uint32_t)rx[1] << 16) | ((uint32_t)rx[2] << 8) | rx[3];
+    if (nor->jedec_id == 0u || nor->jedec_id == 0xFFFFFFu)
+        return HAL_ERROR;
+
+    nor->size = size ? size : spi_nor_jedec_size(rx[3]);
+    if (nor->size == 0u || (nor->size % SPI_NOR_SECTOR) != 0u)
+        return HAL_ERROR;
+
+    if (nor->size > 0x1000000u)
+    {
+        nor->addr_bytes = 4;
+        nor->op_read = SPI_NOR_FAST_READ4;
+        nor->op_prog = SPI_NOR_PP4;
+        nor->op_erase = SPI_NOR_SE4;
+    }
+    else
+    {
+        nor->addr_bytes = 3;
+        nor->op_read = SPI_NOR_FAST_READ;
+        nor->op_prog = SPI_NOR_PP;
+        nor->op_erase = SPI_NOR_SE;
+    }
+
+    return HAL_OK;
+}
+
+/* Write-behind */
+
+/* Program the filled part of page buffer b; the flash busy time overlaps whatever follows */
+static HAL_StatusTypeDef spi_nor_program(SPI_NOR_Flash *nor, uint8_t b)
+{
+    uint16_t lo = nor->page_lo[b];
+    uint8_t n;
+    HAL_StatusTypeDef ret = spi_nor_ready(nor);
+
+    if (ret == HAL_OK)
+        ret = spi_nor_wren(nor);
+
+    if (ret == HAL_OK)
+    {
+        n = spi_nor_hdr(nor, nor->op_prog, nor->page_addr[b] + lo);
+        ret = spi_nor_run(nor, n, &nor->page[b][lo], 0, (uint32_t)(nor->page_hi[b] - lo), 1);
+    }
+
+    if (ret == HAL_OK)
+    {
+        nor->wip = SPI_NOR_PROG_TIMEOUT;
+        nor->pages++;
+    }
+
+    nor->page_addr[b] = SPI_NOR_NONE;
+    return ret;
+}
+
+/* Start programming the page being filled and switch to the other buffer. The program just
+   issued waited for the previous one, so the buffer switched to is no longer read by the DMA */
+static HAL_StatusTypeDef spi_nor_flush(SPI_NOR_Flash *nor)
+{
+    HAL_StatusTypeDef ret;
+
+    if (nor->page_addr[nor->fill] == SPI_NOR_NONE)
+        return HAL_OK;
+
+    ret = spi_nor_program(nor, nor->fill);
+    nor->fill ^= 1u;
+
+    return ret;
+}
+
+HAL_StatusTypeDef spi_nor_sync(SPI_NOR_Flash *nor)
+{
+    HAL_StatusTypeDef ret = spi_nor_flush(nor);
+
+    if (ret != HAL_OK)
+        return ret;
+
+    return spi_nor_ready(nor);
+}
+
+/* Forget the read-ahead windows overlapping [addr, addr + len) */
+static void spi_nor_drop(SPI_NOR_Flash *nor, uint32_t addr, uint32_t len)
+{
+    for (uint8_t i = 0; i < 2u; i++)
+    {
+        if (nor->line_addr[i] != SPI_NOR_NONE && addr < nor->line_addr[i] + SPI_NOR_LINE &&
+            nor->line_addr[i] < addr + len)
+            nor->line_addr[i] = SPI_NOR_NONE;
+    }
+}
+
+/* 1 if the page being filled overlaps [addr, addr + len) */
+static uint8_t spi_nor_pending(const SPI_NOR_Flash *nor, uint32_t addr, uint32_t len)
+{
+    uint32_t page = nor->page_addr[nor->fill];
+
+    return page != SPI_NOR_NONE && addr < page + SPI_NOR_PAGE && page < addr + len;
+}
+
+HAL_StatusTypeDef spi_nor_write(SPI_NOR_Flash *nor, uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    uint32_t page, off, n;
+    uint8_t b;
+    HAL_StatusTypeDef ret;
+
+    if (len == 0 || addr >= nor->size || len > nor->size - addr)
+        return HAL_ERROR;
+
+    /* A prefetch may cover the range: let it land before dropping the windows */
+    if (nor->fetch >= 0)
+    {
+        ret = spi_nor_dma_sync(nor);
+        if (ret != HAL_OK)
+            return ret;
+    }
+    spi_nor_drop(nor, addr, len);
+
+    while (len)
+    {
+        page = addr & ~(SPI_NOR_PAGE - 1u);
+        off = addr - page;
+        n = SPI_NOR_PAGE - off;
+        if (n > len)
+            n = len;
+
+        if (nor->page_addr[nor->fill] != page)
+        {
+            ret = spi_nor_flush(nor);
+            if (ret != HAL_OK)
+                return ret;
+
+            /* Erased value: bytes not written leave the flash unchanged */
+            b = nor->fill;
+            memset(nor->page[b], 0xFF, SPI_NOR_PAGE);
+            nor->page_addr[b] = page;
+            nor->page_lo[b] = SPI_NOR_PAGE;
+            nor->page_hi[b] = 0;
+        }
+
+        b = nor->fill;
+        memcpy(&nor->page[b][off], data, n);
+        if (off < nor->page_lo[b]) nor->page_lo[b] = (uint16_t)off;
+        if (off + n > nor->page_hi[b]) nor->page_hi[b] = (uint16_t)(off + n);
+
+        data += n;
+        addr += n;
+        len -= n;
+
+        /* Full page: program it now, the next one is filled while the flash is busy */
+        if (nor->page_lo[b] == 0u && nor->page_hi[b] == SPI_NOR_PAGE)
+        {
+            ret = spi_nor_flush(nor);
+            if (ret != HAL_OK)
+                return ret;
+        }
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_nor_erase(SPI_NOR_Flash *nor, uint32_t addr, uint32_t len)
+{
+    uint8_t n;
+    HAL_StatusTypeDef ret;
+
+    if (len == 0 || ((addr | len) % SPI_NOR_SECTOR) != 0u || addr >= nor->size || len > nor->size - addr)
+        return HAL_ERROR;
+
+    ret = spi_nor_sync(nor);
+    if (ret != HAL_OK)
+        return ret;
+
+    spi_nor_drop(nor, addr, len);
+
+    for (; len; addr += SPI_NOR_SECTOR, len -= SPI_NOR_SECTOR)
+    {
+        ret = spi_nor_ready(nor);
+        if (ret == HAL_OK)
+            ret = spi_nor_wren(nor);
+        if (ret != HAL_OK)
+            return ret;
+
+        n = spi_nor_hdr(nor, nor->op_erase, addr);
+        ret = spi_app_write(nor->dev, nor->hdr, n, SPI_NOR_XFER_TIMEOUT);
+        if (ret != HAL_OK)
+            return ret;
+
+        nor->wip = SPI_NOR_ERASE_TIMEOUT;
+    }
+
+    return HAL_OK;
+}
+
+/* Read-ahead */
+
+/* Window holding base (aligned to SPI_NOR_LINE), loaded on a miss into the one not used last */
+static HAL_StatusTypeDef spi_nor_line(SPI_NOR_Flash *nor, uint32_t base, uint8_t *idx)
+{
+    uint8_t i, n;
+    HAL_StatusTypeDef ret;
+
+    for (i = 0; i < 2u; i++)
+    {
+        if (nor->line_addr[i] != base)
+            continue;
+
+        if (nor->fetch == (int8_t)i)
+            (void)spi_nor_dma_sync(nor);
+
+        if (nor->line_addr[i] == base)
+        {
+            nor->hits++;
+            nor->line_mru = i;
+            *idx = i;
+            return HAL_OK;
+        }
+    }
+
+    nor->misses++;
+    i = nor->line_mru ^ 1u;
+    nor->line_addr[i] = SPI_NOR_NONE;
+
+    /* The window must not cache data still in the write-behind buffer */
+    if (spi_nor_pending(nor, base, SPI_NOR_LINE))
+    {
+        ret = spi_nor_flush(nor);
+        if (ret != HAL_OK)
+            return ret;
+    }
+
+    ret = spi_nor_ready(nor);
+    if (ret != HAL_OK)
+        return ret;
+
+    n = spi_nor_hdr(nor, nor->op_read, base);
+    ret = spi_nor_run(nor, n, 0, nor->line[i], SPI_NOR_LINE, 0);
+    if (ret != HAL_OK)
+        return ret;
+
+    nor->line_addr[i] = base;
+    nor->line_mru = i;
+    *idx = i;
+
+    return HAL_OK;
+}
+
+/* Load the window at base in the background; skipped while the bus or the flash is busy */
+static void spi_nor_prefetch(SPI_NOR_Flash *nor, uint32_t base)
+{
+    uint8_t i = nor->line_mru ^ 1u;
+    uint8_t n;
+
+    if (!nor->async || nor->dma_busy || nor->wip || base >= nor->size ||
+        nor->line_addr[0] == base || nor->line_addr[1] == base || spi_nor_pending(nor, base, SPI_NOR_LINE))
+        return;
+
+    n = spi_nor_hdr(nor, nor->op_read, base);
+    nor->line_addr[i] = base;
+    nor->fetch = (int8_t)i;
+
+    if (spi_nor_run(nor, n, 0, nor->line[i], SPI_NOR_LINE, 1) != HAL_OK)
+    {
+        nor->line_addr[i] = SPI_NOR_NONE;
+        nor->fetch = -1;
+        return;
+    }
+
+    nor->prefetches++;
+}
+
+HAL_StatusTypeDef spi_nor_read(SPI_NOR_Flash *nor, uint32_t addr, uint8_t *buf, uint32_t len)
+{
+    uint8_t sequential = (addr == nor->next_addr);
+    uint32_t base = 0, off, n;
+    uint8_t i;
+    HAL_StatusTypeDef ret;
+
+    if (len == 0 || addr >= nor->size || len > nor->size - addr)
+        return HAL_ERROR;
+
+    nor->next_addr = addr + len;
+
+    /* Long read: straight into buf, no copy through the windows. Data still in the
+       write-behind buffer is programmed first */
+    if (len >= SPI_NOR_LINE)
+    {
+        ret = spi_nor_pending(nor, addr, len) ? spi_nor_flush(nor) : HAL_OK;
+        if (ret == HAL_OK)
+            ret = spi_nor_ready(nor);
+        if (ret != HAL_OK)
+            return ret;
+
+        n = spi_nor_hdr(nor, nor->op_read, addr);
+        return spi_nor_run(nor, (uint8_t)n, 0, buf, len, 0);
+    }
+
+    while (len)
+    {
+        base = addr & ~(SPI_NOR_LINE - 1u);
+        ret = spi_nor_line(nor, base, &i);
+        if (ret != HAL_OK)
+            return ret;
+
+        off = addr - base;
+        n = SPI_NOR_LINE - off;
+        if (n > len)
+            n = len;
+
+        memcpy(buf, &nor->line[i][off], n);
+        buf += n;
+        addr += n;
+        len -= n;
+    }
+
+    /* Sequential access: fetch the next window while the caller consumes this one */
+    if (sequential)
+        spi_nor_prefetch(nor, base + SPI_NOR_LINE);
+
+    return HAL_OK;
+}
@@ -0,0 +1,180 @@
+/**
+  ******************************************************************************
+  * @file           : spi_pool.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_pool.h"
+#include <string.h>
+
+#if (SPI_POOL_BLOCK % SPI_APP_CACHE_LINE) != 0 || SPI_POOL_COUNT > 32
+#error "SPI_POOL_BLOCK must be a multiple of SPI_APP_CACHE_LINE and SPI_POOL_COUNT <= 32"
+#endif
+
+static int32_t spi_pool_index(const SPI_POOL_Pool *pool, const uint8_t *block)
+{
+    uint32_t off = (uint32_t)(block - &pool->mem[0][0]);
+
+    if (block < &pool->mem[0][0] || off >= sizeof(pool->mem) || (off % SPI_POOL_BLOCK))
+        return -1;
+
+    return (int32_t)(off / SPI_POOL_BLOCK);
+}
+
+static uint32_t spi_pool_bit(const SPI_POOL_Pool *pool, const uint8_t *block)
+{
+    return block ? 1u << spi_pool_index(pool, block) : 0u;
+}
+
+void spi_pool_init(SPI_POOL_Pool *pool)
+{
+    pool->used = 0;
+    pool->driver = 0;
+    pool->peak = 0;
+    memset(pool->xfer, 0, sizeof(pool->xfer));
+}
+
+uint8_t *spi_pool_acquire(SPI_POOL_Pool *pool)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint32_t n;
+
+    __disable_irq();
+
+    for (uint32_t i = 0; i < SPI_POOL_COUNT; i++)
+    {
+        if (!(pool->used & (1u << i)))
+        {
+            pool->used |= 1u << i;
+
+            n = (uint32_t)__builtin_popcount(pool->used);
+            if (n > pool->peak)
+                pool->peak = n;
+
+            __set_PRIMASK(primask);
+            return pool->mem[i];
+        }
+    }
+
+    __set_PRIMASK(primask);
+    return 0;
+}
+
+HAL_StatusTypeDef spi_pool_release(SPI_POOL_Pool *pool, uint8_t *block)
+{
+    int32_t i = spi_pool_index(pool, block);
+    uint32_t primask;
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    if (i < 0)
+        return HAL_ERROR;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (pool->driver & (1u << i)) ret = HAL_BUSY;
+    else if (!(pool->used & (1u << i))) ret = HAL_ERROR;
+    else pool->used &= ~(1u << i);
+
+    __set_PRIMASK(primask);
+    return ret;
+}
+
+/* Completion: TX block back to the pool, RX block to the application, then the device callback */
+static void spi_pool_cplt(SPI_APP_Device *dev, HAL_StatusTypeDef status, void *ctx)
+{
+    SPI_POOL_Xfer *x = (SPI_POOL_Xfer *)ctx;
+    SPI_POOL_Pool *pool = x->pool;
+    SPI_APP_DoneCb cb = x->prev_cb;
+    void *cb_ctx = x->prev_ctx;
+    uint32_t primask;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    pool->driver &= ~(spi_pool_bit(pool, x->tx) | spi_pool_bit(pool, x->rx));
+    if (x->tx && x->tx != x->rx)
+        pool->used &= ~spi_pool_bit(pool, x->tx);
+    x->dev = 0;
+
+    __set_PRIMASK(primask);
+
+    spi_app_set_callback(dev, cb, cb_ctx);
+    if (cb)
+        cb(dev, status, cb_ctx);
+}
+
+HAL_StatusTypeDef spi_pool_submit(SPI_POOL_Pool *pool, SPI_APP_Device *dev, uint8_t *tx, uint8_t *rx,
+                                  uint32_t len)
+{
+    uint32_t bytes = len * spi_app_frame_bytes(dev);
+    uint32_t owned;
+    uint32_t primask;
+    SPI_POOL_Xfer *x = 0;
+    int32_t i;
+    HAL_StatusTypeDef ret;
+
+    if ((tx == 0 && rx == 0) || len == 0 || bytes > SPI_POOL_BLOCK)
+        return HAL_ERROR;
+
+    if (tx && ((i = spi_pool_index(pool, tx)) < 0 || !(pool->used & (1u << i))))
+        return HAL_ERROR;
+    if (rx && ((i = spi_pool_index(pool, rx)) < 0 || !(pool->used & (1u << i))))
+        return HAL_ERROR;
+
+    if (!dev->dma_done)
+        return HAL_BUSY;
+
+    owned = spi_pool_bit(pool, tx) | spi_pool_bit(pool, rx);
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    for (i = 0; i < (int32_t)SPI_POOL_XFERS && x == 0; i++)
+        if (pool->xfer[i].dev == 0)
+            x = &pool->xfer[i];
+    if (x == 0 || (pool->driver & owned))
+    {
+        __set_PRIMASK(primask);
+        return HAL_BUSY;
+    }
+    pool->driver |= owned;
+    x->pool = pool;
+    x->dev = dev;
+    x->tx = tx;
+    x->rx = rx;
+    x->prev_cb = dev->done_cb;
+    x->prev_ctx = dev->done_ctx;
+    __set_PRIMASK(primask);
+
+    spi_app_set_callback(dev, spi_pool_cplt, x);
+
+    if (tx && rx) ret = spi_app_transfer_dma(dev, tx, rx, len);
+    else if (tx) ret = spi_app_write_dma(dev, tx, len);
+    else ret = spi_app_read_dma(dev, rx, len);
+
+    /* Not started: ownership and the device callback go back to the caller */
+    if (ret != HAL_OK)
+    {
+        spi_app_set_callback(dev, x->prev_cb, x->prev_ctx);
+
+        primask = __get_PRIMASK();
+        __disable_irq();
+        pool->driver &= ~owned;
+        x->dev = 0;
+        __set_PRIMASK(primask);
+    }
+
+    return ret;
+}
+
+uint32_t spi_pool_in_use(const SPI_POOL_Pool *pool)
+{
+    return (uint32_t)__builtin_popcount(pool->used);
+}
+
+uint32_t spi_pool_high_water(const SPI_POOL_Pool *pool)
+{
+    return pool->peak;
+}
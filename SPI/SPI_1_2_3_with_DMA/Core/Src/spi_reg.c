@@ -0,0 +1,242 @@
+/**
+  ******************************************************************************
+  * @file           : spi_reg.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_reg.h"
+#include <string.h>
+
+#if SPI_REG_COUNT > 256u
+#error "SPI_REG_COUNT: register addresses are 8-bit"
+#endif
+
+static inline uint8_t spi_reg_bit(const uint32_t *map, uint32_t reg)
+{
+    return (uint8_t)((map[reg >> 5] >> (reg & 31u)) & 1u);
+}
+
+static inline void spi_reg_set(uint32_t *map, uint32_t reg)
+{
+    map[reg >> 5] |= 1UL << (reg & 31u);
+}
+
+static inline void spi_reg_clear(uint32_t *map, uint32_t reg)
+{
+    map[reg >> 5] &= ~(1UL << (reg & 31u));
+}
+
+/* Cached: the shadow can stand in for the device */
+static inline uint8_t spi_reg_cached(const SPI_REG_Map *map, uint32_t reg)
+{
+    return spi_reg_bit(map->valid, reg) && !spi_reg_bit(map->volat, reg);
+}
+
+/* Address byte then len data bytes under one CS */
+static HAL_StatusTypeDef spi_reg_xfer(SPI_REG_Map *map, uint8_t reg, uint8_t read, const uint8_t *tx,
+                                      uint8_t *rx, uint32_t len)
+{
+    map->hdr = reg;
+    if (read) map->hdr |= map->read_bit;
+    if (len > 1u) map->hdr |= map->inc_bit;
+
+    map->seg[0].tx = &map->hdr;
+    map->seg[0].rx = 0;
+    map->seg[0].len = 1;
+    map->seg[1].tx = tx;
+    map->seg[1].rx = rx;
+    map->seg[1].len = len;
+
+    map->xfers++;
+    return spi_app_transfer_vec(map->dev, map->seg, 2, SPI_REG_TIMEOUT);
+}
+
+HAL_StatusTypeDef spi_reg_init(SPI_REG_Map *map, SPI_APP_Device *dev, uint8_t read_bit, uint8_t inc_bit)
+{
+    uint32_t data_size = dev->bus ? dev->cfg.DataSize : dev->hspi->Init.DataSize;
+
+    if (data_size != SPI_DATASIZE_8BIT)
+        return HAL_ERROR;
+
+    memset(map, 0, sizeof(*map));
+    map->dev = dev;
+    map->read_bit = read_bit;
+    map->inc_bit = inc_bit;
+
+    return HAL_OK;
+}
+
+void spi_reg_volatile(SPI_REG_Map *map, uint8_t reg, uint8_t count)
+{
+    for (uint32_t r = reg; r < (uint32_t)reg + count && r < SPI_REG_COUNT; r++)
+        spi_reg_set(map->volat, r);
+}
+
+void spi_reg_invalidate(SPI_REG_Map *map)
+{
+    memset(map->valid, 0, sizeof(map->valid));
+    memset(map->dirty, 0, sizeof(map->dirty));
+}
+
+/* Reads */
+
+HAL_StatusTypeDef spi_reg_read_burst(SPI_REG_Map *map, uint8_t reg, uint8_t *buf, uint8_t len)
+{
+    HAL_StatusTypeDef ret;
+
+    if (buf == 0 || len == 0 || (uint32_t)reg + len > SPI_REG_COUNT)
+        return HAL_ERROR;
+
+    ret = spi_reg_xfer(map, reg, 1, 0, buf, len);
+    if (ret != HAL_OK)
+        return ret;
+
+    map->saved += len - 1u;
+
+    /* A pending write keeps its shadow value */
+    for (uint32_t i = 0; i < len; i++)
+    {
+        uint32_t r = reg + i;
+
+        if (spi_reg_bit(map->volat, r) || spi_reg_bit(map->dirty, r))
+            continue;
+
+        map->val[r] = buf[i];
+        spi_reg_set(map->valid, r);
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_reg_read(SPI_REG_Map *map, uint8_t reg, uint8_t *val)
+{
+    if (val == 0 || reg >= SPI_REG_COUNT)
+        return HAL_ERROR;
+
+    if (spi_reg_cached(map, reg))
+    {
+        *val = map->val[reg];
+        map->hits++;
+        map->saved++;
+        return HAL_OK;
+    }
+
+    return spi_reg_read_burst(map, reg, val, 1);
+}
+
+/* Writes */
+
+HAL_StatusTypeDef spi_reg_write(SPI_REG_Map *map, uint8_t reg, uint8_t val)
+{
+    HAL_StatusTypeDef ret;
+
+    if (reg >= SPI_REG_COUNT)
+        return HAL_ERROR;
+
+    if (spi_reg_cached(map, reg) && !spi_reg_bit(map->dirty, reg) && map->val[reg] == val)
+    {
+        map->saved++;
+        return HAL_OK;
+    }
+
+    ret = spi_reg_xfer(map, reg, 0, &val, 0, 1);
+    if (ret != HAL_OK)
+        return ret;
+
+    map->val[reg] = val;
+    spi_reg_clear(map->dirty, reg);
+    if (!spi_reg_bit(map->volat, reg))
+        spi_reg_set(map->valid, reg);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_reg_stage(SPI_REG_Map *map, uint8_t reg, uint8_t val)
+{
+    if (reg >= SPI_REG_COUNT)
+        return HAL_ERROR;
+
+    if (spi_reg_bit(map->dirty, reg))
+        map->saved++;              // replaces a pending write
+    else if (spi_reg_cached(map, reg) && map->val[reg] == val)
+    {
+        map->saved++;              // already the device value
+        return HAL_OK;
+    }
+
+    map->val[reg] = val;
+    spi_reg_set(map->dirty, reg);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_reg_update(SPI_REG_Map *map, uint8_t reg, uint8_t mask, uint8_t val)
+{
+    uint8_t cur;
+    HAL_StatusTypeDef ret;
+
+    if (reg >= SPI_REG_COUNT)
+        return HAL_ERROR;
+
+    if (spi_reg_bit(map->dirty, reg))
+        cur = map->val[reg];
+    else
+    {
+        ret = spi_reg_read(map, reg, &cur);
+        if (ret != HAL_OK)
+            return ret;
+    }
+
+    return spi_reg_stage(map, reg, (uint8_t)((cur & ~mask) | (val & mask)));
+}
+
+/* Each run of dirty registers in one burst; up to SPI_REG_GAP clean cached registers between two
+   runs are written back with their shadow value rather than starting a new transaction */
+HAL_StatusTypeDef spi_reg_flush(SPI_REG_Map *map)
+{
+    uint32_t r = 0;
+    HAL_StatusTypeDef ret;
+
+    while (r < SPI_REG_COUNT)
+    {
+        uint32_t end, n = 1, gap = 0;
+
+        if (!spi_reg_bit(map->dirty, r))
+        {
+            r++;
+            continue;
+        }
+
+        end = r + 1u;
+        for (uint32_t e = end; e < SPI_REG_COUNT; e++)
+        {
+            if (spi_reg_bit(map->dirty, e))
+            {
+                end = e + 1u;
+                n++;
+                gap = 0;
+            }
+            else if (gap < SPI_REG_GAP && spi_reg_cached(map, e))
+                gap++;
+            else
+                break;
+        }
+
+        ret = spi_reg_xfer(map, (uint8_t)r, 0, &map->val[r], 0, end - r);
+        if (ret != HAL_OK)
+            return ret;
+
+        map->saved += n - 1u;
+
+        for (; r < end; r++)
+        {
+            spi_reg_clear(map->dirty, r);
+            if (!spi_reg_bit(map->volat, r))
+                spi_reg_set(map->valid, r);
+        }
+    }
+
+    return HAL_OK;
+}
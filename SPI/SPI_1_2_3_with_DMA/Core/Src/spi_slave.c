@@ -0,0 +1,270 @@
+/**
+  ******************************************************************************
+  * @file           : spi_slave.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_slave.h"
+#include <string.h>
+
+HAL_StatusTypeDef spi_slave_init(SPI_SLAVE_Rx *slv, SPI_HandleTypeDef *hspi,
+                                 GPIO_TypeDef *NSS_Port, uint16_t NSS_Pin, uint8_t alternate)
+{
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    uint32_t line, shift;
+    HAL_StatusTypeDef ret;
+
+    if (hspi->hdmarx == 0 || NSS_Pin == 0 || (NSS_Pin & (NSS_Pin - 1u)) != 0)
+        return HAL_ERROR;
+
+    if (hspi->State != HAL_SPI_STATE_READY)
+        return HAL_BUSY;
+
+    memset(slv, 0, sizeof(*slv));
+    slv->hspi = hspi;
+    slv->NSS_Port = NSS_Port;
+    slv->NSS_Pin = NSS_Pin;
+
+    /* Clocked by the master; the SPI only shifts while NSS is low */
+    hspi->Init.Mode = SPI_MODE_SLAVE;
+    hspi->Init.NSS = SPI_NSS_HARD_INPUT;
+    hspi->Init.NSSPolarity = SPI_NSS_POLARITY_LOW;
+    hspi->Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+
+    ret = HAL_SPI_Init(hspi);
+    if (ret != HAL_OK)
+        return ret;
+
+    slv->frame_bytes = spi_app_size_bytes(hspi->Init.DataSize);
+
+    /* Pull-up: no packet while the master is unplugged or in reset */
+    GPIO_InitStruct.Pin = NSS_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+    GPIO_InitStruct.Alternate = alternate;
+    HAL_GPIO_Init(NSS_Port, &GPIO_InitStruct);
+
+    /* End of packet: EXTI on the NSS rising edge (HAL_GPIO_Init() only sets up EXTI for input
+       modes, but the EXTI input stage also sees pins in alternate function) */
+    line = POSITION_VAL(NSS_Pin);
+    shift = 4u * (line & 0x03u);
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    MODIFY_REG(SYSCFG->EXTICR[line >> 2], 0x0Fu << shift, GPIO_GET_INDEX(NSS_Port) << shift);
+    SET_BIT(EXTI->RTSR1, NSS_Pin);
+    CLEAR_BIT(EXTI->FTSR1, NSS_Pin);
+    __HAL_GPIO_EXTI_CLEAR_IT(NSS_Pin);
+    SET_BIT(EXTI_D1->IMR1, NSS_Pin);
+
+    return HAL_OK;
+}
+
+/* (Re)start the circular reception at frame 0 of the ring */
+static HAL_StatusTypeDef spi_slave_arm(SPI_SLAVE_Rx *slv)
+{
+    slv->rd = 0;
+    slv->pkt_len = 0;
+    spi_app_cache_invalidate(slv->ring, slv->ring_len * slv->frame_bytes);
+
+    /* RX-only: MISO not driven, TSIZE = 0 (circular) */
+    return HAL_SPI_Receive_DMA(slv->hspi, slv->ring, (uint16_t)slv->ring_len);
+}
+
+HAL_StatusTypeDef spi_slave_start(SPI_SLAVE_Rx *slv, uint8_t *ring, uint16_t ring_len,
+                                  SPI_SLAVE_Cb cb, void *ctx)
+{
+    HAL_StatusTypeDef ret;
+
+    if (ring == 0 || ring_len < 2u || (ring_len & 1u) != 0 || !spi_app_dma_reachable(ring) ||
+        !spi_app_cache_rx_safe(ring, ring_len * slv->frame_bytes))
+        return HAL_ERROR;
+
+    if (slv->on || slv->hspi->State != HAL_SPI_STATE_READY)
+        return HAL_BUSY;
+
+    ret = spi_app_dma_mode(slv->hspi->hdmarx, DMA_CIRCULAR);
+    if (ret != HAL_OK)
+        return ret;
+
+    slv->ring = ring;
+    slv->ring_len = ring_len;
+    slv->cb = cb;
+    slv->ctx = ctx;
+    slv->packets = 0;
+    slv->frames = 0;
+    slv->dropped = 0;
+    slv->fifo_overruns = 0;
+    slv->ring_overruns = 0;
+    slv->errors = 0;
+
+    /* Started in the middle of a packet: skip its tail */
+    slv->resync = (HAL_GPIO_ReadPin(slv->NSS_Port, slv->NSS_Pin) == GPIO_PIN_RESET);
+
+    slv->on = 1;
+    ret = spi_slave_arm(slv);
+    if (ret != HAL_OK)
+    {
+        slv->on = 0;
+        (void)spi_app_dma_mode(slv->hspi->hdmarx, DMA_NORMAL);
+    }
+
+    return ret;
+}
+
+/* Frames not yet delivered are discarded */
+HAL_StatusTypeDef spi_slave_stop(SPI_SLAVE_Rx *slv)
+{
+    HAL_StatusTypeDef ret;
+
+    if (!slv->on)
+        return HAL_OK;
+
+    slv->on = 0;
+    ret = HAL_SPI_Abort(slv->hspi);
+    if (spi_app_dma_mode(slv->hspi->hdmarx, DMA_NORMAL) != HAL_OK)
+        ret = HAL_ERROR;
+
+    return ret;
+}
+
+/* Ring position of the DMA (next frame it writes) */
+static uint32_t spi_slave_pos(const SPI_SLAVE_Rx *slv)
+{
+    uint32_t left = __HAL_DMA_GET_COUNTER(slv->hspi->hdmarx);
+
+    return (left == 0u || left >= slv->ring_len) ? 0u : slv->ring_len - left;
+}
+
+/* Deliver [rd, to) as the next piece of the packet in progress */
+static void spi_slave_piece(SPI_SLAVE_Rx *slv, uint32_t to, uint8_t flags)
+{
+    uint8_t *data = slv->ring + slv->rd * slv->frame_bytes;
+    uint32_t len = to - slv->rd;
+
+    slv->rd = (to == slv->ring_len) ? 0u : to;
+    slv->frames += len;
+
+    if (slv->resync)
+    {
+        if (flags & SPI_SLAVE_PKT_END)
+            slv->resync = 0;
+        return;
+    }
+
+    slv->pkt_len += len;
+    if (len == 0u && !((flags & SPI_SLAVE_PKT_END) && slv->pkt_len))
+        return;
+
+    spi_app_cache_invalidate(data, len * slv->frame_bytes);
+
+    if (flags & SPI_SLAVE_PKT_END)
+    {
+        slv->packets++;
+        slv->pkt_len = 0;
+    }
+
+    if (slv->cb)
+        slv->cb(slv, data, len, flags, slv->ctx);
+}
+
+/* Deliver what the DMA wrote since the last call (two pieces if it wrapped) */
+static void spi_slave_flush(SPI_SLAVE_Rx *slv, uint8_t flags)
+{
+    uint32_t pos = spi_slave_pos(slv);
+
+    if (pos < slv->rd)
+        spi_slave_piece(slv, slv->ring_len, 0);
+    spi_slave_piece(slv, pos, flags);
+}
+
+/* The packet in progress (if any) is lost: tell the consumer, skip the rest of it */
+static void spi_slave_drop(SPI_SLAVE_Rx *slv)
+{
+    uint8_t active = (HAL_GPIO_ReadPin(slv->NSS_Port, slv->NSS_Pin) == GPIO_PIN_RESET);
+
+    if (slv->pkt_len && slv->cb)
+        slv->cb(slv, 0, 0, SPI_SLAVE_PKT_END | SPI_SLAVE_PKT_DROP, slv->ctx);
+
+    if (!slv->resync && (slv->pkt_len || active))
+        slv->dropped++;
+
+    slv->pkt_len = 0;
+    slv->resync = active;
+}
+
+/* Half of the ring filled: the DMA should now be in the other half, anywhere else it went
+   past the delivery point while this IRQ was held off */
+static void spi_slave_boundary(SPI_SLAVE_Rx *slv, uint8_t second)
+{
+    uint32_t pos = spi_slave_pos(slv);
+    uint8_t in_second = (pos >= slv->ring_len / 2u);
+
+    if (in_second != second)
+    {
+        slv->ring_overruns++;
+        spi_slave_drop(slv);
+        slv->rd = pos;
+        return;
+    }
+
+    /* Long packets are handed over piece by piece before the DMA comes back over them */
+    spi_slave_flush(slv, 0);
+}
+
+/* Call this from HAL_GPIO_EXTI_Callback for the NSS pin (rising edge: packet over) */
+void spi_slave_nss_edge(SPI_SLAVE_Rx *slv)
+{
+    SPI_TypeDef *spi = slv->hspi->Instance;
+    uint32_t spin = SPI_APP_FAST_SPIN;
+
+    if (!slv->on)
+        return;
+
+    /* Last frame still in the RX FIFO: let the DMA pick it up */
+    while ((spi->SR & SPI_SR_RXP) && --spin)
+        ;
+
+    spi_slave_flush(slv, SPI_SLAVE_PKT_END);
+}
+
+/* Call this from HAL_SPI_RxHalfCpltCallback of the slave SPI */
+void spi_slave_half_cplt(SPI_SLAVE_Rx *slv)
+{
+    if (slv->on)
+        spi_slave_boundary(slv, 1);
+}
+
+/* Call this from HAL_SPI_RxCpltCallback of the slave SPI */
+void spi_slave_cplt(SPI_SLAVE_Rx *slv)
+{
+    if (slv->on)
+        spi_slave_boundary(slv, 0);
+}
+
+/* Call this from HAL_SPI_ErrorCallback of the slave SPI: the HAL has stopped the reception,
+   count the error and re-arm */
+void spi_slave_error(SPI_SLAVE_Rx *slv)
+{
+    if (!slv->on)
+        return;
+
+    if (slv->hspi->ErrorCode & HAL_SPI_ERROR_OVR)
+        slv->fifo_overruns++;
+    else
+        slv->errors++;
+
+    spi_slave_drop(slv);
+
+    /* The HAL aborts the DMA only when TXDMAEN and RXDMAEN are both set: RX-only, the stream
+       is still enabled and the re-arm would fail on it */
+    if (HAL_DMA_GetState(slv->hspi->hdmarx) == HAL_DMA_STATE_BUSY)
+        (void)HAL_DMA_Abort(slv->hspi->hdmarx);
+
+    if (spi_slave_arm(slv) != HAL_OK)
+    {
+        slv->on = 0;
+        (void)spi_app_dma_mode(slv->hspi->hdmarx, DMA_NORMAL);
+    }
+}
@@ -0,0 +1,161 @@
+/**
+  ******************************************************************************
+  * @file           : spi_stripe.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_stripe.h"
+#include <string.h>
+
+HAL_StatusTypeDef spi_stripe_init(SPI_STRIPE_Set *s, SPI_APP_Device *const *dev, uint8_t count)
+{
+    uint8_t i;
+
+    if (count == 0 || count > SPI_STRIPE_MAX)
+        return HAL_ERROR;
+
+    memset(s, 0, sizeof(*s));
+    s->count = count;
+    s->done = 1;
+
+    for (i = 0; i < count; i++)
+    {
+        s->dev[i] = dev[i];
+        s->rate[i] = spi_app_byte_rate(dev[i]);
+        if (s->rate[i] == 0u)
+            return HAL_ERROR;
+    }
+
+    spi_app_cycles_init();
+
+    return HAL_OK;
+}
+
+/* Stripe n over (or not started): the last one restores the device callbacks and reports */
+static void spi_stripe_finish(SPI_STRIPE_Set *s, uint8_t n, uint8_t err)
+{
+    uint32_t now = DWT->CYCCNT;
+    uint32_t primask;
+    uint8_t left, i;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    s->t_done[n] = now - s->t_start;
+    if (err)
+        s->err = 1;
+    s->pending &= (uint8_t)~(1u << n);
+    left = s->pending;
+    __set_PRIMASK(primask);
+
+    if (left)
+        return;
+
+    s->cycles = now - s->t_start;
+    for (i = 0; i < s->count; i++)
+        spi_app_set_callback(s->dev[i], s->prev_cb[i], s->prev_ctx[i]);
+
+    s->done = 1;
+    if (s->cb)
+        s->cb(s, s->err ? HAL_ERROR : HAL_OK, s->ctx);
+}
+
+static void spi_stripe_cplt(SPI_APP_Device *dev, HAL_StatusTypeDef status, void *ctx)
+{
+    SPI_STRIPE_Set *s = (SPI_STRIPE_Set *)ctx;
+    uint8_t i;
+
+    for (i = 0; i < s->count; i++)
+        if (s->dev[i] == dev)
+            spi_stripe_finish(s, i, status != HAL_OK);
+}
+
+/* pass 0 starts the DMA/IT stripes, pass 1 the blocking ones, so those overlap the DMA */
+HAL_StatusTypeDef spi_stripe_transfer(SPI_STRIPE_Set *s, uint8_t *tx, uint8_t *rx, uint32_t len,
+                                      SPI_STRIPE_Cb cb, void *ctx)
+{
+    uint64_t total = 0;
+    uint32_t off = 0, part, fb;
+    uint8_t method[SPI_STRIPE_MAX];
+    uint8_t i, pass, used = 0;
+    HAL_StatusTypeDef ret = HAL_OK, r;
+
+    if (len == 0 || (tx == 0 && rx == 0))
+        return HAL_ERROR;
+
+    if (!s->done)
+        return HAL_BUSY;
+
+    for (i = 0; i < s->count; i++)
+    {
+        if (len % spi_app_frame_bytes(s->dev[i]) != 0u)
+            return HAL_ERROR;
+        if (!s->dev[i]->dma_done || !spi_app_queue_idle(s->dev[i]))
+            return HAL_BUSY;
+        total += s->rate[i];
+    }
+
+    /* Shares by rate, cut on cache lines (multiples of every frame size); the last device takes the rest */
+    for (i = 0; i < s->count; i++)
+    {
+        if (i == s->count - 1u)
+            part = len - off;
+        else
+            part = (uint32_t)(((uint64_t)len * s->rate[i]) / total) & ~(SPI_APP_CACHE_LINE - 1u);
+
+        s->off[i] = off;
+        s->len[i] = part;
+        off += part;
+        if (part)
+            used |= (uint8_t)(1u << i);
+    }
+
+    s->cb = cb;
+    s->ctx = ctx;
+    s->err = 0;
+    s->done = 0;
+    s->bytes = len;
+    s->pending = used;
+
+    for (i = 0; i < s->count; i++)
+    {
+        s->prev_cb[i] = s->dev[i]->done_cb;
+        s->prev_ctx[i] = s->dev[i]->done_ctx;
+        spi_app_set_callback(s->dev[i], spi_stripe_cplt, s);
+        method[i] = spi_app_xfer_method(s->dev[i], SPI_APP_XFER_DMA, tx, rx);
+    }
+
+    s->t_start = DWT->CYCCNT;
+
+    for (pass = 0; pass < 2u; pass++)
+    {
+        for (i = 0; i < s->count; i++)
+        {
+            if (!(used & (1u << i)) || ((method[i] == SPI_APP_XFER_POLL) != pass))
+                continue;
+
+            fb = spi_app_frame_bytes(s->dev[i]);
+            r = spi_app_xfer_run(s->dev[i], method[i], tx ? tx + s->off[i] : 0, rx ? rx + s->off[i] : 0,
+                                 s->len[i] / fb);
+            if (r == HAL_OK)
+                continue;
+
+            ret = HAL_ERROR;
+            /* A polled stripe that ran has already reported itself, one that was refused has not */
+            if (method[i] != SPI_APP_XFER_POLL || r == HAL_BUSY)
+                spi_stripe_finish(s, i, 1);
+        }
+    }
+
+    return ret;
+}
+
+/* Aggregate payload bytes/s of the last striped transfer (0 if none completed) */
+uint32_t spi_stripe_throughput(const SPI_STRIPE_Set *s)
+{
+    if (!s->done || s->cycles == 0u)
+        return 0;
+
+    return (uint32_t)(((uint64_t)s->bytes * SystemCoreClock) / s->cycles);
+}
@@ -0,0 +1,113 @@
+/**
+  ******************************************************************************
+  * @file           : spi_train.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_train.h"
+#include <string.h>
+
+/* Prescaler 2^(mbr+1) into the registers and the settings that persist (SPE off, bus held) */
+static void spi_train_apply(SPI_APP_Device *dev, uint32_t mbr)
+{
+    uint32_t presc = mbr << SPI_CFG1_MBR_Pos;
+
+    MODIFY_REG(dev->hspi->Instance->CFG1, SPI_CFG1_MBR, presc);
+    dev->hspi->Init.BaudRatePrescaler = presc;
+    if (dev->bus)
+        dev->cfg.BaudRatePrescaler = presc;
+}
+
+/* All rounds must read back expect */
+static uint8_t spi_train_check(SPI_APP_Device *dev, const uint8_t *tx, const uint8_t *expect,
+                               uint32_t len, uint32_t bytes, uint32_t rounds)
+{
+    uint8_t rx[SPI_TRAIN_MAX] __attribute__((aligned(4)));
+
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        memset(rx, 0, bytes);
+        if (spi_app_transfer(dev, (uint8_t *)tx, rx, len, 10) != HAL_OK || memcmp(rx, expect, bytes) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+HAL_StatusTypeDef spi_train_run(SPI_TRAIN_Link *link, SPI_APP_Device *dev, const uint8_t *tx, const uint8_t *expect,
+                                uint32_t len, uint32_t rounds, uint32_t max_hz)
+{
+    /* Static levels, alternating bits and walking ones/zeros (crosstalk, ISI) */
+    static const uint8_t pattern[32] __attribute__((aligned(4))) = {
+        0x00, 0xFF, 0x00, 0xFF, 0xAA, 0x55, 0xAA, 0x55, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+        0xFE, 0xFD, 0xFB, 0xF7, 0xEF, 0xDF, 0xBF, 0x7F, 0xCC, 0x33, 0xF0, 0x0F, 0x96, 0x69, 0x3C, 0xC3
+    };
+    uint32_t fb = spi_app_frame_bytes(dev);
+    uint32_t clk = spi_app_kernel_clock(dev);
+    uint32_t orig, best = 8u, mbr;
+    uint8_t failed = 0;
+    HAL_StatusTypeDef ret;
+
+    if (tx == 0)
+    {
+        tx = pattern;
+        len = sizeof(pattern) / fb;
+    }
+    if (expect == 0)
+        expect = tx;
+
+    if (len == 0 || len * fb > SPI_TRAIN_MAX || rounds == 0)
+        return HAL_ERROR;
+
+    if (!dev->dma_done || dev->hspi->State != HAL_SPI_STATE_READY)
+        return HAL_BUSY;
+
+    /* Held for the whole sweep, so the settings stay loaded (spi_app_transfer nests) */
+    ret = spi_app_bus_acquire(dev);
+    if (ret != HAL_OK)
+        return ret;
+
+    orig = (dev->bus ? dev->cfg.BaudRatePrescaler : dev->hspi->Init.BaudRatePrescaler) >> SPI_CFG1_MBR_Pos;
+    link->dev = dev;
+    link->pass = 0;
+
+    for (mbr = 8u; mbr-- > 0u; )
+    {
+        if (max_hz && (clk >> (mbr + 1u)) > max_hz)
+            break;
+
+        spi_train_apply(dev, mbr);
+        if (!spi_train_check(dev, tx, expect, len, len * fb, rounds))
+        {
+            failed = 1;
+            break;
+        }
+
+        link->pass |= (uint8_t)(1u << mbr);
+        best = mbr;
+    }
+
+    if (best == 8u)
+    {
+        link->hz = 0;
+        spi_train_apply(dev, orig);
+        spi_app_bus_release(dev);
+        return HAL_ERROR;
+    }
+
+    /* Margin from the edge that was actually seen */
+    if (failed)
+    {
+        best += SPI_TRAIN_MARGIN;
+        if (best > 7u)
+            best = 7u;
+    }
+
+    spi_train_apply(dev, best);
+    link->hz = clk >> (best + 1u);
+
+    spi_app_bus_release(dev);
+    return HAL_OK;
+}
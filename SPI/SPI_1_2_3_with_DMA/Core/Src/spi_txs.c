@@ -0,0 +1,189 @@
+/**
+  ******************************************************************************
+  * @file           : spi_txs.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+/* Includes */
+#include "spi_txs.h"
+
+#define SPI_TXS_IFCR_ALL    (SPI_IFCR_EOTC | SPI_IFCR_TXTFC | SPI_IFCR_UDRC | SPI_IFCR_OVRC | SPI_IFCR_CRCEC | \
+                             SPI_IFCR_TIFREC | SPI_IFCR_MODFC | SPI_IFCR_TSERFC | SPI_IFCR_SUSPC)
+
+/* The DMA callbacks only get the stream handle */
+static SPI_TXS_Stream *spi_txs_active = 0;
+
+/* Buffer n sent, the DMA has moved on to the other one: refill n */
+static void spi_txs_sent(SPI_TXS_Stream *txs, uint8_t n)
+{
+    SPI_APP_Device *dev = txs->dev;
+    DMA_Stream_TypeDef *stream = (DMA_Stream_TypeDef *)dev->hspi->hdmatx->Instance;
+    uint32_t bytes = txs->block * spi_app_frame_bytes(dev);
+
+    txs->blocks++;
+    spi_app_events_set(dev, SPI_APP_EVT_BLOCK);
+
+    /* Without refill callback the buffers are repeated on purpose */
+    if (txs->cb == 0)
+        return;
+
+    if (!(txs->ready & (1u << (n ^ 1u))))
+        txs->underruns++;
+
+    txs->ready &= (uint8_t)~(1u << n);
+    if (!txs->cb(txs, txs->buf[n], txs->block, txs->ctx))
+        return;
+
+    spi_app_cache_clean(txs->buf[n], bytes);
+    txs->ready |= (uint8_t)(1u << n);
+
+    /* CT back on n: the other buffer was sent during the refill, part of n went out stale */
+    if (((stream->CR & DMA_SxCR_CT) != 0u) == (n != 0u))
+        txs->underruns++;
+}
+
+static void spi_txs_m0(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+    spi_txs_sent(spi_txs_active, 0);
+}
+
+static void spi_txs_m1(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+    spi_txs_sent(spi_txs_active, 1);
+}
+
+static void spi_txs_error(DMA_HandleTypeDef *hdma)
+{
+    SPI_TXS_Stream *txs = spi_txs_active;
+    SPI_APP_Device *dev = txs->dev;
+
+    (void)hdma;
+    (void)spi_txs_stop(txs);
+
+    dev->dma_err = 1;
+    dev->dma_hal_error = HAL_SPI_ERROR_DMA;
+    spi_app_events_set(dev, SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR);
+}
+
+HAL_StatusTypeDef spi_txs_start(SPI_TXS_Stream *txs, SPI_APP_Device *dev, uint8_t *buf0, uint8_t *buf1,
+                                uint16_t block_len, SPI_TXS_RefillCb cb, void *ctx)
+{
+    SPI_HandleTypeDef *hspi = dev->hspi;
+    SPI_TypeDef *spi = hspi->Instance;
+    uint32_t bytes;
+    HAL_StatusTypeDef ret;
+
+    if (buf0 == 0 || buf1 == 0 || block_len == 0 || hspi->hdmatx == 0 ||
+        !IS_DMA_STREAM_INSTANCE(hspi->hdmatx->Instance) || spi_txs_active != 0)
+        return HAL_ERROR;
+
+    if (!dev->dma_done || dev->stream_on || !spi_app_queue_idle(dev) || hspi->State != HAL_SPI_STATE_READY)
+        return HAL_BUSY;
+
+    bytes = block_len * spi_app_frame_bytes(dev);
+    if (!spi_app_dma_reachable(buf0) || !spi_app_dma_reachable(buf1))
+        return HAL_ERROR;
+
+    /* The stream keeps the shared bus until spi_txs_stop() */
+    ret = spi_app_bus_acquire(dev);
+    if (ret != HAL_OK)
+        return ret;
+
+    spi_txs_active = txs;
+    txs->dev = dev;
+    txs->buf[0] = buf0;
+    txs->buf[1] = buf1;
+    txs->block = block_len;
+    txs->cb = cb;
+    txs->ctx = ctx;
+    txs->ready = 3u;
+    txs->blocks = 0;
+    txs->underruns = 0;
+    spi_app_events_clear(dev, SPI_APP_EVT_BLOCK | SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR);
+
+    spi_app_cache_clean(buf0, bytes);
+    spi_app_cache_clean(buf1, bytes);
+
+    /* One frame per DMA request, TC on each buffer switch only */
+    ret = spi_app_dma_pack(dev, 0);
+
+    hspi->hdmatx->XferCpltCallback = spi_txs_m0;
+    hspi->hdmatx->XferM1CpltCallback = spi_txs_m1;
+    hspi->hdmatx->XferHalfCpltCallback = 0;
+    hspi->hdmatx->XferM1HalfCpltCallback = 0;
+    hspi->hdmatx->XferErrorCallback = spi_txs_error;
+    hspi->hdmatx->XferAbortCallback = 0;
+
+    /* SPI (SPE off): endless simplex transmitter, no NSS pulse or idle cycles between frames */
+    MODIFY_REG(spi->CFG2, SPI_CFG2_COMM, SPI_CFG2_COMM_0);
+    CLEAR_BIT(spi->CFG2, SPI_CFG2_SSOM | SPI_CFG2_MIDI);
+    MODIFY_REG(spi->CR2, SPI_CR2_TSIZE, 0u);
+    SET_BIT(spi->IFCR, SPI_TXS_IFCR_ALL);
+
+    dev->dma_done = 0;
+    dev->dma_err = 0;
+    dev->dma_hal_error = 0;
+    txs->on = 1;
+    hspi->State = HAL_SPI_STATE_BUSY_TX;    // keeps the HAL and spi_app fast paths off the SPI
+
+    if (ret == HAL_OK)
+        ret = HAL_DMAEx_MultiBufferStart_IT(hspi->hdmatx, (uint32_t)buf0, (uint32_t)&spi->TXDR,
+                                            (uint32_t)buf1, block_len);
+    if (ret != HAL_OK)
+    {
+        (void)spi_txs_stop(txs);
+        dev->dma_err = 1;
+        return HAL_ERROR;
+    }
+
+    spi_app_cs_low(dev);
+    SET_BIT(spi->CFG1, SPI_CFG1_TXDMAEN);
+    SET_BIT(spi->CR1, SPI_CR1_SPE);
+    SET_BIT(spi->CR1, SPI_CR1_CSTART);
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef spi_txs_stop(SPI_TXS_Stream *txs)
+{
+    SPI_APP_Device *dev = txs->dev;
+    SPI_HandleTypeDef *hspi;
+    SPI_TypeDef *spi;
+    uint32_t spin = SPI_APP_FAST_SPIN;
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    if (!txs->on)
+        return HAL_OK;
+
+    hspi = dev->hspi;
+    spi = hspi->Instance;
+
+    /* Suspend at a frame boundary, so the slave never sees a cut frame */
+    if (spi->CR1 & SPI_CR1_SPE)
+    {
+        SET_BIT(spi->CR1, SPI_CR1_CSUSP);
+        while (spin && !(spi->SR & SPI_SR_SUSP))
+            spin--;
+    }
+
+    CLEAR_BIT(spi->CR1, SPI_CR1_SPE);
+    CLEAR_BIT(spi->CFG1, SPI_CFG1_TXDMAEN);
+    spi_app_cs_high(dev);
+    if (HAL_DMA_Abort(hspi->hdmatx) != HAL_OK) ret = HAL_ERROR;
+    SET_BIT(spi->IFCR, SPI_TXS_IFCR_ALL);
+
+    /* Back to the HAL settings */
+    MODIFY_REG(spi->CFG2, SPI_CFG2_SSOM | SPI_CFG2_MIDI,
+               ((hspi->Init.NSSPMode == SPI_NSS_PULSE_ENABLE) ? SPI_CFG2_SSOM : 0u) | hspi->Init.MasterInterDataIdleness);
+
+    hspi->State = HAL_SPI_STATE_READY;
+    txs->on = 0;
+    dev->dma_done = 1;
+    spi_txs_active = 0;
+    spi_app_bus_release(dev);
+
+    return ret;
+}
@@ -9,7 +9,17 @@ C_SRCS += \
 ../Core/Src/gpio.c \
 ../Core/Src/main.c \
 ../Core/Src/spi.c \
+../Core/Src/spi_acq.c \
 ../Core/Src/spi_app.c \
+../Core/Src/spi_bench.c \
+../Core/Src/spi_link.c \
+../Core/Src/spi_nor.c \
+../Core/Src/spi_pool.c \
+../Core/Src/spi_reg.c \
+../Core/Src/spi_slave.c \
+../Core/Src/spi_stripe.c \
+../Core/Src/spi_train.c \
+../Core/Src/spi_txs.c \
 ../Core/Src/stm32h7xx_hal_msp.c \
 ../Core/Src/stm32h7xx_it.c \
 ../Core/Src/syscalls.c \
@@ -21,7 +31,17 @@ OBJS += \
 ./Core/Src/gpio.o \
 ./Core/Src/main.o \
 ./Core/Src/spi.o \
+./Core/Src/spi_acq.o \
 ./Core/Src/spi_app.o \
+./Core/Src/spi_bench.o \
+./Core/Src/spi_link.o \
+./Core/Src/spi_nor.o \
+./Core/Src/spi_pool.o \
+./Core/Src/spi_reg.o \
+./Core/Src/spi_slave.o \
+./Core/Src/spi_stripe.o \
+./Core/Src/spi_train.o \
+./Core/Src/spi_txs.o \
 ./Core/Src/stm32h7xx_hal_msp.o \
 ./Core/Src/stm32h7xx_it.o \
 ./Core/Src/syscalls.o \
@@ -33,7 +53,17 @@ C_DEPS += \
 ./Core/Src/gpio.d \
 ./Core/Src/main.d \
 ./Core/Src/spi.d \
+./Core/Src/spi_acq.d \
 ./Core/Src/spi_app.d \
+./Core/Src/spi_bench.d \
+./Core/Src/spi_link.d \
+./Core/Src/spi_nor.d \
+./Core/Src/spi_pool.d \
+./Core/Src/spi_reg.d \
+./Core/Src/spi_slave.d \
+./Core/Src/spi_stripe.d \
+./Core/Src/spi_train.d \
+./Core/Src/spi_txs.d \
 ./Core/Src/stm32h7xx_hal_msp.d \
 ./Core/Src/stm32h7xx_it.d \
 ./Core/Src/syscalls.d \
@@ -48,7 +78,7 @@ Core/Src/%.o Core/Src/%.su Core/Src/%.cyclo: ../Core/Src/%.c Core/Src/subdir.mk
 clean: clean-Core-2f-Src
 
 clean-Core-2f-Src:
-	-$(RM) ./Core/Src/dma.cyclo ./Core/Src/dma.d ./Core/Src/dma.o ./Core/Src/dma.su ./Core/Src/gpio.cyclo ./Core/Src/gpio.d ./Core/Src/gpio.o ./Core/Src/gpio.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/spi.cyclo ./Core/Src/spi.d ./Core/Src/spi.o ./Core/Src/spi.su ./Core/Src/spi_app.cyclo ./Core/Src/spi_app.d ./Core/Src/spi_app.o ./Core/Src/spi_app.su ./Core/Src/stm32h7xx_hal_msp.cyclo ./Core/Src/stm32h7xx_hal_msp.d ./Core/Src/stm32h7xx_hal_msp.o ./Core/Src/stm32h7xx_hal_msp.su ./Core/Src/stm32h7xx_it.cyclo ./Core/Src/stm32h7xx_it.d ./Core/Src/stm32h7xx_it.o ./Core/Src/stm32h7xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32h7xx.cyclo ./Core/Src/system_stm32h7xx.d ./Core/Src/system_stm32h7xx.o ./Core/Src/system_stm32h7xx.su
+	-$(RM) ./Core/Src/dma.cyclo ./Core/Src/dma.d ./Core/Src/dma.o ./Core/Src/dma.su ./Core/Src/gpio.cyclo ./Core/Src/gpio.d ./Core/Src/gpio.o ./Core/Src/gpio.su ./Core/Src/main.cyclo ./Core/Src/main.d ./Core/Src/main.o ./Core/Src/main.su ./Core/Src/spi.cyclo ./Core/Src/spi.d ./Core/Src/spi.o ./Core/Src/spi.su ./Core/Src/spi_acq.cyclo ./Core/Src/spi_acq.d ./Core/Src/spi_acq.o ./Core/Src/spi_acq.su ./Core/Src/spi_app.cyclo ./Core/Src/spi_app.d ./Core/Src/spi_app.o ./Core/Src/spi_app.su ./Core/Src/spi_bench.cyclo ./Core/Src/spi_bench.d ./Core/Src/spi_bench.o ./Core/Src/spi_bench.su ./Core/Src/spi_link.cyclo ./Core/Src/spi_link.d ./Core/Src/spi_link.o ./Core/Src/spi_link.su ./Core/Src/spi_nor.cyclo ./Core/Src/spi_nor.d ./Core/Src/spi_nor.o ./Core/Src/spi_nor.su ./Core/Src/spi_pool.cyclo ./Core/Src/spi_pool.d ./Core/Src/spi_pool.o ./Core/Src/spi_pool.su ./Core/Src/spi_reg.cyclo ./Core/Src/spi_reg.d ./Core/Src/spi_reg.o ./Core/Src/spi_reg.su ./Core/Src/spi_slave.cyclo ./Core/Src/spi_slave.d ./Core/Src/spi_slave.o ./Core/Src/spi_slave.su ./Core/Src/spi_stripe.cyclo ./Core/Src/spi_stripe.d ./Core/Src/spi_stripe.o ./Core/Src/spi_stripe.su ./Core/Src/spi_train.cyclo ./Core/Src/spi_train.d ./Core/Src/spi_train.o ./Core/Src/spi_train.su ./Core/Src/spi_txs.cyclo ./Core/Src/spi_txs.d ./Core/Src/spi_txs.o ./Core/Src/spi_txs.su ./Core/Src/stm32h7xx_hal_msp.cyclo ./Core/Src/stm32h7xx_hal_msp.d ./Core/Src/stm32h7xx_hal_msp.o ./Core/Src/stm32h7xx_hal_msp.su ./Core/Src/stm32h7xx_it.cyclo ./Core/Src/stm32h7xx_it.d ./Core/Src/stm32h7xx_it.o ./Core/Src/stm32h7xx_it.su ./Core/Src/syscalls.cyclo ./Core/Src/syscalls.d ./Core/Src/syscalls.o ./Core/Src/syscalls.su ./Core/Src/sysmem.cyclo ./Core/Src/sysmem.d ./Core/Src/sysmem.o ./Core/Src/sysmem.su ./Core/Src/system_stm32h7xx.cyclo ./Core/Src/system_stm32h7xx.d ./Core/Src/system_stm32h7xx.o ./Core/Src/system_stm32h7xx.su
 
 .PHONY: clean-Core-2f-Src
 
@@ -0,0 +1,203 @@
+/**
+  ******************************************************************************
+  * @file           : bench.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * Host bench of spi_app.c: every device of main.c, blocking / IT / DMA, write /
+  * read / transfer, on the simulator. Per row: latency from the call to the
+  * completion, payload throughput, CS overhead (CS low to the first SCK edge
+  * plus last SCK edge to CS high, from the pin model) and the CPU time the
+  * firmware spent (thread and handlers; the wait for an IT or DMA completion
+  * sleeps, as an application doing other work would). A device on each bus
+  * returns a counter and checks MOSI, so every row is also a data check.
+*/
+
+#include "board.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_MAX           1024u      // frames
+#define BENCH_TIMEOUT       1000u      // ms
+
+enum { BENCH_WRITE, BENCH_READ, BENCH_TRANSFER };
+enum { BENCH_POLL, BENCH_IT, BENCH_DMA };
+
+static const char *const bench_op_name[] = { "write", "read", "transfer" };
+static const char *const bench_path_name[] = { "blocking", "IT", "DMA" };
+static const uint32_t bench_lens[] = { 4u, 64u, BENCH_MAX };
+
+/* Device on the bus: MISO is the frame index since CS went low, MOSI is checked against tx */
+typedef struct {
+    SIM_SpiPeer peer;
+    SPI_TypeDef *spi;
+    const uint8_t *expect;             // MOSI frames, 0: not checked
+    uint32_t frame_bytes;
+    uint32_t index;
+    uint32_t mosi_errors;
+    uint64_t cs_fall, cs_rise;
+    uint64_t first_sck, last_sck;
+} BENCH_Slave;
+
+static uint8_t bench_tx[BENCH_MAX * 2u] SPI_APP_DMA_BUFFER;
+static uint8_t bench_rx[BENCH_MAX * 2u] SPI_APP_DMA_BUFFER;
+
+static uint32_t bench_slave_xfer(void *ctx, uint32_t mosi, uint32_t bits)
+{
+    BENCH_Slave *s = ctx;
+    uint32_t mask = (bits >= 32u) ? 0xFFFFFFFFu : (1u << bits) - 1u;
+
+    if (s->index == 0)
+        s->first_sck = sim_now() - (uint64_t)bits * sim_spi_sck(s->spi);
+    s->last_sck = sim_now();
+
+    if (s->expect)
+    {
+        uint32_t want = s->expect[s->index * s->frame_bytes];
+
+        if (s->frame_bytes > 1u)
+            want |= (uint32_t)s->expect[s->index * s->frame_bytes + 1u] << 8;
+        if ((mosi & mask) != (want & mask))
+            s->mosi_errors++;
+    }
+
+    return s->index++ & mask;
+}
+
+static void bench_slave_cs(void *ctx, int selected)
+{
+    BENCH_Slave *s = ctx;
+
+    if (selected)
+    {
+        s->cs_fall = sim_now();
+        s->index = 0;
+    }
+    else
+        s->cs_rise = sim_now();
+}
+
+static int bench_done(void *ctx)
+{
+    return ((SPI_APP_Device *)ctx)->dma_done != 0;
+}
+
+static HAL_StatusTypeDef bench_start(SPI_APP_Device *dev, uint8_t path, uint8_t op, uint32_t len)
+{
+    uint8_t *tx = (op == BENCH_READ) ? 0 : bench_tx;
+    uint8_t *rx = (op == BENCH_WRITE) ? 0 : bench_rx;
+
+    if (path == BENCH_POLL)
+    {
+        if (op == BENCH_WRITE) return spi_app_write(dev, tx, len, BENCH_TIMEOUT);
+        if (op == BENCH_READ) return spi_app_read(dev, rx, len, BENCH_TIMEOUT);
+        return spi_app_transfer(dev, tx, rx, len, BENCH_TIMEOUT);
+    }
+
+    if (path == BENCH_IT)
+    {
+        /* spi_app_xfer() picks IT for any length */
+        dev->xfer_poll_max = 0;
+        dev->xfer_it_max = 0xFFFFFFFFu;
+        return spi_app_xfer(dev, tx, rx, len);
+    }
+
+    if (op == BENCH_WRITE) return spi_app_write_dma(dev, tx, len);
+    if (op == BENCH_READ) return spi_app_read_dma(dev, rx, len);
+    return spi_app_transfer_dma(dev, tx, rx, len);
+}
+
+/* One row; 0 if the transfer failed or the data is wrong */
+static int bench_row(const char *name, SPI_APP_Device *dev, BENCH_Slave *slv, uint8_t path, uint8_t op,
+                     uint32_t len)
+{
+    SIM_SpiStats *st = sim_spi_stats(dev->hspi->Instance);
+    uint32_t fb = slv->frame_bytes;
+    uint64_t t0, busy0, isr0, wire0, irqs0, lat, busy, cs;
+    HAL_StatusTypeDef ret;
+    int ok = 1;
+
+    for (uint32_t i = 0; i < len * fb; i++)
+    {
+        bench_tx[i] = (uint8_t)(i * 7u + 3u);
+        bench_rx[i] = 0xEEu;
+    }
+    slv->expect = (op == BENCH_READ) ? 0 : bench_tx;
+    slv->mosi_errors = 0;
+    slv->cs_fall = slv->cs_rise = slv->first_sck = slv->last_sck = 0;
+
+    t0 = sim_now();
+    busy0 = sim_clock.busy;
+    isr0 = sim_clock.isr;
+    wire0 = st->wire;
+    irqs0 = sim_clock.irqs;
+
+    ret = bench_start(dev, path, op, len);
+    if (ret == HAL_OK && path != BENCH_POLL && !sim_idle(bench_done, dev, (uint64_t)BENCH_TIMEOUT * (SIM_CPU_HZ / 1000u)))
+        ret = HAL_TIMEOUT;
+    if (ret == HAL_OK && dev->dma_err)
+        ret = HAL_ERROR;
+
+    lat = sim_now() - t0;
+    busy = sim_clock.busy - busy0;
+    cs = (slv->first_sck - slv->cs_fall) + (slv->cs_rise - slv->last_sck);
+
+    if (ret != HAL_OK || slv->mosi_errors || slv->cs_rise < slv->last_sck)
+        ok = 0;
+    for (uint32_t i = 0; ok && op != BENCH_WRITE && i < len; i++)
+    {
+        uint32_t v = bench_rx[i * fb] | (fb > 1u ? (uint32_t)bench_rx[i * fb + 1u] << 8 : 0u);
+
+        if (v != (i & (fb > 1u ? 0xFFFFu : 0xFFu)))
+            ok = 0;
+    }
+
+    printf("%-5s %-9s %-9s %5lu %9.1f %9.1f %9.1f %8.2f %9.1f %5.1f %6.1f %5llu  %s\n",
+           name, bench_path_name[path], bench_op_name[op], (unsigned long)len, sim_us(lat),
+           sim_us(st->wire - wire0), sim_rate(len * fb, lat) / 1000.0, sim_us(cs), sim_us(busy),
+           lat ? 100.0 * (double)busy / (double)lat : 0.0, sim_us(sim_clock.isr - isr0),
+           (unsigned long long)(sim_clock.irqs - irqs0), ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main(void)
+{
+    static BENCH_Slave slaves[3];
+    struct { const char *name; SPI_APP_Device *dev; } devs[3] = {
+        { "SPI1", &spi1_dev }, { "SPI2", &spi2_dev }, { "SPI3", &spi3_dev },
+    };
+    int failures = 0;
+
+    board_init();
+
+    /* SPI1 and SPI2 have neither DMA nor IRQ in the .ioc: add them so all three paths run */
+    board_spi_dma(&hspi1);
+    board_spi_dma(&hspi2);
+
+    for (uint32_t d = 0; d < 3u; d++)
+    {
+        BENCH_Slave *s = &slaves[d];
+
+        s->spi = devs[d].dev->hspi->Instance;
+        s->frame_bytes = (devs[d].dev->hspi->Init.DataSize > SPI_DATASIZE_8BIT) ? 2u : 1u;
+        s->peer.cs_port = devs[d].dev->CS_Port;
+        s->peer.cs_pin = devs[d].dev->CS_Pin;
+        s->peer.xfer = bench_slave_xfer;
+        s->peer.cs = bench_slave_cs;
+        s->peer.ctx = s;
+        sim_spi_attach(s->spi, &s->peer);
+    }
+
+    printf("CPU %lu MHz, SPI kernel clock %lu MHz; times in us, throughput in kB/s (payload)\n",
+           (unsigned long)(SIM_CPU_HZ / 1000000u), (unsigned long)(SIM_SPI_KER_HZ / 1000000u));
+    printf("%-5s %-9s %-9s %5s %9s %9s %9s %8s %9s %5s %6s %5s\n", "dev", "path", "op", "len", "latency",
+           "wire", "kB/s", "CS ovh", "CPU busy", "%", "ISR", "IRQs");
+
+    for (uint32_t d = 0; d < 3u; d++)
+        for (uint8_t path = BENCH_POLL; path <= BENCH_DMA; path++)
+            for (uint8_t op = BENCH_WRITE; op <= BENCH_TRANSFER; op++)
+                for (uint32_t i = 0; i < sizeof(bench_lens) / sizeof(bench_lens[0]); i++)
+                    failures += !bench_row(devs[d].name, devs[d].dev, &slaves[d], path, op, bench_lens[i]);
+
+    printf("%d failure(s), %llu register accesses trapped\n", failures, (unsigned long long)sim_clock.accesses);
+    return failures != 0;
+}
@@ -0,0 +1,195 @@
+/**
+  ******************************************************************************
+  * @file           : board.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+*/
+
+#include "board.h"
+#include "dma.h"
+#include "gpio.h"
+#include "stm32h7xx_it.h"
+
+SPI_APP_Device spi1_dev;
+SPI_APP_Device spi2_dev;
+SPI_APP_Device spi3_dev;
+
+/* Bench only: SPI1 on DMA2 streams 0/1, SPI2 on DMA2 streams 2/3 */
+static DMA_HandleTypeDef hdma_spi1_rx, hdma_spi1_tx, hdma_spi2_rx, hdma_spi2_tx;
+
+static const BOARD_SpiHooks *board_hooks[3];
+static void (*board_exti)(uint16_t pin);
+
+static uint32_t board_index(SPI_HandleTypeDef *hspi)
+{
+    return (hspi == &hspi1) ? 0u : (hspi == &hspi2) ? 1u : 2u;
+}
+
+SPI_APP_Device *board_dev(SPI_HandleTypeDef *hspi)
+{
+    if (hspi == &hspi1) return &spi1_dev;
+    if (hspi == &hspi2) return &spi2_dev;
+    if (hspi == &hspi3) return &spi3_dev;
+    return 0;
+}
+
+void board_spi_hooks(SPI_HandleTypeDef *hspi, const BOARD_SpiHooks *hooks)
+{
+    board_hooks[board_index(hspi)] = hooks;
+}
+
+void board_exti_hook(void (*fn)(uint16_t pin))
+{
+    board_exti = fn;
+}
+
+/* main.c USER CODE 4 */
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    const BOARD_SpiHooks *h = board_hooks[board_index(hspi)];
+    SPI_APP_Device *dev = board_dev(hspi);
+
+    if (h) { if (h->cplt) h->cplt(hspi); }
+    else if (dev) spi_app_dma_cplt(dev);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    HAL_SPI_TxCpltCallback(hspi);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    HAL_SPI_TxCpltCallback(hspi);
+}
+
+void HAL_SPI_RxHalfCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    const BOARD_SpiHooks *h = board_hooks[board_index(hspi)];
+    SPI_APP_Device *dev = board_dev(hspi);
+
+    if (h) { if (h->half) h->half(hspi); }
+    else if (dev) spi_app_dma_half_cplt(dev);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+    const BOARD_SpiHooks *h = board_hooks[board_index(hspi)];
+    SPI_APP_Device *dev = board_dev(hspi);
+
+    if (h) { if (h->error) h->error(hspi); }
+    else if (dev) spi_app_dma_error(dev);
+}
+
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+    if (board_exti)
+        board_exti(GPIO_Pin);
+}
+
+/* Vectors */
+static void board_exti_irq(uint16_t pins)
+{
+    for (uint16_t pin = 1u; pin; pin <<= 1)
+        if ((pins & pin) && __HAL_GPIO_EXTI_GET_IT(pin))
+            HAL_GPIO_EXTI_IRQHandler(pin);
+}
+
+static void board_exti0(void) { board_exti_irq(0x0001u); }
+static void board_exti1(void) { board_exti_irq(0x0002u); }
+static void board_exti2(void) { board_exti_irq(0x0004u); }
+static void board_exti3(void) { board_exti_irq(0x0008u); }
+static void board_exti4(void) { board_exti_irq(0x0010u); }
+static void board_exti9_5(void) { board_exti_irq(0x03E0u); }
+static void board_exti15_10(void) { board_exti_irq(0xFC00u); }
+
+static void board_dma2_s0(void) { HAL_DMA_IRQHandler(&hdma_spi1_rx); }
+static void board_dma2_s1(void) { HAL_DMA_IRQHandler(&hdma_spi1_tx); }
+static void board_dma2_s2(void) { HAL_DMA_IRQHandler(&hdma_spi2_rx); }
+static void board_dma2_s3(void) { HAL_DMA_IRQHandler(&hdma_spi2_tx); }
+static void board_spi1(void) { HAL_SPI_IRQHandler(&hspi1); }
+static void board_spi2(void) { HAL_SPI_IRQHandler(&hspi2); }
+
+static void board_dma_init(DMA_HandleTypeDef *hdma, DMA_Stream_TypeDef *stream, uint32_t request,
+                           uint32_t direction, IRQn_Type irqn)
+{
+    hdma->Instance = stream;
+    hdma->Init.Request = request;
+    hdma->Init.Direction = direction;
+    hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma->Init.MemInc = DMA_MINC_ENABLE;
+    hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma->Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma->Init.Mode = DMA_NORMAL;
+    hdma->Init.Priority = DMA_PRIORITY_HIGH;
+    hdma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(hdma) != HAL_OK)
+        Error_Handler();
+
+    HAL_NVIC_SetPriority(irqn, 0, 0);
+    HAL_NVIC_EnableIRQ(irqn);
+}
+
+void board_spi_dma(SPI_HandleTypeDef *hspi)
+{
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    if (hspi == &hspi1)
+    {
+        board_dma_init(&hdma_spi1_rx, DMA2_Stream0, DMA_REQUEST_SPI1_RX, DMA_PERIPH_TO_MEMORY, DMA2_Stream0_IRQn);
+        board_dma_init(&hdma_spi1_tx, DMA2_Stream1, DMA_REQUEST_SPI1_TX, DMA_MEMORY_TO_PERIPH, DMA2_Stream1_IRQn);
+        __HAL_LINKDMA(hspi, hdmarx, hdma_spi1_rx);
+        __HAL_LINKDMA(hspi, hdmatx, hdma_spi1_tx);
+        HAL_NVIC_SetPriority(SPI1_IRQn, 1, 0);
+        HAL_NVIC_EnableIRQ(SPI1_IRQn);
+    }
+    else if (hspi == &hspi2)
+    {
+        board_dma_init(&hdma_spi2_rx, DMA2_Stream2, DMA_REQUEST_SPI2_RX, DMA_PERIPH_TO_MEMORY, DMA2_Stream2_IRQn);
+        board_dma_init(&hdma_spi2_tx, DMA2_Stream3, DMA_REQUEST_SPI2_TX, DMA_MEMORY_TO_PERIPH, DMA2_Stream3_IRQn);
+        __HAL_LINKDMA(hspi, hdmarx, hdma_spi2_rx);
+        __HAL_LINKDMA(hspi, hdmatx, hdma_spi2_tx);
+        HAL_NVIC_SetPriority(SPI2_IRQn, 1, 0);
+        HAL_NVIC_EnableIRQ(SPI2_IRQn);
+    }
+}
+
+void board_init(void)
+{
+    sim_init();
+
+    sim_vector(DMA1_Stream0_IRQn, DMA1_Stream0_IRQHandler);
+    sim_vector(DMA1_Stream1_IRQn, DMA1_Stream1_IRQHandler);
+    sim_vector(SPI3_IRQn, SPI3_IRQHandler);
+    sim_vector(DMA2_Stream0_IRQn, board_dma2_s0);
+    sim_vector(DMA2_Stream1_IRQn, board_dma2_s1);
+    sim_vector(DMA2_Stream2_IRQn, board_dma2_s2);
+    sim_vector(DMA2_Stream3_IRQn, board_dma2_s3);
+    sim_vector(SPI1_IRQn, board_spi1);
+    sim_vector(SPI2_IRQn, board_spi2);
+    sim_vector(EXTI0_IRQn, board_exti0);
+    sim_vector(EXTI1_IRQn, board_exti1);
+    sim_vector(EXTI2_IRQn, board_exti2);
+    sim_vector(EXTI3_IRQn, board_exti3);
+    sim_vector(EXTI4_IRQn, board_exti4);
+    sim_vector(EXTI9_5_IRQn, board_exti9_5);
+    sim_vector(EXTI15_10_IRQn, board_exti15_10);
+
+    board_hooks[0] = board_hooks[1] = board_hooks[2] = 0;
+    board_exti = 0;
+
+    /* HAL_Init() without the SysTick (the tick is the virtual clock) */
+    HAL_NVIC_SetPriorityGrouping(NVIC_PRIORITYGROUP_4);
+    HAL_MspInit();
+    SCB_EnableDCache();
+
+    MX_GPIO_Init();
+    MX_DMA_Init();
+    MX_SPI1_Init();
+    MX_SPI2_Init();
+    MX_SPI3_Init();
+
+    spi_app_initStruct(&spi1_dev, &hspi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin, 1);
+    spi_app_initStruct(&spi2_dev, &hspi2, SPI2_CS_GPIO_Port, SPI2_CS_Pin, 1);
+    spi_app_initStruct(&spi3_dev, &hspi3, SPI3_CS_GPIO_Port, SPI3_CS_Pin, 1);
+}
@@ -0,0 +1,55 @@
+/**
+  ******************************************************************************
+  * @file           : board.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * Host stand-in for main.c: the CubeMX init sequence and the spi_app devices
+  * of the firmware, on the simulator. The vectors of stm32h7xx_it.c are
+  * installed as they are; SPI1 and SPI2 (no DMA, no IRQ in the .ioc) can get
+  * DMA2 streams and their IRQ for the runs that compare the three paths.
+*/
+
+#ifndef HOST_BOARD_H_
+#define HOST_BOARD_H_
+
+#include "sim.h"
+#include "main.h"
+#include "spi.h"
+#include "spi_app.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern SPI_APP_Device spi1_dev;
+extern SPI_APP_Device spi2_dev;
+extern SPI_APP_Device spi3_dev;
+
+/* sim_init(), then main() up to USER CODE 2 without the calibration (its idle loop runs in
+   RAM and does not advance the virtual clock): spi_app_xfer() keeps its default crossovers */
+void board_init(void);
+
+/* SPI1 / SPI2: DMA2 streams (RX, TX) and the SPI IRQ, as CubeMX would set them up */
+void board_spi_dma(SPI_HandleTypeDef *hspi);
+
+/* Overrides of the HAL SPI callbacks for one handle (slave or link tests); 0 restores the
+   spi_app device routing of main.c */
+typedef struct {
+    void (*half)(SPI_HandleTypeDef *hspi);
+    void (*cplt)(SPI_HandleTypeDef *hspi);
+    void (*error)(SPI_HandleTypeDef *hspi);
+} BOARD_SpiHooks;
+
+void board_spi_hooks(SPI_HandleTypeDef *hspi, const BOARD_SpiHooks *hooks);
+
+/* HAL_GPIO_EXTI_Callback(): EXTI lines 0..15 are routed to the simulator vectors */
+void board_exti_hook(void (*fn)(uint16_t pin));
+
+/* Device of a HAL handle (main.c spi_dev_of()) */
+SPI_APP_Device *board_dev(SPI_HandleTypeDef *hspi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_BOARD_H_ */
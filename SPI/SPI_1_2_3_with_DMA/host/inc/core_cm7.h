@@ -0,0 +1,98 @@
+/**
+  ******************************************************************************
+  * @file           : core_cm7.h (host)
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * Host build only: found before the CMSIS header through the include path.
+  * Provides the cmsis_gcc.h macros and intrinsics for x86-64 (PRIMASK, WFI and
+  * the exclusive monitor are routed to the simulator), then pulls in the real
+  * core_cm7.h for the register layouts and the NVIC/SCB inline functions.
+*/
+
+#ifndef HOST_CORE_CM7_SHIM_H_
+#define HOST_CORE_CM7_SHIM_H_
+
+#include <stdint.h>
+
+/* Keep cmsis_compiler.h / cmsis_gcc.h out: they hold ARM inline assembly */
+#define __CMSIS_COMPILER_H
+#define __CMSIS_GCC_H
+
+#define __ASM                       __asm
+#define __INLINE                    inline
+#define __STATIC_INLINE             static inline
+#define __STATIC_FORCEINLINE        __attribute__((always_inline)) static inline
+#define __NO_RETURN                 __attribute__((__noreturn__))
+#define __USED                      __attribute__((used))
+#define __WEAK                      __attribute__((weak))
+#define __PACKED                    __attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT             struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION              union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)                __attribute__((aligned(x)))
+#define __RESTRICT                  __restrict
+#define __COMPILER_BARRIER()        __asm volatile("" ::: "memory")
+
+struct __attribute__((packed)) T_UINT16_WRITE { uint16_t v; };
+struct __attribute__((packed)) T_UINT16_READ { uint16_t v; };
+struct __attribute__((packed)) T_UINT32_WRITE { uint32_t v; };
+struct __attribute__((packed)) T_UINT32_READ { uint32_t v; };
+#define __UNALIGNED_UINT32(x)                  (((struct T_UINT32_READ *)(x))->v)
+#define __UNALIGNED_UINT16_WRITE(addr, val)    (void)((((struct T_UINT16_WRITE *)(void *)(addr))->v) = (val))
+#define __UNALIGNED_UINT16_READ(addr)          (((const struct T_UINT16_READ *)(const void *)(addr))->v)
+#define __UNALIGNED_UINT32_WRITE(addr, val)    (void)((((struct T_UINT32_WRITE *)(void *)(addr))->v) = (val))
+#define __UNALIGNED_UINT32_READ(addr)          (((const struct T_UINT32_READ *)(const void *)(addr))->v)
+
+/* Simulator hooks (host/sim.c) */
+uint32_t sim_primask_get(void);
+void sim_primask_set(uint32_t primask);
+void sim_wfi(void);
+uint32_t sim_ldrex(volatile void *addr, uint32_t size);
+uint32_t sim_strex(uint32_t value, volatile void *addr, uint32_t size);
+void sim_clrex(void);
+
+__STATIC_FORCEINLINE uint32_t __get_PRIMASK(void) { return sim_primask_get(); }
+__STATIC_FORCEINLINE void __set_PRIMASK(uint32_t priMask) { sim_primask_set(priMask); }
+__STATIC_FORCEINLINE void __disable_irq(void) { sim_primask_set(1u); }
+__STATIC_FORCEINLINE void __enable_irq(void) { sim_primask_set(0u); }
+
+#define __NOP()                     __asm volatile("nop")
+#define __WFI()                     sim_wfi()
+#define __WFE()                     sim_wfi()
+#define __SEV()                     ((void)0)
+#define __BKPT(value)               __builtin_trap()
+
+__STATIC_FORCEINLINE void __ISB(void) { __COMPILER_BARRIER(); }
+__STATIC_FORCEINLINE void __DSB(void) { __sync_synchronize(); }
+__STATIC_FORCEINLINE void __DMB(void) { __sync_synchronize(); }
+
+__STATIC_FORCEINLINE uint8_t __LDREXB(volatile uint8_t *addr) { return (uint8_t)sim_ldrex(addr, 1u); }
+__STATIC_FORCEINLINE uint16_t __LDREXH(volatile uint16_t *addr) { return (uint16_t)sim_ldrex(addr, 2u); }
+__STATIC_FORCEINLINE uint32_t __LDREXW(volatile uint32_t *addr) { return sim_ldrex(addr, 4u); }
+__STATIC_FORCEINLINE uint32_t __STREXB(uint8_t value, volatile uint8_t *addr) { return sim_strex(value, addr, 1u); }
+__STATIC_FORCEINLINE uint32_t __STREXH(uint16_t value, volatile uint16_t *addr) { return sim_strex(value, addr, 2u); }
+__STATIC_FORCEINLINE uint32_t __STREXW(uint32_t value, volatile uint32_t *addr) { return sim_strex(value, addr, 4u); }
+__STATIC_FORCEINLINE void __CLREX(void) { sim_clrex(); }
+
+__STATIC_FORCEINLINE uint32_t __REV(uint32_t value) { return __builtin_bswap32(value); }
+__STATIC_FORCEINLINE uint32_t __REV16(uint32_t value)
+{
+    return ((value & 0xFF00FF00u) >> 8) | ((value & 0x00FF00FFu) << 8);
+}
+__STATIC_FORCEINLINE int16_t __REVSH(int16_t value) { return (int16_t)__builtin_bswap16((uint16_t)value); }
+__STATIC_FORCEINLINE uint32_t __ROR(uint32_t op1, uint32_t op2)
+{
+    op2 %= 32u;
+    return op2 ? (op1 >> op2) | (op1 << (32u - op2)) : op1;
+}
+__STATIC_FORCEINLINE uint32_t __RBIT(uint32_t value)
+{
+    uint32_t r = 0;
+    for (uint32_t i = 0; i < 32u; i++)
+        r |= ((value >> i) & 1u) << (31u - i);
+    return r;
+}
+__STATIC_FORCEINLINE uint8_t __CLZ(uint32_t value) { return value ? (uint8_t)__builtin_clz(value) : 32u; }
+
+#include_next "core_cm7.h"
+
+#endif /* HOST_CORE_CM7_SHIM_H_ */
@@ -0,0 +1,791 @@
+/**
+  ******************************************************************************
+  * @file           : sim.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * Register traps, virtual clock, events and the NVIC.
+  *
+  * A trapped page is a memfd page mapped twice: at its target address without
+  * access rights, and at an alias the models use. A faulting access is decoded
+  * (width, read or write), a read gets its value from the model into the alias,
+  * then the page is opened and the instruction single-stepped (TF); the trap
+  * that follows closes the page again, hands a write to the model and is the
+  * point where pending interrupts are taken, their handlers running nested in
+  * the signal handler like exceptions on the target.
+*/
+
+#define _GNU_SOURCE
+#include "sim.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define SIM_PAGE            0x1000u
+#define SIM_PAGES_MAX       16u
+#define SIM_REGIONS_MAX     48u
+#define SIM_EVENTS_MAX      64u
+#define SIM_IRQ_MAX         160u
+#define SIM_SETTLE_MAX      100000u
+
+SIM_Clock sim_clock;
+
+/* Memory map: target regions backed by plain host memory */
+static const struct { uint32_t base, len; } sim_ram[] = {
+    { 0x20000000u, 0x00020000u },      // DTCM
+    { 0x40000000u, 0x00030000u },      // APB1, APB2, AHB1
+    { 0x52000000u, 0x00010000u },      // AHB3 (MDMA)
+    { 0x58000000u, 0x00030000u },      // APB4, AHB4
+    { 0x5C000000u, 0x00002000u },      // DBGMCU
+    { 0xE0000000u, 0x00100000u },      // Cortex-M7 private peripherals
+};
+
+typedef struct {
+    uint32_t addr;
+    uint8_t *alias;
+} SIM_Page;
+
+typedef struct {
+    uint32_t base, len;
+    SIM_ReadFn rd;
+    SIM_WriteFn wr;
+    void *ctx;
+} SIM_Region;
+
+typedef struct {
+    uint64_t when, seq;
+    SIM_EventFn fn;
+    void *ctx;
+} SIM_Event;
+
+static int sim_fd = -1;
+static SIM_Page sim_pages[SIM_PAGES_MAX];
+static uint32_t sim_page_count;
+static SIM_Region sim_regions[SIM_REGIONS_MAX];
+static uint32_t sim_region_count;
+static SIM_Event sim_events[SIM_EVENTS_MAX];
+static uint32_t sim_event_count;
+static uint64_t sim_event_seq;
+static SIM_SettleFn sim_settle_fns[8];
+static uint32_t sim_settle_count;
+
+/* Single-stepped access in progress */
+static struct {
+    int armed;
+    SIM_Page *page;
+    uint32_t addr, size, old;
+    int write;
+} sim_step;
+
+/* Polling loop detection */
+static struct {
+    uint32_t addr[4], val[4];
+    uint32_t streak;
+    uint32_t ticks;                    // HAL_GetTick() calls since the last trapped access
+} sim_poll;
+
+/* Core: PRIMASK, exclusive monitor, NVIC, DWT */
+static uint32_t sim_primask;
+static struct { volatile void *addr; int valid; } sim_monitor;
+static void (*sim_vectors[SIM_IRQ_MAX])(void);
+static struct { SIM_LineFn line; void *ctx; } sim_lines[SIM_IRQ_MAX];
+static uint32_t sim_nvic_en[(SIM_IRQ_MAX + 31u) / 32u];
+static uint32_t sim_nvic_pend[(SIM_IRQ_MAX + 31u) / 32u];
+static uint8_t sim_active[SIM_IRQ_MAX];
+static uint32_t sim_prio = 0x100u;     // running priority (thread: lowest)
+static uint32_t sim_depth;             // exception nesting
+static uint64_t sim_dwt_base;
+static uint32_t sim_dwt_frozen;
+static uint64_t sim_progress;          // last time the firmware or a model did something
+
+/* Fatal errors: no stdio, this may run in a signal handler */
+static void sim_fatal(const char *msg, uint64_t a, uint64_t b)
+{
+    char buf[160];
+    int n = snprintf(buf, sizeof(buf), "sim: %s (0x%llx, 0x%llx) at %.1f us\n", msg,
+                     (unsigned long long)a, (unsigned long long)b, sim_us(sim_clock.now));
+    (void)write(2, buf, (size_t)n);
+    _exit(3);
+}
+
+/* Pages and regions */
+
+static SIM_Page *sim_page_of(uintptr_t addr)
+{
+    for (uint32_t i = 0; i < sim_page_count; i++)
+        if (addr - sim_pages[i].addr < SIM_PAGE)
+            return &sim_pages[i];
+    return 0;
+}
+
+static SIM_Region *sim_region_of(uint32_t addr)
+{
+    for (uint32_t i = 0; i < sim_region_count; i++)
+        if (addr - sim_regions[i].base < sim_regions[i].len)
+            return &sim_regions[i];
+    return 0;
+}
+
+static SIM_Page *sim_page_map(uint32_t addr)
+{
+    SIM_Page *pg = sim_page_of(addr);
+    off_t off;
+
+    if (pg)
+        return pg;
+    if (sim_page_count == SIM_PAGES_MAX)
+        sim_fatal("too many trapped pages", addr, 0);
+
+    pg = &sim_pages[sim_page_count];
+    off = (off_t)sim_page_count * SIM_PAGE;
+    pg->addr = addr & ~(SIM_PAGE - 1u);
+    pg->alias = mmap(0, SIM_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED, sim_fd, off);
+    if (pg->alias == MAP_FAILED ||
+        mmap((void *)(uintptr_t)pg->addr, SIM_PAGE, PROT_NONE, MAP_SHARED | MAP_FIXED, sim_fd, off) == MAP_FAILED)
+        sim_fatal("cannot map trapped page", addr, 0);
+
+    sim_page_count++;
+    return pg;
+}
+
+void sim_trap(uint32_t base, uint32_t len, SIM_ReadFn rd, SIM_WriteFn wr, void *ctx)
+{
+    if (sim_region_count == SIM_REGIONS_MAX)
+        sim_fatal("too many trapped regions", base, len);
+
+    for (uint32_t a = base & ~(SIM_PAGE - 1u); a < base + len; a += SIM_PAGE)
+        (void)sim_page_map(a);
+
+    sim_regions[sim_region_count++] = (SIM_Region){ base, len, rd, wr, ctx };
+}
+
+/* Model view of a register: the alias of a trapped page, target memory otherwise */
+volatile uint32_t *sim_reg(uint32_t addr)
+{
+    SIM_Page *pg = sim_page_of(addr);
+
+    if (pg)
+        return (volatile uint32_t *)(pg->alias + (addr - pg->addr));
+    return (volatile uint32_t *)(uintptr_t)addr;
+}
+
+static uint32_t sim_load(uint32_t addr, uint32_t size)
+{
+    volatile uint8_t *p = (volatile uint8_t *)sim_reg(addr);
+
+    if (size == 1u) return *p;
+    if (size == 2u) return *(volatile uint16_t *)p;
+    return *(volatile uint32_t *)p;
+}
+
+static void sim_store(uint32_t addr, uint32_t val, uint32_t size)
+{
+    volatile uint8_t *p = (volatile uint8_t *)sim_reg(addr);
+
+    if (size == 1u) *p = (uint8_t)val;
+    else if (size == 2u) *(volatile uint16_t *)p = (uint16_t)val;
+    else *(volatile uint32_t *)p = val;
+}
+
+/* Access by a bus master other than the CPU (DMA): no CPU cost */
+uint32_t sim_bus_read(uint32_t addr, uint32_t size)
+{
+    SIM_Region *r = sim_region_of(addr);
+
+    return r && r->rd ? r->rd(r->ctx, addr, size) : sim_load(addr, size);
+}
+
+void sim_bus_write(uint32_t addr, uint32_t val, uint32_t size)
+{
+    SIM_Region *r = sim_region_of(addr);
+    uint32_t old = sim_load(addr, size);
+
+    sim_store(addr, val, size);
+    if (r && r->wr)
+        r->wr(r->ctx, addr, old, val, size);
+}
+
+/* Events */
+
+void sim_at(uint64_t when, SIM_EventFn fn, void *ctx)
+{
+    if (sim_event_count == SIM_EVENTS_MAX)
+        sim_fatal("event queue full", when, 0);
+    if (when < sim_clock.now)
+        when = sim_clock.now;
+
+    sim_events[sim_event_count++] = (SIM_Event){ when, sim_event_seq++, fn, ctx };
+}
+
+void sim_cancel(SIM_EventFn fn, void *ctx)
+{
+    for (uint32_t i = 0; i < sim_event_count;)
+    {
+        if (sim_events[i].fn == fn && sim_events[i].ctx == ctx)
+            sim_events[i] = sim_events[--sim_event_count];
+        else
+            i++;
+    }
+}
+
+static SIM_Event *sim_event_next(void)
+{
+    SIM_Event *e = 0;
+
+    for (uint32_t i = 0; i < sim_event_count; i++)
+        if (!e || sim_events[i].when < e->when || (sim_events[i].when == e->when && sim_events[i].seq < e->seq))
+            e = &sim_events[i];
+    return e;
+}
+
+void sim_settle_hook(SIM_SettleFn fn)
+{
+    sim_settle_fns[sim_settle_count++] = fn;
+}
+
+/* Run the models to a fixed point (DMA requests served, SPI engines restarted) */
+void sim_settle(void)
+{
+    static int busy, again;
+    uint32_t rounds = 0;
+    int progress;
+
+    if (busy)
+    {
+        again = 1;
+        return;
+    }
+
+    busy = 1;
+    do
+    {
+        progress = again;
+        again = 0;
+        for (uint32_t i = 0; i < sim_settle_count; i++)
+            progress |= sim_settle_fns[i]();
+        if (++rounds > SIM_SETTLE_MAX)
+            sim_fatal("models do not settle", rounds, 0);
+    } while (progress);
+    busy = 0;
+}
+
+void sim_reset_watchdog(void)
+{
+    sim_progress = sim_clock.now;
+}
+
+/* Time */
+
+enum { SIM_BUSY, SIM_IDLE, SIM_APP };
+
+static void sim_account(int kind, uint64_t d)
+{
+    if (kind == SIM_IDLE)
+        sim_clock.idle += d;
+    else
+    {
+        sim_clock.busy += d;
+        if (sim_depth)
+            sim_clock.isr += d;
+        else if (kind == SIM_APP)
+            sim_clock.app += d;
+    }
+}
+
+static int sim_irq_wakeup(void);
+
+/* Clock to `to`, firing the events on the way; with wake set, stops after an event that leaves
+   an enabled interrupt pending. Returns the time reached */
+static uint64_t sim_advance(uint64_t to, int kind, int wake)
+{
+    uint64_t from = sim_clock.now;
+    SIM_Event *e;
+
+    while ((e = sim_event_next()) != 0 && e->when <= to)
+    {
+        SIM_Event ev = *e;
+
+        *e = sim_events[--sim_event_count];
+        if (ev.when > sim_clock.now)
+            sim_clock.now = ev.when;
+        ev.fn(ev.ctx);
+        sim_settle();
+        sim_progress = sim_clock.now;
+
+        if (wake && sim_irq_wakeup())
+        {
+            to = sim_clock.now;
+            break;
+        }
+    }
+
+    if (to > sim_clock.now)
+        sim_clock.now = to;
+    sim_account(kind, sim_clock.now - from);
+
+    if (sim_clock.now - sim_progress > SIM_WATCHDOG)
+        sim_fatal("no progress (firmware waiting for an event that never comes)", sim_clock.now, 0);
+
+    return sim_clock.now;
+}
+
+static void sim_charge(uint32_t cycles)
+{
+    (void)sim_advance(sim_clock.now + cycles, SIM_BUSY, 0);
+}
+
+/* Next point a spinning CPU would see a change: a model event or, when the loop reads the tick,
+   the next millisecond */
+static uint64_t sim_poll_target(int tick)
+{
+    SIM_Event *e = sim_event_next();
+    uint64_t ms = SIM_CPU_HZ / 1000u;
+    uint64_t t = tick ? (sim_clock.now / ms + 1u) * ms : UINT64_MAX;
+
+    if (e && e->when < t)
+        t = e->when;
+    return t;
+}
+
+/* HAL_GetTick(): a loop that only reads the tick sleeps to the next event or millisecond */
+uint32_t sim_tick(void)
+{
+    sim_charge(SIM_COST_TICK);
+
+    if (++sim_poll.ticks > SIM_POLL_STREAK)
+    {
+        (void)sim_advance(sim_poll_target(1), SIM_BUSY, 1);
+        sim_poll.streak = 0;
+    }
+
+    return (uint32_t)(sim_clock.now / (SIM_CPU_HZ / 1000u));
+}
+
+/* Interrupts */
+
+void sim_vector(IRQn_Type irqn, void (*handler)(void))
+{
+    sim_vectors[irqn] = handler;
+}
+
+void sim_irq_source(IRQn_Type irqn, SIM_LineFn line, void *ctx)
+{
+    sim_lines[irqn].line = line;
+    sim_lines[irqn].ctx = ctx;
+}
+
+static int sim_irq_pending(uint32_t irqn)
+{
+    if (sim_nvic_pend[irqn >> 5] & (1u << (irqn & 31u)))
+        return 1;
+    return sim_lines[irqn].line && sim_lines[irqn].line(sim_lines[irqn].ctx);
+}
+
+static int sim_irq_enabled(uint32_t irqn)
+{
+    return (sim_nvic_en[irqn >> 5] >> (irqn & 31u)) & 1u;
+}
+
+static uint32_t sim_irq_prio(uint32_t irqn)
+{
+    volatile uint8_t *ip = (volatile uint8_t *)sim_reg((uint32_t)(uintptr_t)&NVIC->IP[0]);
+
+    return ip[irqn] >> (8u - __NVIC_PRIO_BITS);
+}
+
+/* Highest priority interrupt that would preempt now, -1 if none */
+static int sim_irq_select(void)
+{
+    int best = -1;
+
+    for (uint32_t n = 0; n < SIM_IRQ_MAX; n++)
+    {
+        if (!sim_irq_enabled(n) || sim_active[n] || !sim_irq_pending(n))
+            continue;
+        if (sim_irq_prio(n) >= sim_prio)
+            continue;
+        if (best < 0 || sim_irq_prio(n) < sim_irq_prio((uint32_t)best))
+            best = (int)n;
+    }
+    return best;
+}
+
+/* WFI wake-up condition: an enabled interrupt pending, PRIMASK not considered */
+static int sim_irq_wakeup(void)
+{
+    for (uint32_t n = 0; n < SIM_IRQ_MAX; n++)
+        if (sim_irq_enabled(n) && !sim_active[n] && sim_irq_prio(n) < sim_prio && sim_irq_pending(n))
+            return 1;
+    return 0;
+}
+
+static void sim_irq_deliver(void)
+{
+    static uint32_t repeat;
+    static uint64_t repeat_at;
+    int n;
+
+    while (!sim_primask && !sim_step.armed && (n = sim_irq_select()) >= 0)
+    {
+        uint32_t saved = sim_prio;
+
+        if (sim_clock.now == repeat_at && ++repeat > 100000u)
+            sim_fatal("interrupt source never cleared", (uint64_t)n, 0);
+        if (sim_clock.now != repeat_at)
+        {
+            repeat_at = sim_clock.now;
+            repeat = 0;
+        }
+        if (!sim_vectors[n])
+            sim_fatal("no handler for interrupt", (uint64_t)n, 0);
+
+        sim_nvic_pend[n >> 5] &= ~(1u << (n & 31u));
+        sim_active[n] = 1;
+        sim_prio = sim_irq_prio((uint32_t)n);
+        sim_depth++;
+        sim_monitor.valid = 0;
+        sim_clock.irqs++;
+        sim_poll.streak = 0;
+        sim_progress = sim_clock.now;
+
+        sim_charge(SIM_COST_IRQ);
+        sim_vectors[n]();
+        sim_charge(SIM_COST_IRQ);
+
+        sim_monitor.valid = 0;
+        sim_depth--;
+        sim_prio = saved;
+        sim_active[n] = 0;
+    }
+}
+
+uint32_t sim_primask_get(void)
+{
+    return sim_primask;
+}
+
+void sim_primask_set(uint32_t primask)
+{
+    sim_primask = primask & 1u;
+    if (!sim_primask)
+        sim_irq_deliver();
+}
+
+/* Sleep to the next event or SysTick (1 ms), then take the interrupts */
+void sim_wfi(void)
+{
+    if (!sim_irq_wakeup())
+        (void)sim_advance(sim_poll_target(1), SIM_IDLE, 1);
+    sim_poll.streak = 0;
+    sim_poll.ticks = 0;
+    sim_irq_deliver();
+}
+
+uint32_t sim_ldrex(volatile void *addr, uint32_t size)
+{
+    sim_monitor.addr = addr;
+    sim_monitor.valid = 1;
+    if (size == 1u) return *(volatile uint8_t *)addr;
+    if (size == 2u) return *(volatile uint16_t *)addr;
+    return *(volatile uint32_t *)addr;
+}
+
+uint32_t sim_strex(uint32_t value, volatile void *addr, uint32_t size)
+{
+    if (!sim_monitor.valid || sim_monitor.addr != addr)
+        return 1u;
+
+    sim_monitor.valid = 0;
+    if (size == 1u) *(volatile uint8_t *)addr = (uint8_t)value;
+    else if (size == 2u) *(volatile uint16_t *)addr = (uint16_t)value;
+    else *(volatile uint32_t *)addr = value;
+    return 0u;
+}
+
+void sim_clrex(void)
+{
+    sim_monitor.valid = 0;
+}
+
+void sim_cpu(uint32_t cycles)
+{
+    while (cycles)
+    {
+        SIM_Event *e = sim_event_next();
+        uint64_t step = cycles;
+
+        if (e && e->when > sim_clock.now && e->when - sim_clock.now < step)
+            step = e->when - sim_clock.now;
+        (void)sim_advance(sim_clock.now + step, SIM_APP, 0);
+        cycles -= (uint32_t)step;
+        sim_progress = sim_clock.now;
+        sim_irq_deliver();
+    }
+    sim_poll.ticks = 0;
+}
+
+int sim_idle(int (*done)(void *ctx), void *ctx, uint64_t timeout)
+{
+    uint64_t end = sim_clock.now + timeout;
+
+    sim_irq_deliver();
+    while (!done(ctx))
+    {
+        SIM_Event *e = sim_event_next();
+
+        if (sim_clock.now >= end)
+            return 0;
+        (void)sim_advance(e && e->when < end ? e->when : end, SIM_IDLE, 1);
+        sim_irq_deliver();
+    }
+    sim_poll.ticks = 0;
+    return 1;
+}
+
+/* Core peripherals: NVIC set/clear registers, DWT cycle counter */
+
+static uint32_t sim_nvic_read(void *ctx, uint32_t addr, uint32_t size)
+{
+    uint32_t off = addr - (uint32_t)NVIC_BASE;
+    uint32_t w = (off & 0x7Fu) >> 2;
+    uint32_t v = 0;
+
+    (void)ctx;
+    if (off >= 0x300u || w >= (SIM_IRQ_MAX + 31u) / 32u)
+        return sim_load(addr, size);
+
+    if (off < 0x100u)                  // ISER / ICER
+        return sim_nvic_en[w];
+    for (uint32_t b = 0; b < 32u; b++)  // ISPR / ICPR
+        if (w * 32u + b < SIM_IRQ_MAX && sim_irq_pending(w * 32u + b))
+            v |= 1u << b;
+    return v;
+}
+
+static void sim_nvic_write(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    uint32_t off = addr - (uint32_t)NVIC_BASE;
+    uint32_t w = (off & 0x7Fu) >> 2;
+
+    (void)ctx;
+    (void)old;
+    (void)size;
+    if (off >= 0x300u || w >= (SIM_IRQ_MAX + 31u) / 32u)
+        return;
+
+    if (off < 0x80u) sim_nvic_en[w] |= val;
+    else if (off < 0x100u) sim_nvic_en[w] &= ~val;
+    else if (off < 0x200u) ;
+    else if (off < 0x280u) sim_nvic_pend[w] |= val;
+    else sim_nvic_pend[w] &= ~val;
+
+    *sim_reg(addr) = 0;
+}
+
+static uint32_t sim_dwt_read(void *ctx, uint32_t addr, uint32_t size)
+{
+    (void)ctx;
+    if (addr == (uint32_t)(uintptr_t)&DWT->CYCCNT)
+        return (*sim_reg((uint32_t)(uintptr_t)&DWT->CTRL) & DWT_CTRL_CYCCNTENA_Msk)
+               ? (uint32_t)(sim_clock.now - sim_dwt_base) : sim_dwt_frozen;
+    return sim_load(addr, size);
+}
+
+static void sim_dwt_write(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    (void)ctx;
+    (void)size;
+    if (addr == (uint32_t)(uintptr_t)&DWT->CYCCNT)
+    {
+        sim_dwt_base = sim_clock.now - val;
+        sim_dwt_frozen = val;
+    }
+    else if (addr == (uint32_t)(uintptr_t)&DWT->CTRL && ((old ^ val) & DWT_CTRL_CYCCNTENA_Msk))
+    {
+        if (val & DWT_CTRL_CYCCNTENA_Msk)
+            sim_dwt_base = sim_clock.now - sim_dwt_frozen;
+        else
+            sim_dwt_frozen = (uint32_t)(sim_clock.now - sim_dwt_base);
+    }
+}
+
+/* Trapped CPU accesses */
+
+/* Operand size of the faulting x86-64 instruction */
+static uint32_t sim_decode(const uint8_t *ip)
+{
+    uint32_t opsize = 4;
+
+    for (;; ip++)
+    {
+        if (*ip == 0x66u) opsize = 2;
+        else if (*ip == 0x67u || *ip == 0xF2u || *ip == 0xF3u || *ip == 0xF0u || *ip == 0x2Eu ||
+                 *ip == 0x36u || *ip == 0x3Eu || *ip == 0x26u || *ip == 0x64u || *ip == 0x65u) ;
+        else break;
+    }
+    if ((*ip & 0xF0u) == 0x40u)
+    {
+        if (*ip & 0x08u) opsize = 8;
+        ip++;
+    }
+
+    switch (*ip)
+    {
+    case 0x00: case 0x02: case 0x08: case 0x0A: case 0x20: case 0x22: case 0x28: case 0x2A:
+    case 0x30: case 0x32: case 0x38: case 0x3A: case 0x80: case 0x84: case 0x86: case 0x88:
+    case 0x8A: case 0xC6: case 0xF6: case 0xFE:
+        return 1;
+    case 0x0F:
+        if (ip[1] == 0xB6u || ip[1] == 0xBEu) return 1;
+        if (ip[1] == 0xB7u || ip[1] == 0xBFu) return 2;
+        if (ip[1] == 0x6Eu || ip[1] == 0x7Eu) return opsize == 8 ? 8 : 4;
+        return opsize;
+    default:
+        return opsize;
+    }
+}
+
+/* Reads seen before: a repeated value keeps the polling streak going */
+static int sim_poll_same(uint32_t addr, uint32_t val)
+{
+    for (uint32_t i = 0; i < 4u; i++)
+        if (sim_poll.addr[i] == addr)
+        {
+            int same = sim_poll.val[i] == val;
+            sim_poll.val[i] = val;
+            return same;
+        }
+
+    memmove(&sim_poll.addr[1], &sim_poll.addr[0], 3u * sizeof(uint32_t));
+    memmove(&sim_poll.val[1], &sim_poll.val[0], 3u * sizeof(uint32_t));
+    sim_poll.addr[0] = addr;
+    sim_poll.val[0] = val;
+    return 0;
+}
+
+static uint32_t sim_cpu_read(uint32_t addr, uint32_t size)
+{
+    SIM_Region *r = sim_region_of(addr);
+    int tick = sim_poll.ticks != 0;
+    uint32_t v;
+
+    sim_clock.accesses++;
+    sim_poll.ticks = 0;
+    sim_charge(SIM_COST_READ);
+    v = r && r->rd ? r->rd(r->ctx, addr, size) : sim_load(addr, size);
+
+    if (!sim_poll_same(addr, v))
+        sim_poll.streak = 0;
+    else if (++sim_poll.streak >= SIM_POLL_STREAK)
+    {
+        uint64_t t = sim_poll_target(tick);
+
+        if (t != UINT64_MAX)
+        {
+            (void)sim_advance(t, SIM_BUSY, 0);
+            sim_poll.streak = 0;
+            v = r && r->rd ? r->rd(r->ctx, addr, size) : sim_load(addr, size);
+            (void)sim_poll_same(addr, v);
+        }
+    }
+
+    sim_settle();
+    return v;
+}
+
+static void sim_cpu_write(uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    SIM_Region *r = sim_region_of(addr);
+
+    sim_clock.accesses++;
+    sim_poll.ticks = 0;
+    sim_poll.streak = 0;
+    sim_progress = sim_clock.now;
+    sim_charge(SIM_COST_WRITE);
+    if (r && r->wr)
+        r->wr(r->ctx, addr, old, val, size);
+    sim_settle();
+}
+
+static void sim_segv(int sig, siginfo_t *si, void *uctx)
+{
+    ucontext_t *uc = uctx;
+    uintptr_t a = (uintptr_t)si->si_addr;
+    SIM_Page *pg = sim_page_of(a);
+    uint32_t addr = (uint32_t)a;
+
+    (void)sig;
+    if (!pg || sim_step.armed)
+        sim_fatal("memory fault", a, (uint64_t)uc->uc_mcontext.gregs[REG_RIP]);
+
+    sim_step.page = pg;
+    sim_step.addr = addr;
+    sim_step.size = sim_decode((const uint8_t *)uc->uc_mcontext.gregs[REG_RIP]);
+    sim_step.write = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+    if (sim_step.size > 4u)
+        sim_fatal("unsupported register access width", a, sim_step.size);
+
+    if (sim_step.write)
+        sim_step.old = sim_load(addr, sim_step.size);
+    else
+        sim_store(addr, sim_cpu_read(addr, sim_step.size), sim_step.size);
+
+    sim_step.armed = 1;
+    if (mprotect((void *)(uintptr_t)pg->addr, SIM_PAGE, PROT_READ | PROT_WRITE) != 0)
+        sim_fatal("mprotect", pg->addr, 0);
+    uc->uc_mcontext.gregs[REG_EFL] |= 0x100;
+}
+
+static void sim_trap_step(int sig, siginfo_t *si, void *uctx)
+{
+    ucontext_t *uc = uctx;
+    SIM_Page *pg = sim_step.page;
+
+    (void)sig;
+    (void)si;
+    if (!sim_step.armed)
+        sim_fatal("unexpected trap", (uint64_t)uc->uc_mcontext.gregs[REG_RIP], 0);
+
+    uc->uc_mcontext.gregs[REG_EFL] &= ~0x100;
+    (void)mprotect((void *)(uintptr_t)pg->addr, SIM_PAGE, PROT_NONE);
+    sim_step.armed = 0;
+
+    if (sim_step.write)
+        sim_cpu_write(sim_step.addr, sim_step.old, sim_load(sim_step.addr, sim_step.size), sim_step.size);
+
+    sim_irq_deliver();
+}
+
+void sim_init(void)
+{
+    struct sigaction sa;
+
+    memset(&sim_clock, 0, sizeof(sim_clock));
+
+    for (uint32_t i = 0; i < sizeof(sim_ram) / sizeof(sim_ram[0]); i++)
+        if (mmap((void *)(uintptr_t)sim_ram[i].base, sim_ram[i].len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) == MAP_FAILED)
+            sim_fatal("cannot map target memory (build with -no-pie)", sim_ram[i].base, 0);
+
+    sim_fd = memfd_create("sim-regs", 0);
+    if (sim_fd < 0 || ftruncate(sim_fd, (off_t)SIM_PAGES_MAX * SIM_PAGE) != 0)
+        sim_fatal("memfd", 0, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sa.sa_sigaction = sim_segv;
+    sigaction(SIGSEGV, &sa, 0);
+    sa.sa_sigaction = sim_trap_step;
+    sigaction(SIGTRAP, &sa, 0);
+
+    sim_trap(NVIC_BASE, 0x300u, sim_nvic_read, sim_nvic_write, 0);
+    sim_trap(DWT_BASE, 0x10u, sim_dwt_read, sim_dwt_write, 0);
+
+    sim_gpio_init();
+    sim_spi_init();
+    sim_dma_init();
+    sim_hal_init();
+}
@@ -0,0 +1,171 @@
+/**
+  ******************************************************************************
+  * @file           : sim.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * Host simulator of the STM32H753 peripherals used by spi_app.c: SPI1/2/3,
+  * DMA1/DMA2 with DMAMUX1, MDMA, GPIO, EXTI and the NVIC. The firmware and the
+  * HAL run unmodified on x86-64: the register pages are mapped at their target
+  * addresses without access rights, every access faults into the simulator,
+  * which runs the peripheral models on a virtual clock of CPU cycles (480 MHz).
+*/
+
+#ifndef HOST_SIM_H_
+#define HOST_SIM_H_
+
+#include <stdint.h>
+#include "stm32h7xx_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Virtual clocks (Hz): CPU, SPI123 kernel clock, PCLK1 */
+#define SIM_CPU_HZ          480000000u
+#define SIM_SPI_KER_HZ      192000000u
+#define SIM_PCLK1_HZ        120000000u
+
+/* CPU cost of one peripheral register access, bus wait plus the code around it (cycles) */
+#ifndef SIM_COST_READ
+#define SIM_COST_READ       34u
+#endif
+#ifndef SIM_COST_WRITE
+#define SIM_COST_WRITE      18u
+#endif
+
+/* Exception entry and return (cycles) */
+#ifndef SIM_COST_IRQ
+#define SIM_COST_IRQ        12u
+#endif
+
+/* HAL_GetTick() call (cycles) */
+#ifndef SIM_COST_TICK
+#define SIM_COST_TICK       8u
+#endif
+
+/* Identical register reads in a row taken as a polling loop: the clock then jumps to the next
+   peripheral event (or millisecond, for HAL timeouts), the jump counted as busy CPU time */
+#ifndef SIM_POLL_STREAK
+#define SIM_POLL_STREAK     3u
+#endif
+
+/* Virtual time without any progress of the firmware before the run is aborted (cycles) */
+#ifndef SIM_WATCHDOG
+#define SIM_WATCHDOG        (10ull * SIM_CPU_HZ)
+#endif
+
+/* CPU time accounting (cycles). busy includes isr */
+typedef struct {
+    uint64_t now;
+    uint64_t busy;                     // firmware running (thread and handlers)
+    uint64_t idle;                     // WFI / sim_idle()
+    uint64_t isr;                      // exception handlers, entry and return included
+    uint64_t app;                      // sim_cpu(): application work outside the driver
+    uint64_t accesses;                 // register accesses trapped
+    uint64_t irqs;                     // exceptions taken
+} SIM_Clock;
+
+extern SIM_Clock sim_clock;
+
+/* Map the peripheral space, install the trap handlers and reset every model */
+void sim_init(void);
+
+static inline uint64_t sim_now(void) { return sim_clock.now; }
+
+/* Cycles to microseconds / bytes per second */
+static inline double sim_us(uint64_t cycles) { return (double)cycles * 1e6 / SIM_CPU_HZ; }
+static inline double sim_rate(uint64_t bytes, uint64_t cycles)
+{
+    return cycles ? (double)bytes * SIM_CPU_HZ / (double)cycles : 0.0;
+}
+
+/* Application context: cycles of busy work (IRQs are taken in between) */
+void sim_cpu(uint32_t cycles);
+
+/* Application context: sleep until done(ctx) is true (WFI loop); 0 on timeout (cycles) */
+int sim_idle(int (*done)(void *ctx), void *ctx, uint64_t timeout);
+
+/* Scheduled call at virtual time when (cycles); the callback runs outside any firmware context
+   and may only touch the models (sim_gpio_drive(), sim_spi_slave_frame(), ...) */
+typedef void (*SIM_EventFn)(void *ctx);
+void sim_at(uint64_t when, SIM_EventFn fn, void *ctx);
+void sim_cancel(SIM_EventFn fn, void *ctx);
+
+/* Vector table: handler of a device interrupt */
+void sim_vector(IRQn_Type irqn, void (*handler)(void));
+
+/* GPIO: level seen on a pin, external drive (-1 releases it) and pin-to-pin wire */
+int sim_gpio_level(GPIO_TypeDef *port, uint16_t pin);
+void sim_gpio_drive(GPIO_TypeDef *port, uint16_t pin, int level);
+void sim_gpio_wire(GPIO_TypeDef *from, uint16_t from_pin, GPIO_TypeDef *to, uint16_t to_pin);
+
+/* Device on a SPI bus, selected while its CS pin is low. xfer() gets each frame the master
+   clocks while selected and returns MISO; cs() is called on CS edges (optional) */
+typedef struct SIM_SpiPeer {
+    GPIO_TypeDef *cs_port;
+    uint16_t cs_pin;
+    uint32_t (*xfer)(void *ctx, uint32_t mosi, uint32_t bits);
+    void (*cs)(void *ctx, int selected);
+    void *ctx;
+    struct SIM_SpiPeer *next;
+} SIM_SpiPeer;
+
+void sim_spi_attach(SPI_TypeDef *spi, SIM_SpiPeer *peer);
+
+/* Connect two instances: frames clocked by master go to slave (its NSS is its own pin) */
+void sim_spi_link(SPI_TypeDef *master, SPI_TypeDef *slave);
+
+/* CRC mismatch (CRCE with EOT) at the end of the nth master transfer with CRCEN from now
+   (1: the next one), once; 0 cancels */
+void sim_spi_crc_error(SPI_TypeDef *spi, uint32_t nth);
+
+/* External master clocking one frame into a slave instance; returns MISO */
+uint32_t sim_spi_slave_frame(SPI_TypeDef *slave, uint32_t mosi, uint32_t bits);
+
+/* Per-instance wire statistics */
+typedef struct {
+    uint64_t frames;
+    uint64_t bits;
+    uint64_t wire;                     // cycles with SCK running
+    uint32_t ovr;                      // frames lost on a full RX FIFO
+    uint32_t udr;                      // slave frames sent with an empty TX FIFO
+} SIM_SpiStats;
+
+SIM_SpiStats *sim_spi_stats(SPI_TypeDef *spi);
+
+/* SCK period of an instance as configured now (CPU cycles) */
+uint32_t sim_spi_sck(SPI_TypeDef *spi);
+
+/* DMA requests served on a stream since sim_init() */
+uint32_t sim_dma_requests(DMA_Stream_TypeDef *stream);
+
+/* Internal: models and trap dispatch (sim*.c) */
+typedef uint32_t (*SIM_ReadFn)(void *ctx, uint32_t addr, uint32_t size);
+typedef void (*SIM_WriteFn)(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size);
+typedef int (*SIM_LineFn)(void *ctx);
+typedef int (*SIM_SettleFn)(void);
+
+void sim_trap(uint32_t base, uint32_t len, SIM_ReadFn rd, SIM_WriteFn wr, void *ctx);
+volatile uint32_t *sim_reg(uint32_t addr);
+uint32_t sim_bus_read(uint32_t addr, uint32_t size);
+void sim_bus_write(uint32_t addr, uint32_t val, uint32_t size);
+void sim_irq_source(IRQn_Type irqn, SIM_LineFn line, void *ctx);
+void sim_settle_hook(SIM_SettleFn fn);
+void sim_settle(void);
+void sim_reset_watchdog(void);
+
+void sim_gpio_init(void);
+void sim_gpio_update(void);
+void sim_gpio_af_driver(GPIO_TypeDef *port, uint16_t pin, uint32_t af, int (*level)(void *ctx), void *ctx);
+void sim_gpio_watch(GPIO_TypeDef *port, uint16_t pin, void (*edge)(void *ctx, int level), void *ctx);
+void sim_spi_init(void);
+uint32_t sim_spi_dma_request(uint32_t req);
+void sim_dma_init(void);
+void sim_hal_init(void);
+uint32_t sim_tick(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SIM_H_ */
@@ -0,0 +1,343 @@
+/**
+  ******************************************************************************
+  * @file           : sim_dma.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * DMA1/DMA2 streams behind DMAMUX1, and the MDMA (software requests, one
+  * block). A stream serves its request line (SPI TXP/RXP with TX/RXDMAEN) one
+  * PSIZE item per beat with no bus latency: NDTR, half/complete flags,
+  * circular reload and double-buffer CT switch as on the target; a stream
+  * disabled by software raises TCIF. The FIFO, bursts and the request
+  * generator are not modelled; DMA data go straight to host memory, so cache
+  * maintenance is not checked here.
+*/
+
+#include "sim.h"
+#include <string.h>
+
+#define SIM_STREAMS         16u
+#define SIM_MDMA_CHANNELS   16u
+#define SIM_MDMA_SETUP      20u        // CPU cycles from the software request to the first beat
+
+typedef struct {
+    uint32_t base;                     // stream registers
+    uint32_t pos;                      // bytes moved in the current buffer
+    uint32_t ndtr;                     // NDTR programmed at enable
+    uint32_t requests;
+} SIM_Stream;
+
+static SIM_Stream sim_streams[SIM_STREAMS];
+static const uint8_t sim_flag_shift[4] = { 0u, 6u, 16u, 22u };
+
+static DMA_Stream_TypeDef *sim_stream_regs(const SIM_Stream *st)
+{
+    return (DMA_Stream_TypeDef *)(uintptr_t)sim_reg(st->base);
+}
+
+static uint32_t sim_stream_index(uint32_t addr)
+{
+    uint32_t ctrl = addr >= DMA2_BASE ? 1u : 0u;
+
+    return ctrl * 8u + ((addr - (ctrl ? DMA2_BASE : DMA1_BASE)) - 0x10u) / 0x18u;
+}
+
+/* Flags of stream i in LISR/HISR */
+static volatile uint32_t *sim_stream_isr(uint32_t i, uint32_t *shift)
+{
+    uint32_t base = i < 8u ? DMA1_BASE : DMA2_BASE;
+    uint32_t s = i % 8u;
+
+    *shift = sim_flag_shift[s % 4u];
+    return sim_reg(base + (s < 4u ? 0x0u : 0x4u));
+}
+
+static void sim_stream_flag(uint32_t i, uint32_t flag)
+{
+    uint32_t shift;
+    volatile uint32_t *isr = sim_stream_isr(i, &shift);
+
+    *isr |= flag << shift;
+}
+
+uint32_t sim_dma_requests(DMA_Stream_TypeDef *stream)
+{
+    return sim_streams[sim_stream_index((uint32_t)(uintptr_t)stream)].requests;
+}
+
+static int sim_stream_line(void *ctx)
+{
+    uint32_t i = (uint32_t)(uintptr_t)ctx;
+    DMA_Stream_TypeDef *r = sim_stream_regs(&sim_streams[i]);
+    uint32_t shift, flags, en = 0;
+
+    flags = (*sim_stream_isr(i, &shift) >> shift) & 0x3Du;
+    if (r->CR & DMA_SxCR_TCIE) en |= DMA_FLAG_TCIF0_4;
+    if (r->CR & DMA_SxCR_HTIE) en |= DMA_FLAG_HTIF0_4;
+    if (r->CR & DMA_SxCR_TEIE) en |= DMA_FLAG_TEIF0_4;
+    if (r->CR & DMA_SxCR_DMEIE) en |= DMA_FLAG_DMEIF0_4;
+    if (r->FCR & DMA_SxFCR_FEIE) en |= DMA_FLAG_FEIF0_4;
+
+    return (flags & en) != 0u;
+}
+
+static uint32_t sim_request_level(uint32_t req)
+{
+    return req ? sim_spi_dma_request(req) : 0u;
+}
+
+/* One PSIZE item between the peripheral register and memory */
+static void sim_stream_beat(uint32_t i)
+{
+    SIM_Stream *st = &sim_streams[i];
+    DMA_Stream_TypeDef *r = sim_stream_regs(st);
+    uint32_t cr = r->CR;
+    uint32_t psize = 1u << ((cr & DMA_SxCR_PSIZE) >> DMA_SxCR_PSIZE_Pos);
+    uint32_t mem = ((cr & DMA_SxCR_DBM) && (cr & DMA_SxCR_CT)) ? r->M1AR : r->M0AR;
+    uint8_t *m = (uint8_t *)(uintptr_t)(mem + st->pos);
+    uint32_t v = 0;
+
+    if ((cr & DMA_SxCR_DIR) == 0u)     // peripheral to memory
+    {
+        v = sim_bus_read(r->PAR, psize);
+        memcpy(m, &v, psize);
+    }
+    else
+    {
+        memcpy(&v, m, psize);
+        sim_bus_write(r->PAR, v, psize);
+    }
+
+    if (cr & DMA_SxCR_MINC)
+        st->pos += psize;
+    st->requests++;
+    r->NDTR--;
+
+    if (r->NDTR == st->ndtr - st->ndtr / 2u)
+        sim_stream_flag(i, DMA_FLAG_HTIF0_4);
+
+    if (r->NDTR == 0u)
+    {
+        sim_stream_flag(i, DMA_FLAG_TCIF0_4);
+        if (cr & (DMA_SxCR_CIRC | DMA_SxCR_DBM))
+        {
+            r->NDTR = st->ndtr;
+            st->pos = 0;
+            if (cr & DMA_SxCR_DBM)
+                r->CR = cr ^ DMA_SxCR_CT;
+        }
+        else
+            r->CR = cr & ~DMA_SxCR_EN;
+    }
+}
+
+static int sim_dma_settle(void)
+{
+    int progress = 0;
+
+    for (uint32_t i = 0; i < SIM_STREAMS; i++)
+    {
+        DMA_Stream_TypeDef *r = sim_stream_regs(&sim_streams[i]);
+        uint32_t req = *sim_reg(DMAMUX1_Channel0_BASE + 4u * i) & DMAMUX_CxCR_DMAREQ_ID;
+
+        if ((r->CR & DMA_SxCR_DIR) == DMA_SxCR_DIR_1)      // memory to memory: all at once
+        {
+            while ((r->CR & DMA_SxCR_EN) && r->NDTR)
+            {
+                uint32_t psize = 1u << ((r->CR & DMA_SxCR_PSIZE) >> DMA_SxCR_PSIZE_Pos);
+
+                memcpy((uint8_t *)(uintptr_t)r->M0AR + sim_streams[i].pos,
+                       (uint8_t *)(uintptr_t)r->PAR + sim_streams[i].pos, psize);
+                sim_streams[i].pos += psize;
+                if (--r->NDTR == 0u)
+                {
+                    sim_stream_flag(i, DMA_FLAG_TCIF0_4);
+                    r->CR &= ~DMA_SxCR_EN;
+                }
+                progress = 1;
+            }
+            continue;
+        }
+
+        while ((r->CR & DMA_SxCR_EN) && r->NDTR && sim_request_level(req))
+        {
+            sim_stream_beat(i);
+            progress = 1;
+        }
+    }
+    return progress;
+}
+
+/* DMA1/DMA2 registers */
+
+static void sim_dma_write(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    uint32_t base = addr >= DMA2_BASE ? DMA2_BASE : DMA1_BASE;
+    uint32_t off = addr - base;
+
+    (void)ctx;
+    (void)size;
+    if (off == 0x8u || off == 0xCu)    // LIFCR / HIFCR
+    {
+        *sim_reg(base + off - 0x8u) &= ~val;
+        *sim_reg(addr) = 0;
+        return;
+    }
+    if (off < 0x8u)                    // LISR / HISR: read-only
+    {
+        *sim_reg(addr) = old;
+        return;
+    }
+
+    if ((off - 0x10u) % 0x18u == 0u)   // SxCR
+    {
+        uint32_t i = sim_stream_index(addr);
+        SIM_Stream *st = &sim_streams[i];
+        DMA_Stream_TypeDef *r = sim_stream_regs(st);
+
+        if (!(old & DMA_SxCR_EN) && (val & DMA_SxCR_EN))
+        {
+            st->pos = 0;
+            st->ndtr = r->NDTR;
+        }
+        else if ((old & DMA_SxCR_EN) && !(val & DMA_SxCR_EN))
+            sim_stream_flag(i, DMA_FLAG_TCIF0_4);
+    }
+}
+
+static void sim_dmamux_write(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    (void)ctx;
+    (void)old;
+    (void)size;
+    if (addr == DMAMUX1_ChannelStatus_BASE + 4u)       // CFR
+    {
+        *sim_reg(DMAMUX1_ChannelStatus_BASE) &= ~val;
+        *sim_reg(addr) = 0;
+    }
+    else if (addr == DMAMUX1_RequestGenStatus_BASE + 4u)
+    {
+        *sim_reg(DMAMUX1_RequestGenStatus_BASE) &= ~val;
+        *sim_reg(addr) = 0;
+    }
+}
+
+/* MDMA */
+
+static MDMA_Channel_TypeDef *sim_mdma_regs(uint32_t c)
+{
+    return (MDMA_Channel_TypeDef *)(uintptr_t)sim_reg(MDMA_Channel0_BASE + 0x40u * c);
+}
+
+static uint32_t sim_mdma_pending(uint32_t c)
+{
+    MDMA_Channel_TypeDef *r = sim_mdma_regs(c);
+    uint32_t en = 0;
+
+    if (r->CCR & MDMA_CCR_TEIE) en |= MDMA_CISR_TEIF;
+    if (r->CCR & MDMA_CCR_CTCIE) en |= MDMA_CISR_CTCIF;
+    if (r->CCR & MDMA_CCR_BRTIE) en |= MDMA_CISR_BRTIF;
+    if (r->CCR & MDMA_CCR_BTIE) en |= MDMA_CISR_BTIF;
+    if (r->CCR & MDMA_CCR_TCIE) en |= MDMA_CISR_TCIF;
+
+    return r->CISR & en;
+}
+
+static void sim_mdma_done(void *ctx)
+{
+    uint32_t c = (uint32_t)(uintptr_t)ctx;
+    MDMA_Channel_TypeDef *r = sim_mdma_regs(c);
+    uint32_t len = (r->CBNDTR & MDMA_CBNDTR_BNDT) * (((r->CBNDTR & MDMA_CBNDTR_BRC) >> MDMA_CBNDTR_BRC_Pos) + 1u);
+
+    memcpy((void *)(uintptr_t)r->CDAR, (const void *)(uintptr_t)r->CSAR, len);
+    r->CISR = (r->CISR & ~MDMA_CISR_CRQA) | MDMA_CISR_CTCIF | MDMA_CISR_BRTIF | MDMA_CISR_BTIF | MDMA_CISR_TCIF;
+    r->CCR &= ~MDMA_CCR_EN;
+}
+
+static uint32_t sim_mdma_read(void *ctx, uint32_t addr, uint32_t size)
+{
+    (void)ctx;
+    if (addr == MDMA_BASE)             // GISR0
+    {
+        uint32_t v = 0;
+
+        for (uint32_t c = 0; c < SIM_MDMA_CHANNELS; c++)
+            if (sim_mdma_pending(c))
+                v |= 1u << c;
+        return v;
+    }
+    (void)size;
+    return *sim_reg(addr & ~3u);
+}
+
+static void sim_mdma_write(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    uint32_t c = (addr - MDMA_Channel0_BASE) / 0x40u;
+    uint32_t off = (addr - MDMA_Channel0_BASE) % 0x40u;
+    MDMA_Channel_TypeDef *r;
+
+    (void)ctx;
+    (void)size;
+    if (addr < MDMA_Channel0_BASE)
+    {
+        *sim_reg(addr) = old;
+        return;
+    }
+
+    r = sim_mdma_regs(c);
+    if (off == offsetof(MDMA_Channel_TypeDef, CIFCR))
+    {
+        r->CISR &= ~(val & 0x1Fu);
+        r->CIFCR = 0;
+    }
+    else if (off == offsetof(MDMA_Channel_TypeDef, CISR))
+        r->CISR = old;
+    else if (off == offsetof(MDMA_Channel_TypeDef, CCR))
+    {
+        uint32_t len = r->CBNDTR & MDMA_CBNDTR_BNDT;
+
+        if ((val & MDMA_CCR_SWRQ) && (r->CCR & MDMA_CCR_EN) && !(r->CISR & MDMA_CISR_CRQA))
+        {
+            r->CISR |= MDMA_CISR_CRQA;
+            sim_at(sim_now() + SIM_MDMA_SETUP + len / 2u, sim_mdma_done, (void *)(uintptr_t)c);
+        }
+        if (!(val & MDMA_CCR_EN) && (old & MDMA_CCR_EN) && (r->CISR & MDMA_CISR_CRQA))
+        {
+            sim_cancel(sim_mdma_done, (void *)(uintptr_t)c);
+            r->CISR &= ~MDMA_CISR_CRQA;
+        }
+        r->CCR &= ~MDMA_CCR_SWRQ;
+    }
+}
+
+static int sim_mdma_line(void *ctx)
+{
+    (void)ctx;
+    for (uint32_t c = 0; c < SIM_MDMA_CHANNELS; c++)
+        if (sim_mdma_pending(c))
+            return 1;
+    return 0;
+}
+
+static const IRQn_Type sim_stream_irqn[SIM_STREAMS] = {
+    DMA1_Stream0_IRQn, DMA1_Stream1_IRQn, DMA1_Stream2_IRQn, DMA1_Stream3_IRQn,
+    DMA1_Stream4_IRQn, DMA1_Stream5_IRQn, DMA1_Stream6_IRQn, DMA1_Stream7_IRQn,
+    DMA2_Stream0_IRQn, DMA2_Stream1_IRQn, DMA2_Stream2_IRQn, DMA2_Stream3_IRQn,
+    DMA2_Stream4_IRQn, DMA2_Stream5_IRQn, DMA2_Stream6_IRQn, DMA2_Stream7_IRQn,
+};
+
+void sim_dma_init(void)
+{
+    memset(sim_streams, 0, sizeof(sim_streams));
+    for (uint32_t i = 0; i < SIM_STREAMS; i++)
+    {
+        sim_streams[i].base = (i < 8u ? DMA1_Stream0_BASE : DMA2_Stream0_BASE) + 0x18u * (i % 8u);
+        sim_irq_source(sim_stream_irqn[i], sim_stream_line, (void *)(uintptr_t)i);
+    }
+
+    sim_trap(DMA1_BASE, 0x400u, 0, sim_dma_write, 0);
+    sim_trap(DMA2_BASE, 0x400u, 0, sim_dma_write, 0);
+    sim_trap(DMAMUX1_BASE, 0x400u, 0, sim_dmamux_write, 0);
+    sim_trap(MDMA_BASE, 0x1000u, sim_mdma_read, sim_mdma_write, 0);
+    sim_irq_source(MDMA_IRQn, sim_mdma_line, 0);
+    sim_settle_hook(sim_dma_settle);
+}
@@ -0,0 +1,263 @@
+/**
+  ******************************************************************************
+  * @file           : sim_gpio.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * GPIO ports A..K, EXTI lines 0..15 (CPU1 view) and SYSCFG EXTICR.
+  * Pin level: output -> ODR; alternate function -> the peripheral driving it
+  * (SPI NSS), if any; otherwise external drive, wire, then the pull (floating
+  * inputs read high). Level changes go to EXTI and to the pin watchers.
+*/
+
+#include "sim.h"
+#include <string.h>
+
+#define SIM_PORTS           11u
+#define SIM_AF_MAX          8u
+#define SIM_WATCH_MAX       16u
+#define SIM_WIRE_MAX        8u
+
+typedef struct {
+    uint32_t port;
+    uint16_t pin;
+    uint32_t af;
+    int (*level)(void *ctx);
+    void *ctx;
+} SIM_AfDriver;
+
+static uint16_t sim_ext_mask[SIM_PORTS], sim_ext_level[SIM_PORTS];
+static uint16_t sim_level[SIM_PORTS];
+static SIM_AfDriver sim_af[SIM_AF_MAX];
+static uint32_t sim_af_count;
+static struct { uint32_t port; uint16_t pin; void (*edge)(void *, int); void *ctx; } sim_watch[SIM_WATCH_MAX];
+static uint32_t sim_watch_count;
+static struct { uint32_t from, to; uint16_t from_pin, to_pin; } sim_wires[SIM_WIRE_MAX];
+static uint32_t sim_wire_count;
+
+static uint32_t sim_port_index(GPIO_TypeDef *port)
+{
+    return (uint32_t)((uintptr_t)port - GPIOA_BASE) / 0x400u;
+}
+
+static GPIO_TypeDef *sim_port(uint32_t i)
+{
+    return (GPIO_TypeDef *)(uintptr_t)sim_reg((uint32_t)(GPIOA_BASE + 0x400u * i));
+}
+
+static uint32_t sim_pin_index(uint16_t pin)
+{
+    return (uint32_t)__builtin_ctz(pin);
+}
+
+static uint16_t sim_port_levels(uint32_t p)
+{
+    GPIO_TypeDef *g = sim_port(p);
+    uint16_t lv = 0;
+
+    for (uint32_t n = 0; n < 16u; n++)
+    {
+        uint32_t mode = (g->MODER >> (2u * n)) & 3u;
+        int v = -1;
+
+        if (mode == 1u)
+            v = (g->ODR >> n) & 1u;
+        else if (mode == 2u)
+        {
+            uint32_t af = (g->AFR[n >> 3] >> (4u * (n & 7u))) & 0xFu;
+
+            for (uint32_t i = 0; i < sim_af_count; i++)
+                if (sim_af[i].port == p && sim_af[i].pin == (1u << n) && sim_af[i].af == af)
+                    v = sim_af[i].level(sim_af[i].ctx);
+        }
+
+        if (v < 0 && (sim_ext_mask[p] & (1u << n)))
+            v = (sim_ext_level[p] >> n) & 1u;
+        if (v < 0)
+            v = ((g->PUPDR >> (2u * n)) & 3u) != 2u;
+
+        lv |= (uint16_t)((uint32_t)v << n);
+    }
+    return lv;
+}
+
+static void sim_exti_edge(uint32_t p, uint32_t n, int level)
+{
+    volatile uint32_t *exticr = sim_reg((uint32_t)(uintptr_t)&SYSCFG->EXTICR[n >> 2]);
+    volatile uint32_t *imr = sim_reg((uint32_t)(uintptr_t)&EXTI_D1->IMR1);
+    volatile uint32_t *pr = sim_reg((uint32_t)(uintptr_t)&EXTI_D1->PR1);
+    uint32_t trig = *sim_reg((uint32_t)(uintptr_t)(level ? &EXTI->RTSR1 : &EXTI->FTSR1));
+
+    if (((*exticr >> (4u * (n & 3u))) & 0xFu) != p)
+        return;
+    if ((trig & *imr) & (1u << n))
+        *pr |= 1u << n;
+}
+
+void sim_gpio_update(void)
+{
+    static int busy;
+
+    if (busy)
+        return;
+    busy = 1;
+
+    for (uint32_t round = 0; round < 4u; round++)
+    {
+        uint16_t lv[SIM_PORTS];
+        int changed = 0;
+
+        for (uint32_t i = 0; i < sim_wire_count; i++)
+        {
+            uint32_t t = sim_wires[i].to;
+            int v = (sim_port_levels(sim_wires[i].from) & sim_wires[i].from_pin) != 0;
+
+            sim_ext_mask[t] |= sim_wires[i].to_pin;
+            sim_ext_level[t] = (uint16_t)(v ? (sim_ext_level[t] | sim_wires[i].to_pin)
+                                            : (sim_ext_level[t] & ~sim_wires[i].to_pin));
+        }
+
+        for (uint32_t p = 0; p < SIM_PORTS; p++)
+            lv[p] = sim_port_levels(p);
+
+        for (uint32_t p = 0; p < SIM_PORTS; p++)
+        {
+            uint16_t diff = lv[p] ^ sim_level[p];
+
+            if (!diff)
+                continue;
+            changed = 1;
+            sim_level[p] = lv[p];
+
+            for (uint32_t n = 0; n < 16u; n++)
+            {
+                int level = (lv[p] >> n) & 1u;
+
+                if (!(diff & (1u << n)))
+                    continue;
+                sim_exti_edge(p, n, level);
+                for (uint32_t i = 0; i < sim_watch_count; i++)
+                    if (sim_watch[i].port == p && sim_watch[i].pin == (1u << n))
+                        sim_watch[i].edge(sim_watch[i].ctx, level);
+            }
+        }
+
+        if (!changed)
+            break;
+    }
+
+    busy = 0;
+}
+
+int sim_gpio_level(GPIO_TypeDef *port, uint16_t pin)
+{
+    return (sim_port_levels(sim_port_index(port)) & pin) != 0;
+}
+
+void sim_gpio_drive(GPIO_TypeDef *port, uint16_t pin, int level)
+{
+    uint32_t p = sim_port_index(port);
+
+    if (level < 0)
+        sim_ext_mask[p] &= (uint16_t)~pin;
+    else
+    {
+        sim_ext_mask[p] |= pin;
+        sim_ext_level[p] = (uint16_t)(level ? (sim_ext_level[p] | pin) : (sim_ext_level[p] & ~pin));
+    }
+    sim_gpio_update();
+}
+
+void sim_gpio_wire(GPIO_TypeDef *from, uint16_t from_pin, GPIO_TypeDef *to, uint16_t to_pin)
+{
+    sim_wires[sim_wire_count++] = (typeof(sim_wires[0])){ sim_port_index(from), sim_port_index(to), from_pin, to_pin };
+    sim_gpio_update();
+}
+
+void sim_gpio_af_driver(GPIO_TypeDef *port, uint16_t pin, uint32_t af, int (*level)(void *ctx), void *ctx)
+{
+    sim_af[sim_af_count++] = (SIM_AfDriver){ sim_port_index(port), pin, af, level, ctx };
+}
+
+void sim_gpio_watch(GPIO_TypeDef *port, uint16_t pin, void (*edge)(void *ctx, int level), void *ctx)
+{
+    sim_watch[sim_watch_count].port = sim_port_index(port);
+    sim_watch[sim_watch_count].pin = pin;
+    sim_watch[sim_watch_count].edge = edge;
+    sim_watch[sim_watch_count].ctx = ctx;
+    sim_watch_count++;
+}
+
+/* Registers */
+
+static uint32_t sim_gpio_read(void *ctx, uint32_t addr, uint32_t size)
+{
+    uint32_t p = (addr - GPIOA_BASE) / 0x400u;
+    uint32_t off = (addr - GPIOA_BASE) % 0x400u;
+    volatile uint32_t *r = sim_reg(addr & ~3u);
+
+    (void)ctx;
+    if (off == offsetof(GPIO_TypeDef, IDR))
+        return sim_port_levels(p);
+    if (off == offsetof(GPIO_TypeDef, BSRR))
+        return 0;
+    return size == 4u ? *r : (*r >> (8u * (addr & 3u))) & ((1u << (8u * size)) - 1u);
+}
+
+static void sim_gpio_write(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    uint32_t p = (addr - GPIOA_BASE) / 0x400u;
+    uint32_t off = (addr - GPIOA_BASE) % 0x400u;
+    GPIO_TypeDef *g = sim_port(p);
+
+    (void)ctx;
+    (void)old;
+    if ((off & ~3u) == offsetof(GPIO_TypeDef, BSRR))
+    {
+        uint32_t v = *sim_reg(addr & ~3u);   // half-word writes land in the upper/lower half
+
+        (void)size;
+        g->ODR = (g->ODR & ~(v >> 16)) | (v & 0xFFFFu);
+        g->BSRR = 0;
+    }
+    else if (off == offsetof(GPIO_TypeDef, IDR))
+        g->IDR = 0;
+
+    sim_gpio_update();
+}
+
+/* EXTI_D1 pending register: write 1 to clear */
+static void sim_exti_write(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    (void)ctx;
+    (void)size;
+    if (addr == (uint32_t)(uintptr_t)&EXTI_D1->PR1)
+        *sim_reg(addr) = old & ~val;
+}
+
+static int sim_exti_line(void *ctx)
+{
+    uint32_t mask = (uint32_t)(uintptr_t)ctx;
+
+    return (*sim_reg((uint32_t)(uintptr_t)&EXTI_D1->PR1) & *sim_reg((uint32_t)(uintptr_t)&EXTI_D1->IMR1) & mask) != 0;
+}
+
+void sim_gpio_init(void)
+{
+    memset(sim_ext_mask, 0, sizeof(sim_ext_mask));
+    sim_af_count = sim_watch_count = sim_wire_count = 0;
+
+    sim_trap(GPIOA_BASE, 0x400u * SIM_PORTS, sim_gpio_read, sim_gpio_write, 0);
+    sim_trap(EXTI_BASE, 0x100u, 0, sim_exti_write, 0);
+    sim_trap(SYSCFG_BASE, 0x100u, 0, 0, 0);
+
+    sim_irq_source(EXTI0_IRQn, sim_exti_line, (void *)(uintptr_t)0x0001u);
+    sim_irq_source(EXTI1_IRQn, sim_exti_line, (void *)(uintptr_t)0x0002u);
+    sim_irq_source(EXTI2_IRQn, sim_exti_line, (void *)(uintptr_t)0x0004u);
+    sim_irq_source(EXTI3_IRQn, sim_exti_line, (void *)(uintptr_t)0x0008u);
+    sim_irq_source(EXTI4_IRQn, sim_exti_line, (void *)(uintptr_t)0x0010u);
+    sim_irq_source(EXTI9_5_IRQn, sim_exti_line, (void *)(uintptr_t)0x03E0u);
+    sim_irq_source(EXTI15_10_IRQn, sim_exti_line, (void *)(uintptr_t)0xFC00u);
+
+    for (uint32_t p = 0; p < SIM_PORTS; p++)
+        sim_level[p] = sim_port_levels(p);
+}
@@ -0,0 +1,72 @@
+/**
+  ******************************************************************************
+  * @file           : sim_hal.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * HAL pieces replaced on the host: the tick comes from the virtual clock and
+  * the RCC reports the clock tree of SystemClock_Config() (480 MHz CPU, APB1
+  * at 120 MHz, SPI123 kernel clock 192 MHz) without touching any register.
+*/
+
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+uint32_t SystemCoreClock = SIM_CPU_HZ;
+uint32_t SystemD2Clock = SIM_CPU_HZ / 2u;
+
+
+void sim_hal_init(void)
+{
+    /* APB1 divided by 2: the TIM12 clock is twice PCLK1 */
+    MODIFY_REG(RCC->D2CFGR, RCC_D2CFGR_D2PPRE1, RCC_APB1_DIV2);
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return sim_tick();
+}
+
+void HAL_IncTick(void)
+{
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+    uint32_t start = HAL_GetTick();
+
+    while (HAL_GetTick() - start < Delay + 1u)
+        __WFI();
+}
+
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig(RCC_PeriphCLKInitTypeDef *PeriphClkInit)
+{
+    (void)PeriphClkInit;
+    return HAL_OK;
+}
+
+uint32_t HAL_RCCEx_GetPeriphCLKFreq(uint64_t PeriphClk)
+{
+    return (PeriphClk == RCC_PERIPHCLK_SPI123) ? SIM_SPI_KER_HZ : 0u;
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void)
+{
+    return SIM_CPU_HZ / 2u;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+    return SIM_PCLK1_HZ;
+}
+
+uint32_t HAL_RCC_GetSysClockFreq(void)
+{
+    return SIM_CPU_HZ;
+}
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "Error_Handler() at %.1f us\n", sim_us(sim_now()));
+    exit(2);
+}
@@ -0,0 +1,175 @@
+/**
+  ******************************************************************************
+  * @file           : sim_nor.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * SPI NOR flash model (see sim_nor.h). Bytes are programmed by AND with the
+  * array, as on the parts: only an erase brings bits back to 1.
+*/
+
+#include "sim_nor.h"
+#include <string.h>
+
+#define SIM_NOR_WREN        0x06u
+#define SIM_NOR_RDSR        0x05u
+#define SIM_NOR_RDID        0x9Fu
+#define SIM_NOR_FAST_READ   0x0Bu
+#define SIM_NOR_PP          0x02u
+#define SIM_NOR_SE          0x20u
+
+#define SIM_NOR_SR_WIP      0x01u
+#define SIM_NOR_SR_WEL      0x02u
+
+/* Frames of opcode and address: data starts after them (plus one dummy byte for FAST_READ) */
+#define SIM_NOR_HDR         4u
+
+static uint32_t sim_nor_log2(uint32_t v)
+{
+    uint32_t n = 0;
+
+    while (v > 1u)
+    {
+        v >>= 1;
+        n++;
+    }
+    return n;
+}
+
+/* Start a program or erase: WIP for t cycles */
+static void sim_nor_busy(SIM_Nor *nor, uint64_t t)
+{
+    nor->busy_until = sim_now() + t;
+    nor->busy += t;
+    nor->wel = 0;
+}
+
+static void sim_nor_cs(void *ctx, int selected)
+{
+    SIM_Nor *nor = ctx;
+    uint32_t page;
+
+    if (selected)
+    {
+        nor->index = 0;
+        nor->op = 0;
+        nor->addr = 0;
+        memset(nor->prog_set, 0, sizeof(nor->prog_set));
+        return;
+    }
+
+    /* Program and erase run from CS release, once the whole command is in */
+    if (nor->index < SIM_NOR_HDR || sim_nor_wip(nor))
+        return;
+
+    if (nor->op == SIM_NOR_PP)
+    {
+        if (!nor->wel)
+        {
+            nor->violations++;
+            return;
+        }
+        page = nor->addr & (nor->size - 1u) & ~0xFFu;
+        for (uint32_t i = 0; i < 256u; i++)
+            if (nor->prog_set[i])
+                nor->mem[page + i] &= nor->prog[i];
+        nor->programs++;
+        sim_nor_busy(nor, SIM_NOR_T_PP);
+    }
+    else if (nor->op == SIM_NOR_SE)
+    {
+        if (!nor->wel)
+        {
+            nor->violations++;
+            return;
+        }
+        memset(&nor->mem[nor->addr & (nor->size - 1u) & ~0xFFFu], 0xFF, 4096u);
+        nor->erases++;
+        sim_nor_busy(nor, SIM_NOR_T_SE);
+    }
+}
+
+static uint32_t sim_nor_xfer(void *ctx, uint32_t mosi, uint32_t bits)
+{
+    SIM_Nor *nor = ctx;
+    uint32_t i = nor->index++;
+    uint8_t sr;
+
+    (void)bits;
+    if (i == 0)
+    {
+        nor->op = (uint8_t)mosi;
+
+        /* Busy: only the status register answers */
+        if (sim_nor_wip(nor) && nor->op != SIM_NOR_RDSR)
+        {
+            nor->violations++;
+            nor->op = 0;
+            return 0xFFu;
+        }
+
+        if (nor->op == SIM_NOR_WREN)
+            nor->wel = 1;
+        else if (nor->op == SIM_NOR_RDSR)
+            nor->status_reads++;
+        else if (nor->op == SIM_NOR_FAST_READ)
+            nor->reads++;
+        else if (nor->op != SIM_NOR_RDID && nor->op != SIM_NOR_PP && nor->op != SIM_NOR_SE)
+        {
+            nor->violations++;
+            nor->op = 0;
+        }
+        return 0xFFu;
+    }
+
+    switch (nor->op)
+    {
+    case SIM_NOR_RDSR:
+        sr = (uint8_t)((sim_nor_wip(nor) ? SIM_NOR_SR_WIP : 0u) | (nor->wel ? SIM_NOR_SR_WEL : 0u));
+        return sr;
+
+    case SIM_NOR_RDID:
+        return (i <= 3u) ? (uint8_t)(nor->jedec >> (8u * (3u - i))) : 0xFFu;
+
+    case SIM_NOR_FAST_READ:
+    case SIM_NOR_PP:
+    case SIM_NOR_SE:
+        if (i < SIM_NOR_HDR)
+        {
+            nor->addr = (nor->addr << 8) | (uint8_t)mosi;
+            return 0xFFu;
+        }
+        if (nor->op == SIM_NOR_FAST_READ)
+        {
+            if (i == SIM_NOR_HDR)
+                return 0xFFu;          // dummy byte
+            return nor->mem[nor->addr++ & (nor->size - 1u)];
+        }
+        if (nor->op == SIM_NOR_PP)
+        {
+            /* Past the end of the page the address wraps to its start */
+            uint32_t off = (nor->addr + i - SIM_NOR_HDR) & 0xFFu;
+
+            nor->prog[off] = (uint8_t)mosi;
+            nor->prog_set[off] = 1;
+        }
+        return 0xFFu;
+
+    default:
+        return 0xFFu;
+    }
+}
+
+void sim_nor_init(SIM_Nor *nor, GPIO_TypeDef *cs_port, uint16_t cs_pin, uint8_t *mem, uint32_t size)
+{
+    memset(nor, 0, sizeof(*nor));
+    nor->mem = mem;
+    nor->size = size;
+    nor->jedec = 0xEF4000u | sim_nor_log2(size);       // Winbond W25Q, capacity code 2^n
+    memset(mem, 0xFF, size);
+
+    nor->peer.cs_port = cs_port;
+    nor->peer.cs_pin = cs_pin;
+    nor->peer.xfer = sim_nor_xfer;
+    nor->peer.cs = sim_nor_cs;
+    nor->peer.ctx = nor;
+}
@@ -0,0 +1,63 @@
+/**
+  ******************************************************************************
+  * @file           : sim_nor.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * SPI NOR flash on a simulated bus (SIM_SpiPeer): RDID, RDSR, WREN, FAST_READ,
+  * page program and 4 KB sector erase with 3-byte addresses. Program and erase
+  * start on CS release and keep WIP set for their typical time; any command but
+  * RDSR while WIP is set, and program / erase without WREN, are ignored as on
+  * the parts and counted as violations.
+*/
+
+#ifndef HOST_SIM_NOR_H_
+#define HOST_SIM_NOR_H_
+
+#include "sim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Typical page program and sector erase times (cycles), W25Q-class parts */
+#ifndef SIM_NOR_T_PP
+#define SIM_NOR_T_PP        (SIM_CPU_HZ / 1000000u * 700u)
+#endif
+#ifndef SIM_NOR_T_SE
+#define SIM_NOR_T_SE        (SIM_CPU_HZ / 1000u * 45u)
+#endif
+
+typedef struct {
+    SIM_SpiPeer peer;
+    uint8_t *mem;                      // array contents, owned by the caller
+    uint32_t size;
+    uint32_t jedec;                    // manufacturer, type, capacity
+
+    /* Command in progress */
+    uint8_t op;
+    uint32_t index;                    // frames since CS low
+    uint32_t addr;
+    uint8_t prog[256];                 // page program data latch
+    uint8_t prog_set[256];
+    uint8_t wel;
+    uint64_t busy_until;               // WIP while now < busy_until
+
+    /* Statistics */
+    uint32_t reads;                    // FAST_READ commands
+    uint32_t programs;
+    uint32_t erases;
+    uint32_t status_reads;
+    uint32_t violations;
+    uint64_t busy;                     // cycles with WIP set
+} SIM_Nor;
+
+/* mem: size bytes, size a power of two (1 MB and up) */
+void sim_nor_init(SIM_Nor *nor, GPIO_TypeDef *cs_port, uint16_t cs_pin, uint8_t *mem, uint32_t size);
+
+static inline int sim_nor_wip(const SIM_Nor *nor) { return sim_now() < nor->busy_until; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SIM_NOR_H_ */
@@ -0,0 +1,574 @@
+/**
+  ******************************************************************************
+  * @file           : sim_spi.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * SPI1/2/3 (SPI v2 of the H7): 16-byte TX and RX FIFOs counted in frames, the
+  * SR flags derived from the FIFO levels and FTHLV, TSIZE/EOT/TXTF, suspend,
+  * DMA requests and the IRQ line. A master clocks one frame per event, its
+  * duration taken from the prescaler (SCK = 192 MHz kernel clock / 2^(MBR+1)),
+  * with MSSI before the first frame and MIDI between frames; a full-duplex or
+  * TX-only master waits for TX data (no underrun), an RX-only one clocks on
+  * and overruns a full RX FIFO. Hardware NSS output follows SSOE/SSOM/SSIOP.
+  * Not modelled: the CRC unit (CRCEN transfers send no CRC and raise CRCE
+  * only when injected by sim_spi_crc_error()), TI mode, half-duplex direction
+  * changes and MODF.
+*/
+
+#include "sim.h"
+#include <string.h>
+
+#define SIM_SPI_COUNT       3u
+#define SIM_SPI_FIFO        16u        // bytes
+#define SIM_SPI_START       10u        // CPU cycles from CSTART to the first SCK edge (kernel clocks)
+
+#define SIM_SPI_LATCHED     (SPI_SR_EOT | SPI_SR_TXTF | SPI_SR_UDR | SPI_SR_OVR | SPI_SR_CRCE | \
+                             SPI_SR_TIFRE | SPI_SR_MODF | SPI_SR_SUSP)
+
+typedef struct SIM_Spi {
+    uint32_t base;
+    IRQn_Type irqn;
+    uint32_t req_rx, req_tx;
+    GPIO_TypeDef *nss_port;
+    uint16_t nss_pin;
+    uint32_t nss_af;
+
+    uint32_t tx[SIM_SPI_FIFO], rx[SIM_SPI_FIFO];
+    uint32_t tx_head, tx_n, rx_head, rx_n;
+    uint32_t flags;                    // latched SR flags
+    int running;                       // master: transfer started (CSTART)
+    int susp_req;
+    int in_flight;
+    uint32_t mosi;                     // frame in flight
+    uint32_t frames_started;
+    uint64_t last_end;
+    uint32_t ctsize;
+    uint32_t tx_loaded;
+    int nss_active;
+    uint32_t crc_fail;                 // CRCEN transfers to go before an injected CRCE (0: none)
+
+    SIM_SpiPeer *peers;
+    struct SIM_Spi *slave;
+    SIM_SpiStats stats;
+} SIM_Spi;
+
+static SIM_Spi sim_spi[SIM_SPI_COUNT];
+
+static SPI_TypeDef *sim_spi_regs(const SIM_Spi *s)
+{
+    return (SPI_TypeDef *)(uintptr_t)sim_reg(s->base);
+}
+
+static SIM_Spi *sim_spi_of(SPI_TypeDef *spi)
+{
+    for (uint32_t i = 0; i < SIM_SPI_COUNT; i++)
+        if (sim_spi[i].base == (uint32_t)(uintptr_t)spi)
+            return &sim_spi[i];
+    return 0;
+}
+
+static uint32_t sim_spi_bits(const SIM_Spi *s)
+{
+    return ((sim_spi_regs(s)->CFG1 & SPI_CFG1_DSIZE) >> SPI_CFG1_DSIZE_Pos) + 1u;
+}
+
+static uint32_t sim_spi_frame_bytes(const SIM_Spi *s)
+{
+    uint32_t bits = sim_spi_bits(s);
+
+    return bits <= 8u ? 1u : bits <= 16u ? 2u : 4u;
+}
+
+static uint32_t sim_spi_mask(uint32_t bits)
+{
+    return bits >= 32u ? 0xFFFFFFFFu : (1u << bits) - 1u;
+}
+
+static uint32_t sim_spi_capacity(const SIM_Spi *s)
+{
+    return SIM_SPI_FIFO / sim_spi_frame_bytes(s);
+}
+
+static uint32_t sim_spi_packet(const SIM_Spi *s)
+{
+    return ((sim_spi_regs(s)->CFG1 & SPI_CFG1_FTHLV) >> SPI_CFG1_FTHLV_Pos) + 1u;
+}
+
+static uint32_t sim_spi_comm(const SIM_Spi *s)
+{
+    return (sim_spi_regs(s)->CFG2 & SPI_CFG2_COMM) >> SPI_CFG2_COMM_Pos;
+}
+
+static int sim_spi_master(const SIM_Spi *s)
+{
+    return (sim_spi_regs(s)->CFG2 & SPI_CFG2_MASTER) != 0u;
+}
+
+static int sim_spi_enabled(const SIM_Spi *s)
+{
+    return (sim_spi_regs(s)->CR1 & SPI_CR1_SPE) != 0u;
+}
+
+uint32_t sim_spi_sck(SPI_TypeDef *spi)
+{
+    SIM_Spi *s = sim_spi_of(spi);
+    uint32_t presc = 2u << ((sim_spi_regs(s)->CFG1 & SPI_CFG1_MBR) >> SPI_CFG1_MBR_Pos);
+
+    return (uint32_t)(((uint64_t)presc * SIM_CPU_HZ) / SIM_SPI_KER_HZ);
+}
+
+SIM_SpiStats *sim_spi_stats(SPI_TypeDef *spi)
+{
+    return &sim_spi_of(spi)->stats;
+}
+
+/* FIFOs */
+
+static int sim_spi_push(uint32_t *fifo, uint32_t *head, uint32_t *n, uint32_t cap, uint32_t v)
+{
+    if (*n >= cap)
+        return 0;
+    fifo[(*head + *n) % SIM_SPI_FIFO] = v;
+    (*n)++;
+    return 1;
+}
+
+static uint32_t sim_spi_pop(uint32_t *fifo, uint32_t *head, uint32_t *n)
+{
+    uint32_t v;
+
+    if (*n == 0)
+        return 0;
+    v = fifo[*head];
+    *head = (*head + 1u) % SIM_SPI_FIFO;
+    (*n)--;
+    return v;
+}
+
+static void sim_spi_flush(SIM_Spi *s)
+{
+    s->tx_head = s->tx_n = s->rx_head = s->rx_n = 0;
+}
+
+/* Status */
+
+static uint32_t sim_spi_sr(const SIM_Spi *s)
+{
+    SPI_TypeDef *r = sim_spi_regs(s);
+    uint32_t sr = s->flags;
+    uint32_t tsize = r->CR2 & SPI_CR2_TSIZE;
+    uint32_t rx_bytes = s->rx_n * sim_spi_frame_bytes(s);
+
+    if (sim_spi_enabled(s))
+    {
+        if (sim_spi_capacity(s) - s->tx_n >= sim_spi_packet(s) && !(tsize && (s->flags & SPI_SR_TXTF)))
+            sr |= SPI_SR_TXP;
+        if (s->rx_n >= sim_spi_packet(s))
+            sr |= SPI_SR_RXP;
+    }
+    if ((sr & SPI_SR_TXP) && (sr & SPI_SR_RXP))
+        sr |= SPI_SR_DXP;
+    if (rx_bytes >= 4u)
+        sr |= SPI_SR_RXWNE;
+    else
+        sr |= (s->rx_n << SPI_SR_RXPLVL_Pos) & SPI_SR_RXPLVL;
+    if (s->tx_n == 0 && !s->in_flight)
+        sr |= SPI_SR_TXC;
+    sr |= (s->ctsize << SPI_SR_CTSIZE_Pos) & SPI_SR_CTSIZE;
+
+    return sr;
+}
+
+static int sim_spi_line(void *ctx)
+{
+    const SIM_Spi *s = ctx;
+
+    return (sim_spi_sr(s) & sim_spi_regs(s)->IER & 0x7FFu) != 0u;
+}
+
+uint32_t sim_spi_dma_request(uint32_t req)
+{
+    for (uint32_t i = 0; i < SIM_SPI_COUNT; i++)
+    {
+        SIM_Spi *s = &sim_spi[i];
+        uint32_t cfg1 = sim_spi_regs(s)->CFG1;
+
+        if (req == s->req_rx)
+            return (cfg1 & SPI_CFG1_RXDMAEN) && (sim_spi_sr(s) & SPI_SR_RXP);
+        if (req == s->req_tx)
+            return (cfg1 & SPI_CFG1_TXDMAEN) && (sim_spi_sr(s) & SPI_SR_TXP);
+    }
+    return 0;
+}
+
+/* Hardware NSS output */
+
+static int sim_spi_nss_level(void *ctx)
+{
+    const SIM_Spi *s = ctx;
+    uint32_t cfg2 = sim_spi_regs(s)->CFG2;
+    int active_high = (cfg2 & SPI_CFG2_SSIOP) != 0u;
+
+    if (!sim_spi_master(s) || !(cfg2 & SPI_CFG2_SSOE))
+        return -1;
+    if (!sim_spi_enabled(s) && !(cfg2 & SPI_CFG2_AFCNTR))
+        return -1;
+    return s->nss_active ? active_high : !active_high;
+}
+
+static void sim_spi_nss(SIM_Spi *s, int active)
+{
+    if (s->nss_active == active)
+        return;
+    s->nss_active = active;
+    sim_gpio_update();
+}
+
+/* Slave selected: software SSI or the NSS input pin */
+static int sim_spi_selected(const SIM_Spi *s)
+{
+    SPI_TypeDef *r = sim_spi_regs(s);
+    int active_high = (r->CFG2 & SPI_CFG2_SSIOP) != 0u;
+
+    if (r->CFG2 & SPI_CFG2_SSM)
+        return ((r->CR1 & SPI_CR1_SSI) != 0u) == active_high;
+    return sim_gpio_level(s->nss_port, s->nss_pin) == active_high;
+}
+
+/* Frames */
+
+static uint32_t sim_spi_exchange(SIM_Spi *s, uint32_t mosi, uint32_t bits)
+{
+    uint32_t miso = sim_spi_mask(bits);
+
+    for (SIM_SpiPeer *p = s->peers; p; p = p->next)
+        if (!sim_gpio_level(p->cs_port, p->cs_pin))
+            miso &= p->xfer(p->ctx, mosi, bits);
+
+    if (s->slave)
+        miso &= sim_spi_slave_frame((SPI_TypeDef *)(uintptr_t)s->slave->base, mosi, bits);
+
+    s->stats.frames++;
+    s->stats.bits += bits;
+    return miso & sim_spi_mask(bits);
+}
+
+static void sim_spi_rx(SIM_Spi *s, uint32_t v)
+{
+    if (!sim_spi_push(s->rx, &s->rx_head, &s->rx_n, sim_spi_capacity(s), v))
+    {
+        s->flags |= SPI_SR_OVR;
+        s->stats.ovr++;
+    }
+}
+
+static void sim_spi_end_of_transfer(SIM_Spi *s)
+{
+    if ((sim_spi_regs(s)->CFG1 & SPI_CFG1_CRCEN) && s->crc_fail && --s->crc_fail == 0)
+        s->flags |= SPI_SR_CRCE;
+
+    s->flags |= SPI_SR_EOT;
+    s->running = 0;
+    sim_spi_regs(s)->CR1 &= ~SPI_CR1_CSTART;
+}
+
+static void sim_spi_suspend(SIM_Spi *s)
+{
+    s->susp_req = 0;
+    s->running = 0;
+    s->flags |= SPI_SR_SUSP;
+    sim_spi_regs(s)->CR1 &= ~SPI_CR1_CSTART;
+}
+
+static void sim_spi_frame_end(void *ctx)
+{
+    SIM_Spi *s = ctx;
+    SPI_TypeDef *r = sim_spi_regs(s);
+    uint32_t bits = sim_spi_bits(s);
+    uint32_t comm = sim_spi_comm(s);
+    uint32_t miso;
+
+    s->in_flight = 0;
+    s->last_end = sim_now();
+    miso = sim_spi_exchange(s, s->mosi, bits);
+
+    if (comm != 1u)                    // not TX-only
+        sim_spi_rx(s, miso);
+
+    if (r->CR2 & SPI_CR2_TSIZE)
+    {
+        if (s->ctsize)
+            s->ctsize--;
+        if (s->ctsize == 0)
+        {
+            sim_spi_end_of_transfer(s);
+            sim_spi_nss(s, 0);
+            return;
+        }
+    }
+
+    if (s->susp_req)
+        sim_spi_suspend(s);
+    else if ((r->CFG2 & SPI_CFG2_SSOM) && (r->CFG2 & SPI_CFG2_MIDI))
+        sim_spi_nss(s, 0);
+}
+
+/* Master: start the next frame if it can go */
+static int sim_spi_kick(SIM_Spi *s)
+{
+    SPI_TypeDef *r = sim_spi_regs(s);
+    uint32_t comm, bits, sck;
+    uint64_t start;
+
+    if (!s->running || s->in_flight)
+        return 0;
+    if (s->susp_req)
+    {
+        sim_spi_suspend(s);
+        return 1;
+    }
+    if ((r->CR2 & SPI_CR2_TSIZE) && s->ctsize == 0)
+        return 0;
+
+    comm = sim_spi_comm(s);
+    if (comm != 2u && s->tx_n == 0)    // waits for TX data, except RX-only
+        return 0;
+    if (comm == 2u && (r->CR1 & SPI_CR1_MASRX) && s->rx_n >= sim_spi_capacity(s))
+    {
+        sim_spi_suspend(s);
+        return 1;
+    }
+
+    bits = sim_spi_bits(s);
+    sck = sim_spi_sck((SPI_TypeDef *)(uintptr_t)s->base);
+    s->mosi = comm == 2u ? sim_spi_mask(bits) : sim_spi_pop(s->tx, &s->tx_head, &s->tx_n);
+
+    if (s->frames_started == 0)
+        start = sim_now() + SIM_SPI_START + ((r->CFG2 & SPI_CFG2_MSSI) >> SPI_CFG2_MSSI_Pos) * sck;
+    else
+    {
+        start = s->last_end + ((r->CFG2 & SPI_CFG2_MIDI) >> SPI_CFG2_MIDI_Pos) * sck;
+        if (start < sim_now())
+            start = sim_now();
+    }
+
+    s->frames_started++;
+    s->in_flight = 1;
+    s->stats.wire += (uint64_t)bits * sck;
+    sim_spi_nss(s, 1);
+    sim_at(start + (uint64_t)bits * sck, sim_spi_frame_end, s);
+    return 1;
+}
+
+static int sim_spi_settle(void)
+{
+    int progress = 0;
+
+    for (uint32_t i = 0; i < SIM_SPI_COUNT; i++)
+        progress |= sim_spi_kick(&sim_spi[i]);
+    return progress;
+}
+
+uint32_t sim_spi_slave_frame(SPI_TypeDef *slave, uint32_t mosi, uint32_t bits)
+{
+    SIM_Spi *s = sim_spi_of(slave);
+    SPI_TypeDef *r = sim_spi_regs(s);
+    uint32_t comm = sim_spi_comm(s);
+    uint32_t miso = sim_spi_mask(bits);
+
+    if (!sim_spi_enabled(s) || sim_spi_master(s) || !sim_spi_selected(s))
+        return miso;
+
+    s->stats.frames++;
+    s->stats.bits += bits;
+
+    if (comm != 1u)
+        sim_spi_rx(s, mosi & sim_spi_mask(sim_spi_bits(s)));
+
+    if (comm != 2u)
+    {
+        if (s->tx_n)
+            miso = sim_spi_pop(s->tx, &s->tx_head, &s->tx_n);
+        else
+        {
+            miso = r->UDRDR;
+            s->flags |= SPI_SR_UDR;
+            s->stats.udr++;
+        }
+    }
+
+    if ((r->CR2 & SPI_CR2_TSIZE) && s->ctsize && --s->ctsize == 0)
+        s->flags |= SPI_SR_EOT;
+
+    sim_settle();
+    return miso & sim_spi_mask(bits);
+}
+
+/* Registers */
+
+static uint32_t sim_spi_read(void *ctx, uint32_t addr, uint32_t size)
+{
+    SIM_Spi *s = ctx;
+    uint32_t off = addr - s->base;
+
+    if (off == offsetof(SPI_TypeDef, SR))
+        return sim_spi_sr(s);
+
+    if ((off & ~3u) == offsetof(SPI_TypeDef, RXDR))
+    {
+        uint32_t fb = sim_spi_frame_bytes(s);
+        uint32_t n = size > fb ? size / fb : 1u;
+        uint32_t v = 0;
+
+        for (uint32_t i = 0; i < n && s->rx_n; i++)
+            v |= sim_spi_pop(s->rx, &s->rx_head, &s->rx_n) << (8u * fb * i);
+        return v;
+    }
+
+    if (size == 4u)
+        return *sim_reg(addr);
+    return (*sim_reg(addr & ~3u) >> (8u * (addr & 3u))) & ((1u << (8u * size)) - 1u);
+}
+
+static void sim_spi_write(void *ctx, uint32_t addr, uint32_t old, uint32_t val, uint32_t size)
+{
+    SIM_Spi *s = ctx;
+    SPI_TypeDef *r = sim_spi_regs(s);
+    uint32_t off = addr - s->base;
+
+    if ((off & ~3u) == offsetof(SPI_TypeDef, TXDR))
+    {
+        uint32_t fb = sim_spi_frame_bytes(s);
+        uint32_t n = size > fb ? size / fb : 1u;
+        uint32_t tsize = r->CR2 & SPI_CR2_TSIZE;
+
+        if (!sim_spi_enabled(s))
+            return;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            uint32_t v = (val >> (8u * fb * i)) & sim_spi_mask(sim_spi_bits(s));
+
+            if (!sim_spi_push(s->tx, &s->tx_head, &s->tx_n, sim_spi_capacity(s), v))
+                break;
+            if (tsize && ++s->tx_loaded >= tsize)
+                s->flags |= SPI_SR_TXTF;
+        }
+        return;
+    }
+
+    switch (off)
+    {
+    case offsetof(SPI_TypeDef, CR1):
+    {
+        uint32_t cr1 = r->CR1;
+
+        if ((old & SPI_CR1_SPE) && !(cr1 & SPI_CR1_SPE))
+        {
+            if (s->in_flight)
+                sim_cancel(sim_spi_frame_end, s);
+            sim_spi_flush(s);
+            s->running = s->in_flight = s->susp_req = 0;
+            s->ctsize = 0;
+            cr1 &= ~SPI_CR1_CSTART;
+            s->nss_active = 0;
+            r->CR1 = cr1;
+            sim_gpio_update();
+        }
+        else if (!(old & SPI_CR1_SPE) && (cr1 & SPI_CR1_SPE))
+        {
+            s->ctsize = r->CR2 & SPI_CR2_TSIZE;
+            s->tx_loaded = 0;
+            s->frames_started = 0;
+            sim_gpio_update();
+        }
+
+        if ((cr1 & SPI_CR1_CSUSP) && s->running)
+        {
+            if (s->in_flight)
+                s->susp_req = 1;
+            else
+                sim_spi_suspend(s);
+        }
+        cr1 = r->CR1 & ~SPI_CR1_CSUSP;
+
+        if ((cr1 & SPI_CR1_CSTART) && !(old & SPI_CR1_CSTART) && (cr1 & SPI_CR1_SPE) && sim_spi_master(s) &&
+            !s->running)
+        {
+            s->running = 1;
+            s->ctsize = r->CR2 & SPI_CR2_TSIZE;
+            s->frames_started = 0;
+        }
+        if (!s->running && sim_spi_master(s))
+            cr1 &= ~SPI_CR1_CSTART;
+        r->CR1 = cr1;
+        break;
+    }
+    case offsetof(SPI_TypeDef, CR2):
+        if (!s->running)
+            s->ctsize = r->CR2 & SPI_CR2_TSIZE;
+        s->tx_loaded = 0;
+        s->flags &= ~SPI_SR_TXTF;
+        break;
+    case offsetof(SPI_TypeDef, IFCR):
+        s->flags &= ~(val & SIM_SPI_LATCHED);
+        r->IFCR = 0;
+        break;
+    case offsetof(SPI_TypeDef, SR):
+        r->SR = old;                   // read-only
+        break;
+    default:
+        break;
+    }
+}
+
+static void sim_spi_setup(SIM_Spi *s, SPI_TypeDef *spi, IRQn_Type irqn, uint32_t req_rx, uint32_t req_tx,
+                          GPIO_TypeDef *nss_port, uint16_t nss_pin, uint32_t nss_af)
+{
+    memset(s, 0, sizeof(*s));
+    s->base = (uint32_t)(uintptr_t)spi;
+    s->irqn = irqn;
+    s->req_rx = req_rx;
+    s->req_tx = req_tx;
+    s->nss_port = nss_port;
+    s->nss_pin = nss_pin;
+    s->nss_af = nss_af;
+
+    sim_trap(s->base, 0x400u, sim_spi_read, sim_spi_write, s);
+    sim_irq_source(irqn, sim_spi_line, s);
+    sim_gpio_af_driver(nss_port, nss_pin, nss_af, sim_spi_nss_level, s);
+}
+
+static void sim_spi_peer_cs(void *ctx, int level)
+{
+    SIM_SpiPeer *peer = ctx;
+
+    peer->cs(peer->ctx, !level);
+}
+
+void sim_spi_attach(SPI_TypeDef *spi, SIM_SpiPeer *peer)
+{
+    SIM_Spi *s = sim_spi_of(spi);
+
+    peer->next = s->peers;
+    s->peers = peer;
+    if (peer->cs)
+        sim_gpio_watch(peer->cs_port, peer->cs_pin, sim_spi_peer_cs, peer);
+}
+
+void sim_spi_link(SPI_TypeDef *master, SPI_TypeDef *slave)
+{
+    sim_spi_of(master)->slave = sim_spi_of(slave);
+}
+
+void sim_spi_crc_error(SPI_TypeDef *spi, uint32_t nth)
+{
+    sim_spi_of(spi)->crc_fail = nth;
+}
+
+void sim_spi_init(void)
+{
+    sim_spi_setup(&sim_spi[0], SPI1, SPI1_IRQn, DMA_REQUEST_SPI1_RX, DMA_REQUEST_SPI1_TX, GPIOG, GPIO_PIN_10, GPIO_AF5_SPI1);
+    sim_spi_setup(&sim_spi[1], SPI2, SPI2_IRQn, DMA_REQUEST_SPI2_RX, DMA_REQUEST_SPI2_TX, GPIOB, GPIO_PIN_12, GPIO_AF5_SPI2);
+    sim_spi_setup(&sim_spi[2], SPI3, SPI3_IRQn, DMA_REQUEST_SPI3_RX, DMA_REQUEST_SPI3_TX, GPIOA, GPIO_PIN_15, GPIO_AF6_SPI3);
+    sim_settle_hook(sim_spi_settle);
+}
@@ -0,0 +1,34 @@
+/**
+  ******************************************************************************
+  * @file           : test.h
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * Host tests: checks keep going after a failure, the exit status reports them.
+*/
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define TEST_CHECK(cond) test_check((cond) != 0, #cond, __FILE__, __LINE__)
+
+static inline void test_check(int ok, const char *what, const char *file, int line)
+{
+    if (!ok)
+    {
+        printf("FAIL %s:%d: %s\n", file, line, what);
+        test_failures++;
+    }
+}
+
+/* main() return value */
+static inline int test_done(const char *name)
+{
+    printf("%s: %s (%d failure(s))\n", name, test_failures ? "FAIL" : "ok", test_failures);
+    return test_failures != 0;
+}
+
+#endif /* HOST_TEST_H_ */
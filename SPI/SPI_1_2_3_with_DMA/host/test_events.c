@@ -0,0 +1,224 @@
+/**
+  ******************************************************************************
+  * @file           : test_events.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * Completion callback and event flags of spi_app_*_dma() on SPI3. While a DMA
+  * transfer is in flight the application keeps running (sim_cpu() slices, or
+  * asleep in sim_idle()) and the driver only costs the start and the IRQs; the
+  * same transfer done blocking keeps the CPU busy for the whole wire time. Also
+  * checks the callback (once, HAL_OK, after the data), spi_app_wait() /
+  * spi_app_dma_wait() flag semantics, and that a CRC mismatch repeats a single
+  * transfer but ends a vectored one with an error.
+*/
+
+#include "board.h"
+#include "test.h"
+#include <string.h>
+
+#define EV_LEN              1024u      // bytes per transfer
+#define EV_SLICE            960u       // application work between two completion checks (cycles, 2 us)
+#define EV_FREE_PCT         90u        // share of the transfer left to the application, at least
+#define EV_BUSY_PCT         90u        // share of a blocking transfer spent in the driver, at least
+
+static uint8_t ev_tx[EV_LEN] SPI_APP_DMA_BUFFER;
+static uint8_t ev_rx[EV_LEN] SPI_APP_DMA_BUFFER;
+
+static struct {
+    uint32_t calls;
+    HAL_StatusTypeDef status;
+    uint32_t data_ok;                  // rx complete when the callback ran
+    uint64_t when;
+} ev_cb_log;
+
+static uint32_t ev_selects, ev_frames;  // CS assertions and frames seen by the bus device
+
+/* Bus device: returns MOSI inverted */
+static uint32_t ev_xfer(void *ctx, uint32_t mosi, uint32_t bits)
+{
+    (void)ctx;
+    (void)bits;
+    ev_frames++;
+    return (uint8_t)~mosi;
+}
+
+static void ev_cs(void *ctx, int selected)
+{
+    (void)ctx;
+    if (selected)
+        ev_selects++;
+}
+
+static int ev_rx_ok(void)
+{
+    for (uint32_t i = 0; i < EV_LEN; i++)
+        if (ev_rx[i] != (uint8_t)~ev_tx[i])
+            return 0;
+    return 1;
+}
+
+static void ev_cb(SPI_APP_Device *dev, HAL_StatusTypeDef status, void *ctx)
+{
+    (void)dev;
+    TEST_CHECK(ctx == ev_rx);
+    ev_cb_log.calls++;
+    ev_cb_log.status = status;
+    ev_cb_log.data_ok = ev_rx_ok();
+    ev_cb_log.when = sim_now();
+}
+
+static int ev_done(void *ctx)
+{
+    return (((SPI_APP_Device *)ctx)->events & SPI_APP_EVT_DONE) != 0;
+}
+
+static void ev_prepare(uint32_t seed)
+{
+    for (uint32_t i = 0; i < EV_LEN; i++)
+        ev_tx[i] = (uint8_t)(seed + i * 13u);
+    memset(ev_rx, 0xEE, sizeof(ev_rx));
+    memset(&ev_cb_log, 0, sizeof(ev_cb_log));
+    spi_app_events_clear(&spi3_dev, 0xFFFFFFFFu);
+}
+
+/* Main loop working in slices and checking for the callback in between */
+static void test_overlap(void)
+{
+    uint64_t t0, drv0, app0, t_dma, drv_dma, app_dma, t_blk, drv_blk;
+
+    ev_prepare(1);
+    spi_app_set_callback(&spi3_dev, ev_cb, ev_rx);
+    t0 = sim_now();
+    drv0 = sim_clock.busy - sim_clock.app;
+    app0 = sim_clock.app;
+    TEST_CHECK(spi_app_transfer_dma(&spi3_dev, ev_tx, ev_rx, EV_LEN) == HAL_OK);
+    while (!ev_cb_log.calls)
+        sim_cpu(EV_SLICE);
+    t_dma = ev_cb_log.when - t0;
+    drv_dma = sim_clock.busy - sim_clock.app - drv0;
+    app_dma = sim_clock.app - app0;
+
+    TEST_CHECK(ev_cb_log.calls == 1 && ev_cb_log.status == HAL_OK && ev_cb_log.data_ok);
+    TEST_CHECK(spi3_dev.dma_done && !spi3_dev.dma_err);
+    TEST_CHECK(app_dma * 100u >= t_dma * EV_FREE_PCT);
+    TEST_CHECK(drv_dma * 100u <= t_dma * (100u - EV_FREE_PCT));
+
+    /* No callback once removed; the flags are still set */
+    spi_app_set_callback(&spi3_dev, 0, 0);
+    ev_prepare(2);
+    TEST_CHECK(spi_app_transfer_dma(&spi3_dev, ev_tx, ev_rx, EV_LEN) == HAL_OK);
+    while (!spi3_dev.dma_done)
+        sim_cpu(EV_SLICE);
+    TEST_CHECK(ev_cb_log.calls == 0 && ev_rx_ok());
+    TEST_CHECK(spi_app_wait(&spi3_dev, SPI_APP_EVT_DONE, 0) == SPI_APP_EVT_DONE);
+
+    /* The same transfer blocking: the CPU waits on the wire */
+    ev_prepare(3);
+    t0 = sim_now();
+    drv0 = sim_clock.busy - sim_clock.app;
+    TEST_CHECK(spi_app_transfer(&spi3_dev, ev_tx, ev_rx, EV_LEN, 100) == HAL_OK);
+    t_blk = sim_now() - t0;
+    drv_blk = sim_clock.busy - sim_clock.app - drv0;
+    TEST_CHECK(ev_rx_ok());
+    TEST_CHECK(drv_blk * 100u >= t_blk * EV_BUSY_PCT);
+
+    printf("%u bytes: DMA %.1f us, driver %.1f us (%.1f%%), application %.1f us; "
+           "blocking %.1f us, driver %.1f us (%.1f%%)\n", (unsigned)EV_LEN,
+           sim_us(t_dma), sim_us(drv_dma), 100.0 * drv_dma / t_dma, sim_us(app_dma),
+           sim_us(t_blk), sim_us(drv_blk), 100.0 * drv_blk / t_blk);
+}
+
+/* Main loop asleep until the DONE flag: the transfer time is idle time */
+static void test_sleep(void)
+{
+    uint64_t t0, idle0, busy0, t, idle, busy;
+
+    ev_prepare(4);
+    t0 = sim_now();
+    idle0 = sim_clock.idle;
+    busy0 = sim_clock.busy;
+    TEST_CHECK(spi_app_transfer_dma(&spi3_dev, ev_tx, ev_rx, EV_LEN) == HAL_OK);
+    TEST_CHECK(sim_idle(ev_done, &spi3_dev, SIM_CPU_HZ / 10u));
+    t = sim_now() - t0;
+    idle = sim_clock.idle - idle0;
+    busy = sim_clock.busy - busy0;
+
+    TEST_CHECK(ev_rx_ok());
+    TEST_CHECK(idle * 100u >= t * EV_FREE_PCT);
+
+    /* Only the bits of the mask are returned and cleared */
+    TEST_CHECK(spi_app_wait(&spi3_dev, SPI_APP_EVT_ERROR, 0) == 0);
+    TEST_CHECK(spi_app_wait(&spi3_dev, SPI_APP_EVT_DONE | SPI_APP_EVT_ERROR, 0) == SPI_APP_EVT_DONE);
+    TEST_CHECK(spi_app_wait(&spi3_dev, SPI_APP_EVT_DONE, 0) == 0);
+
+    printf("%u bytes asleep: %.1f us, idle %.1f us, busy %.1f us\n", (unsigned)EV_LEN,
+           sim_us(t), sim_us(idle), sim_us(busy));
+}
+
+/* spi_app_dma_wait(): HAL_OK on completion, HAL_TIMEOUT with nothing in flight */
+static void test_dma_wait(void)
+{
+    ev_prepare(5);
+    TEST_CHECK(spi_app_transfer_dma(&spi3_dev, ev_tx, ev_rx, EV_LEN) == HAL_OK);
+    TEST_CHECK(spi_app_dma_wait(&spi3_dev, 100) == HAL_OK);
+    TEST_CHECK(spi3_dev.dma_done && ev_rx_ok());
+    TEST_CHECK(spi_app_dma_wait(&spi3_dev, 2) == HAL_TIMEOUT);
+}
+
+/* CRC (8-bit, x^8 + x^2 + x + 1) with 2 retries. A mismatch on a single transfer repeats it under
+   a new CS; on segment 1 of a vectored transfer it ends the transfer with the error, without
+   resending segment 0 or starting segment 2 */
+static void test_crc(void)
+{
+    const SPI_APP_Seg seg[3] = {
+        { ev_tx, ev_rx, 4u },
+        { ev_tx + 64u, ev_rx + 64u, 16u },
+        { ev_tx + 128u, ev_rx + 128u, 8u },
+    };
+    uint32_t errors = spi3_dev.crc_errors, failures = spi3_dev.crc_failures;
+
+    TEST_CHECK(spi_app_crc_enable(&spi3_dev, SPI_CRC_LENGTH_DATASIZE, 0x07u, 0, 2) == HAL_OK);
+    spi_app_set_callback(&spi3_dev, ev_cb, ev_rx);
+
+    ev_prepare(6);
+    ev_selects = ev_frames = 0;
+    sim_spi_crc_error(SPI3, 1);
+    TEST_CHECK(spi_app_transfer_dma(&spi3_dev, ev_tx, ev_rx, 16u) == HAL_OK);
+    TEST_CHECK(sim_idle(ev_done, &spi3_dev, SIM_CPU_HZ / 10u));
+    TEST_CHECK(ev_cb_log.calls == 1 && ev_cb_log.status == HAL_OK && !spi3_dev.dma_err);
+    TEST_CHECK(ev_selects == 2u && ev_frames == 32u);
+    TEST_CHECK(spi3_dev.crc_errors == errors + 1u && spi3_dev.crc_failures == failures);
+
+    ev_prepare(7);
+    ev_selects = ev_frames = 0;
+    sim_spi_crc_error(SPI3, 2);
+    TEST_CHECK(spi_app_transfer_vec_dma(&spi3_dev, seg, 3) == HAL_OK);
+    TEST_CHECK(sim_idle(ev_done, &spi3_dev, SIM_CPU_HZ / 10u));
+    TEST_CHECK(ev_cb_log.calls == 1 && ev_cb_log.status == HAL_ERROR);
+    TEST_CHECK(spi3_dev.dma_err && (spi3_dev.dma_hal_error & HAL_SPI_ERROR_CRC));
+    TEST_CHECK(ev_selects == 1u && ev_frames == seg[0].len + seg[1].len);
+    TEST_CHECK(spi3_dev.crc_errors == errors + 2u && spi3_dev.crc_failures == failures + 1u);
+    TEST_CHECK(spi_app_wait(&spi3_dev, SPI_APP_EVT_ERROR, 0) == SPI_APP_EVT_ERROR);
+
+    spi_app_set_callback(&spi3_dev, 0, 0);
+    sim_spi_crc_error(SPI3, 0);
+    TEST_CHECK(spi_app_crc_disable(&spi3_dev) == HAL_OK);
+
+    printf("crc: single transfer repeated once, vectored transfer failed on segment 1 after %lu frames\n",
+           (unsigned long)ev_frames);
+}
+
+int main(void)
+{
+    static SIM_SpiPeer dev = { SPI3_CS_GPIO_Port, SPI3_CS_Pin, ev_xfer, ev_cs, 0, 0 };
+
+    board_init();
+    sim_spi_attach(SPI3, &dev);
+
+    test_overlap();
+    test_sleep();
+    test_dma_wait();
+    test_crc();
+
+    return test_done("test_events");
+}
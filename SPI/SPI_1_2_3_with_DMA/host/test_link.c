@@ -0,0 +1,189 @@
+/**
+  ******************************************************************************
+  * @file           : test_link.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * spi_link over the simulated bus: SPI3 master (spi_link_exchange() on
+  * spi3_dev) and SPI2 as DMA slave (8-bit, hardware NSS on PB12 wired to the
+  * SPI3 CS), both windows kept full. Every MOSI and MISO bit is flipped with
+  * probability ber_ppm / 10^6 on the way; payloads must arrive complete and in
+  * order at each end, and the goodput is reported against the error rate.
+*/
+
+#include "board.h"
+#include "spi_link.h"
+#include "test.h"
+#include <string.h>
+
+#define LINK_EXCHANGES      500u
+
+typedef struct {
+    uint32_t next;                     // number of the next payload expected
+    uint32_t bad;
+} LINK_Check;
+
+static SPI_LINK_Endpoint link_master SPI_APP_DMA_BUFFER;
+static SPI_LINK_Endpoint link_slave SPI_APP_DMA_BUFFER;
+static LINK_Check link_chk[2];         // [0]: received by the master, [1]: by the slave
+static uint32_t link_ber_ppm;
+static uint32_t link_rng = 0x2545F491u;
+static uint64_t link_flips;
+
+static void link_check(SPI_LINK_Endpoint *link, const uint8_t *data, uint8_t len, void *ctx)
+{
+    LINK_Check *chk = ctx;
+    uint32_t n;
+
+    (void)link;
+    memcpy(&n, data, sizeof(n));
+    if (len != SPI_LINK_PAYLOAD || n != chk->next)
+        chk->bad++;
+    chk->next++;
+}
+
+/* Flip each bit of a frame with probability link_ber_ppm / 10^6 (xorshift32) */
+static uint32_t link_noise(uint32_t v, uint32_t bits)
+{
+    for (uint32_t b = 0; b < bits && link_ber_ppm; b++)
+    {
+        link_rng ^= link_rng << 13;
+        link_rng ^= link_rng >> 17;
+        link_rng ^= link_rng << 5;
+        if ((link_rng % 1000000u) < link_ber_ppm)
+        {
+            v ^= 1u << b;
+            link_flips++;
+        }
+    }
+    return v;
+}
+
+/* The wire between the SPI3 master and the SPI2 slave */
+static uint32_t link_wire(void *ctx, uint32_t mosi, uint32_t bits)
+{
+    (void)ctx;
+    return link_noise(sim_spi_slave_frame(SPI2, link_noise(mosi, bits), bits), bits);
+}
+
+static void link_slave_cplt(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+    spi_link_slave_cplt(&link_slave);
+}
+
+static void link_slave_error(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+    spi_link_slave_error(&link_slave);
+}
+
+static const BOARD_SpiHooks link_slave_hooks = { 0, link_slave_cplt, link_slave_error };
+
+/* SPI2: 8-bit slave, NSS input on PB12 */
+static void link_slave_setup(void)
+{
+    GPIO_InitTypeDef gpio = {0};
+
+    board_spi_dma(&hspi2);
+    board_spi_hooks(&hspi2, &link_slave_hooks);
+
+    hspi2.Init.Mode = SPI_MODE_SLAVE;
+    hspi2.Init.DataSize = SPI_DATASIZE_8BIT;
+    hspi2.Init.NSS = SPI_NSS_HARD_INPUT;
+    hspi2.Init.NSSPolarity = SPI_NSS_POLARITY_LOW;
+    TEST_CHECK(HAL_SPI_Init(&hspi2) == HAL_OK);
+
+    gpio.Pin = SPI2_CS_Pin;
+    gpio.Mode = GPIO_MODE_AF_PP;
+    gpio.Pull = GPIO_PULLUP;
+    gpio.Speed = GPIO_SPEED_FREQ_HIGH;
+    gpio.Alternate = GPIO_AF5_SPI2;
+    HAL_GPIO_Init(SPI2_CS_GPIO_Port, &gpio);
+    sim_gpio_wire(SPI3_CS_GPIO_Port, SPI3_CS_Pin, SPI2_CS_GPIO_Port, SPI2_CS_Pin);
+}
+
+/* Keep the window of an endpoint full: payload n carries n in its first bytes */
+static void link_fill(SPI_LINK_Endpoint *link, uint32_t *sent)
+{
+    uint8_t msg[SPI_LINK_PAYLOAD];
+
+    memset(msg, 0x5A, sizeof(msg));
+    for (;;)
+    {
+        memcpy(msg, sent, sizeof(*sent));
+        if (spi_link_send(link, msg, SPI_LINK_PAYLOAD) != HAL_OK)
+            break;
+        (*sent)++;
+    }
+}
+
+static void link_run(uint32_t ber_ppm)
+{
+    uint32_t sent[2] = { 0, 0 };
+    uint32_t goodput, fails = 0;
+    uint64_t t0, bytes;
+
+    link_ber_ppm = ber_ppm;
+    link_flips = 0;
+    memset(link_chk, 0, sizeof(link_chk));
+    spi_link_init(&link_master, link_check, &link_chk[0]);
+    spi_link_init(&link_slave, link_check, &link_chk[1]);
+
+    (void)HAL_SPI_Abort(&hspi2);
+    TEST_CHECK(spi_link_slave_arm(&link_slave, &hspi2) == HAL_OK);
+
+    t0 = sim_now();
+    for (uint32_t x = 0; x < LINK_EXCHANGES; x++)
+    {
+        link_fill(&link_master, &sent[0]);
+        link_fill(&link_slave, &sent[1]);
+        if (spi_link_exchange(&link_master, &spi3_dev) != HAL_OK)
+            fails++;
+    }
+
+    /* Delivered, in order, nothing repeated */
+    TEST_CHECK(link_chk[0].bad == 0 && link_chk[1].bad == 0);
+    TEST_CHECK(link_chk[0].next == link_master.delivered && link_chk[1].next == link_slave.delivered);
+    TEST_CHECK(link_chk[0].next <= sent[1] && link_chk[1].next <= sent[0]);
+    TEST_CHECK(fails == 0);
+
+    /* Payload bytes delivered per 1000 slot bytes moved, both directions */
+    bytes = (uint64_t)(link_master.delivered + link_slave.delivered) * SPI_LINK_PAYLOAD;
+    goodput = (uint32_t)(bytes * 1000u / ((uint64_t)LINK_EXCHANGES * 2u * SPI_LINK_SLOT));
+
+    if (ber_ppm == 0)
+    {
+        TEST_CHECK(link_master.crc_errors == 0 && link_slave.crc_errors == 0);
+        TEST_CHECK(link_master.retransmits == 0 && link_slave.retransmits == 0);
+        TEST_CHECK(goodput >= (SPI_LINK_PAYLOAD * 1000u / SPI_LINK_SLOT) - 5u);
+    }
+    else
+        TEST_CHECK(link_master.crc_errors + link_slave.crc_errors > 0 && goodput > 0);
+
+    printf("%7lu %9llu %9lu %9lu %9lu %9lu %9lu %8lu %9.1f\n", (unsigned long)ber_ppm,
+           (unsigned long long)link_flips, (unsigned long)link_master.delivered,
+           (unsigned long)link_slave.delivered, (unsigned long)(link_master.crc_errors + link_slave.crc_errors),
+           (unsigned long)(link_master.retransmits + link_slave.retransmits),
+           (unsigned long)(link_master.duplicates + link_slave.duplicates), (unsigned long)goodput,
+           sim_rate(bytes, sim_now() - t0) / 1000.0);
+}
+
+int main(void)
+{
+    static SIM_SpiPeer wire = { SPI3_CS_GPIO_Port, SPI3_CS_Pin, link_wire, 0, 0, 0 };
+    static const uint32_t ber[] = { 0u, 100u, 1000u, 3000u };
+
+    board_init();
+    link_slave_setup();
+    sim_spi_attach(SPI3, &wire);
+
+    printf("%lu exchanges of %u-byte slots per row, SPI3 master -> SPI2 slave\n",
+           (unsigned long)LINK_EXCHANGES, (unsigned)SPI_LINK_SLOT);
+    printf("%7s %9s %9s %9s %9s %9s %9s %8s %9s\n", "ber_ppm", "flips", "m_deliv", "s_deliv", "crc_err",
+           "retrans", "dups", "goodput", "kB/s");
+
+    for (uint32_t i = 0; i < sizeof(ber) / sizeof(ber[0]); i++)
+        link_run(ber[i]);
+
+    return test_done("test_link");
+}
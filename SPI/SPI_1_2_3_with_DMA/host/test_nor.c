@@ -0,0 +1,231 @@
+/**
+  ******************************************************************************
+  * @file           : test_nor.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * spi_nor on SPI3 (DMA) against the NOR model of sim_nor.c (1 MB, page program
+  * 0.7 ms, sector erase 45 ms). Checks that reads see every write, buffered or
+  * programmed, through a mix of short and long accesses and erases; the hit
+  * rate of the read-ahead windows on a sequential scan and the time saved by
+  * prefetching while the caller consumes; and that filling the next page
+  * overlaps the program of the previous one. The model counts any command sent
+  * while the flash is busy.
+*/
+
+#include "board.h"
+#include "sim_nor.h"
+#include "spi_nor.h"
+#include "test.h"
+#include <string.h>
+
+#define N_SIZE              0x100000u
+#define N_AREA              0x10000u   // region used by the coherency run
+#define N_OPS               120u
+#define N_CHUNK             64u        // sequential scan: bytes per read
+#define N_SCAN              0x8000u
+#define N_CONSUME           (SIM_CPU_HZ / 1000000u * 300u)     // caller work per chunk (cycles)
+#define N_PAGES             16u
+#define N_FILL              (SIM_CPU_HZ / 1000u)               // caller work to produce a page
+
+static uint8_t n_mem[N_SIZE];
+static uint8_t n_shadow[N_AREA];
+static uint8_t n_buf[2u * SPI_NOR_LINE];  // reads up to twice a window: both paths
+static SIM_Nor n_chip;
+static SPI_NOR_Flash n_nor SPI_APP_DMA_BUFFER;
+static uint32_t n_rng = 0x9E3779B9u;
+
+static uint32_t n_rand(uint32_t n)
+{
+    n_rng ^= n_rng << 13;
+    n_rng ^= n_rng >> 17;
+    n_rng ^= n_rng << 5;
+    return n_rng % n;
+}
+
+/* Writes and reads (window and direct paths) against a shadow of the array, one erase halfway
+   (45 ms of status polling: one is enough) */
+static void test_coherency(void)
+{
+    uint32_t mismatches = 0;
+
+    for (uint32_t i = 0; i < N_AREA; i++)
+        n_mem[i] = (uint8_t)(i * 7u);
+    memcpy(n_shadow, n_mem, N_AREA);
+
+    for (uint32_t op = 0; op < N_OPS; op++)
+    {
+        uint32_t kind = n_rand(16);
+        uint32_t len = (kind < 6) ? 1u + n_rand(600) : 1u + n_rand(sizeof(n_buf));
+        uint32_t addr = n_rand(N_AREA - len);
+
+        if (op == N_OPS / 2u)
+        {
+            addr &= ~(SPI_NOR_SECTOR - 1u);
+            TEST_CHECK(spi_nor_erase(&n_nor, addr, SPI_NOR_SECTOR) == HAL_OK);
+            memset(&n_shadow[addr], 0xFF, SPI_NOR_SECTOR);
+        }
+        else if (kind < 6)
+        {
+            for (uint32_t i = 0; i < len; i++)
+                n_buf[i] = (uint8_t)n_rand(256);
+            TEST_CHECK(spi_nor_write(&n_nor, addr, n_buf, len) == HAL_OK);
+            for (uint32_t i = 0; i < len; i++)
+                n_shadow[addr + i] &= n_buf[i];
+
+            /* Read straight back: the tail is still in the write-behind buffer */
+            TEST_CHECK(spi_nor_read(&n_nor, addr, n_buf, len) == HAL_OK);
+            if (memcmp(n_buf, &n_shadow[addr], len) != 0)
+                mismatches++;
+        }
+        else
+        {
+            TEST_CHECK(spi_nor_read(&n_nor, addr, n_buf, len) == HAL_OK);
+            if (memcmp(n_buf, &n_shadow[addr], len) != 0)
+                mismatches++;
+
+            /* Sequential follow-up: served by the window just used or the prefetched one */
+            if (len < SPI_NOR_LINE && addr + 2u * len <= N_AREA)
+            {
+                TEST_CHECK(spi_nor_read(&n_nor, addr + len, n_buf, len) == HAL_OK);
+                if (memcmp(n_buf, &n_shadow[addr + len], len) != 0)
+                    mismatches++;
+            }
+        }
+    }
+
+    TEST_CHECK(spi_nor_sync(&n_nor) == HAL_OK);
+    TEST_CHECK(mismatches == 0);
+    TEST_CHECK(memcmp(n_mem, n_shadow, N_AREA) == 0);
+    TEST_CHECK(n_chip.violations == 0);
+
+    printf("coherency: %u ops, %lu programs, %lu erases, %lu reads, %lu status polls, %lu mismatches\n",
+           (unsigned)N_OPS, (unsigned long)n_chip.programs, (unsigned long)n_chip.erases,
+           (unsigned long)n_chip.reads, (unsigned long)n_chip.status_reads, (unsigned long)mismatches);
+}
+
+/* Sequential scan in N_CHUNK reads, N_CONSUME of caller work after each */
+static uint64_t n_scan(uint32_t base, uint32_t *bad)
+{
+    uint64_t t0 = sim_now();
+
+    for (uint32_t a = base; a < base + N_SCAN; a += N_CHUNK)
+    {
+        TEST_CHECK(spi_nor_read(&n_nor, a, n_buf, N_CHUNK) == HAL_OK);
+        if (memcmp(n_buf, &n_mem[a], N_CHUNK) != 0)
+            (*bad)++;
+        sim_cpu(N_CONSUME);
+    }
+    return sim_now() - t0;
+}
+
+static void test_prefetch(void)
+{
+    uint32_t base = 0x40000u, bad = 0;
+    uint32_t lines = N_SCAN / SPI_NOR_LINE;
+    uint32_t hits, misses;
+    uint64_t t_ahead, t_plain;
+
+    for (uint32_t i = 0; i < 2u * N_SCAN; i++)
+        n_mem[base + i] = (uint8_t)(i * 13u + 5u);
+
+    /* Windows loaded on demand only */
+    n_nor.async = 0;
+    n_nor.hits = n_nor.misses = n_nor.prefetches = 0;
+    t_plain = n_scan(base, &bad);
+    TEST_CHECK(n_nor.misses == lines && n_nor.prefetches == 0);
+
+    /* Read-ahead: the next window comes in by DMA while the caller works */
+    n_nor.async = 1;
+    n_nor.hits = n_nor.misses = n_nor.prefetches = 0;
+    t_ahead = n_scan(base + N_SCAN, &bad);
+    hits = n_nor.hits;
+    misses = n_nor.misses;
+
+    TEST_CHECK(bad == 0 && n_chip.violations == 0);
+    TEST_CHECK(misses == 1 && n_nor.prefetches >= lines - 1u);
+    TEST_CHECK(hits * 100u >= (hits + misses) * 99u);
+    TEST_CHECK(t_ahead * 4u <= t_plain * 3u);
+
+    printf("prefetch: %lu reads of %u bytes, hit rate %.1f%% (%.1f%% on demand), %lu prefetches; "
+           "%.0f us with read-ahead, %.0f us without\n", (unsigned long)(N_SCAN / N_CHUNK), (unsigned)N_CHUNK,
+           100.0 * hits / (hits + misses), 100.0 * (N_SCAN / N_CHUNK - lines) / (N_SCAN / N_CHUNK),
+           (unsigned long)n_nor.prefetches, sim_us(t_ahead), sim_us(t_plain));
+}
+
+/* N_PAGES pages produced by the caller (N_FILL each) and written; sync after each one when
+   serial, so nothing of the flash work overlaps the production of the next page */
+static uint64_t n_program(uint32_t base, uint8_t serial)
+{
+    uint8_t page[SPI_NOR_PAGE];
+    uint64_t t0 = sim_now();
+
+    for (uint32_t p = 0; p < N_PAGES; p++)
+    {
+        sim_cpu(N_FILL);
+        for (uint32_t i = 0; i < SPI_NOR_PAGE; i++)
+            page[i] = (uint8_t)(p * 3u + i + serial);
+        TEST_CHECK(spi_nor_write(&n_nor, base + p * SPI_NOR_PAGE, page, SPI_NOR_PAGE) == HAL_OK);
+        if (serial)
+            TEST_CHECK(spi_nor_sync(&n_nor) == HAL_OK);
+    }
+    TEST_CHECK(spi_nor_sync(&n_nor) == HAL_OK);
+
+    for (uint32_t p = 0; p < N_PAGES; p++)
+        for (uint32_t i = 0; i < SPI_NOR_PAGE; i++)
+            TEST_CHECK(n_mem[base + p * SPI_NOR_PAGE + i] == (uint8_t)(p * 3u + i + serial));
+
+    return sim_now() - t0;
+}
+
+static void test_overlap(void)
+{
+    uint64_t t_serial, t_piped;
+    uint32_t pages0 = n_chip.programs;
+
+    t_serial = n_program(0x80000u, 1);
+    t_piped = n_program(0x90000u, 0);
+
+    TEST_CHECK(n_chip.programs - pages0 == 2u * N_PAGES && n_chip.violations == 0);
+    TEST_CHECK(t_piped * 10u <= t_serial * 8u);
+
+    printf("program: %u pages, %.0f us with write-behind, %.0f us synced per page\n", (unsigned)N_PAGES,
+           sim_us(t_piped), sim_us(t_serial));
+}
+
+/* Erase returns at once; the next access waits for WIP and sees the sector blank */
+static void test_erase(void)
+{
+    uint32_t addr = 0xA0000u;
+    uint64_t t0, t_erase, t_read;
+
+    memset(&n_mem[addr], 0x00, SPI_NOR_SECTOR);
+    t0 = sim_now();
+    TEST_CHECK(spi_nor_erase(&n_nor, addr, SPI_NOR_SECTOR) == HAL_OK);
+    t_erase = sim_now() - t0;
+    TEST_CHECK(spi_nor_read(&n_nor, addr + 100u, n_buf, 16) == HAL_OK);
+    t_read = sim_now() - t0;
+
+    for (uint32_t i = 0; i < 16u; i++)
+        TEST_CHECK(n_buf[i] == 0xFFu);
+    TEST_CHECK(t_erase < SIM_NOR_T_SE / 10u && t_read >= SIM_NOR_T_SE);
+    TEST_CHECK(n_chip.violations == 0);
+
+    printf("erase: returns after %.0f us, first read after %.0f us\n", sim_us(t_erase), sim_us(t_read));
+}
+
+int main(void)
+{
+    board_init();
+    sim_nor_init(&n_chip, SPI3_CS_GPIO_Port, SPI3_CS_Pin, n_mem, N_SIZE);
+    sim_spi_attach(SPI3, &n_chip.peer);
+
+    TEST_CHECK(spi_nor_init(&n_nor, &spi3_dev, 0) == HAL_OK);
+    TEST_CHECK(n_nor.size == N_SIZE && n_nor.async);
+
+    test_coherency();
+    test_prefetch();
+    test_overlap();
+    test_erase();
+
+    return test_done("test_nor");
+}
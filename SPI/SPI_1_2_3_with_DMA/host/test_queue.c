@@ -0,0 +1,346 @@
+/**
+  ******************************************************************************
+  * @file           : test_queue.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * SPI_APP_Queue on SPI3 with four devices (CS on PD0..PD3, one per queued
+  * transaction). Checks that transactions reach the wire, complete and call
+  * back in submission order, one CS at a time, also when the queue is topped
+  * up from the thread and from the callbacks while it runs (the last callback
+  * before the queue reports drained); that a failing transaction drops the
+  * rest in order; and that the chained queue keeps the bus busier than the
+  * same transfers started one by one from a main loop.
+*/
+
+#include "board.h"
+#include "test.h"
+#include <string.h>
+
+#define Q_DEVS              4u
+#define Q_LEN               64u        // frames per transaction (throughput runs)
+#define Q_RUN               64u        // transactions per throughput run
+#define Q_LOG               256u
+#define Q_SLICE             9600u      // main loop work between two SPI services (cycles, 20 us)
+
+typedef struct {
+    SIM_SpiPeer peer;
+    uint32_t id;
+    uint32_t index;                    // frame in the current selection
+    uint8_t got[Q_LEN];                // MOSI of the current selection
+} Q_Dev;
+
+/* Wire and completion order: (device, first MOSI byte) */
+static struct { uint32_t dev; uint8_t tag; } q_wire[Q_LOG], q_done[Q_LOG];
+static uint32_t q_wire_n, q_done_n;
+static uint32_t q_selected, q_overlaps, q_data_errors;
+static uint64_t q_first_sck, q_last_sck, q_idle;   // bus idle time between selections
+
+static Q_Dev q_devs[Q_DEVS];
+static SPI_APP_Queue q_queue;
+static uint8_t q_tx[Q_LOG][Q_LEN] SPI_APP_DMA_BUFFER;
+static uint8_t q_rx[Q_LOG][Q_LEN] SPI_APP_DMA_BUFFER;
+static uint32_t q_refill;              // transactions the callback still submits
+static uint32_t q_next;                // slot of the next refill
+
+static uint32_t q_xfer(void *ctx, uint32_t mosi, uint32_t bits)
+{
+    Q_Dev *d = ctx;
+
+    if (d->index == 0)
+    {
+        uint64_t start = sim_now() - (uint64_t)bits * sim_spi_sck(SPI3);
+
+        if (q_last_sck)
+            q_idle += start - q_last_sck;
+        if (!q_first_sck)
+            q_first_sck = start;
+    }
+    q_last_sck = sim_now();
+
+    if (d->index < Q_LEN)
+        d->got[d->index] = (uint8_t)mosi;
+    return (uint8_t)(d->id * 16u + d->index++);
+}
+
+static void q_cs(void *ctx, int selected)
+{
+    Q_Dev *d = ctx;
+
+    if (selected)
+    {
+        if (q_selected)
+            q_overlaps++;
+        q_selected++;
+        d->index = 0;
+    }
+    else
+    {
+        q_selected--;
+        if (q_wire_n < Q_LOG)
+        {
+            q_wire[q_wire_n].dev = d->id;
+            q_wire[q_wire_n].tag = d->got[0];
+            q_wire_n++;
+        }
+    }
+}
+
+static void q_txn(SPI_APP_Txn *t, uint32_t dev, uint32_t slot, uint32_t len)
+{
+    memset(t, 0, sizeof(*t));
+    t->CS_Port = GPIOD;
+    t->CS_Pin = (uint16_t)(GPIO_PIN_0 << dev);
+    t->cs_active_low = 1;
+    t->tx = q_tx[slot];
+    t->rx = q_rx[slot];
+    t->len = len;
+    t->ctx = (void *)(uintptr_t)slot;
+
+    q_tx[slot][0] = (uint8_t)slot;
+    for (uint32_t i = 1; i < len; i++)
+        q_tx[slot][i] = (uint8_t)(slot * 7u + i);
+    memset(q_rx[slot], 0xEE, len);
+}
+
+static void q_cb(SPI_APP_Device *dev, HAL_StatusTypeDef status, void *ctx);
+
+/* Completion: check the data of the transaction, log it, optionally submit one more */
+static void q_cb(SPI_APP_Device *dev, HAL_StatusTypeDef status, void *ctx)
+{
+    uint32_t slot = (uint32_t)(uintptr_t)ctx;
+
+    /* Completed transactions call back before the queue reports drained and frees the bus */
+    if (status == HAL_OK)
+        TEST_CHECK(!q_queue.done && !(dev->events & SPI_APP_EVT_QUEUE));
+
+    if (q_done_n < Q_LOG)
+    {
+        q_done[q_done_n].dev = (status == HAL_OK) ? 0u : 0xFFu;
+        q_done[q_done_n].tag = (uint8_t)slot;
+        q_done_n++;
+    }
+
+    if (status == HAL_OK && q_refill)
+    {
+        SPI_APP_Txn t;
+        uint32_t next = q_next++;
+
+        q_refill--;
+        q_txn(&t, next % Q_DEVS, next, 8u);
+        t.cb = q_cb;
+        if (spi_app_queue_submit(dev, &t, 1) != HAL_OK)
+            q_data_errors++;
+    }
+}
+
+static int q_drained(void *ctx)
+{
+    (void)ctx;
+    return q_queue.done;
+}
+
+static void q_reset(void)
+{
+    q_wire_n = q_done_n = 0;
+    q_overlaps = q_data_errors = 0;
+    q_first_sck = q_last_sck = q_idle = 0;
+}
+
+/* Wire order == completion order == submission order (slots first .. first + n - 1) */
+static void q_check_order(uint32_t first, uint32_t n)
+{
+    TEST_CHECK(q_wire_n == n && q_done_n == n);
+    for (uint32_t i = 0; i < n && i < q_wire_n && i < q_done_n; i++)
+    {
+        TEST_CHECK(q_wire[i].tag == (uint8_t)(first + i));
+        TEST_CHECK(q_wire[i].dev == (first + i) % Q_DEVS);
+        TEST_CHECK(q_done[i].dev == 0u && q_done[i].tag == (uint8_t)(first + i));
+    }
+    TEST_CHECK(q_overlaps == 0 && q_data_errors == 0);
+}
+
+static void test_order(void)
+{
+    SPI_APP_Txn t[SPI_APP_QUEUE_LEN];
+    static const uint32_t lens[] = { 1u, 5u, 64u, 2u, 17u, 33u, 3u, 64u };
+
+    q_reset();
+    for (uint32_t i = 0; i < SPI_APP_QUEUE_LEN; i++)
+    {
+        q_txn(&t[i], i % Q_DEVS, i, lens[i]);
+        t[i].cb = q_cb;
+    }
+
+    /* Half now, the rest while the first ones are on the wire */
+    TEST_CHECK(spi_app_queue_submit(&spi3_dev, t, SPI_APP_QUEUE_LEN / 2u) == HAL_OK);
+    TEST_CHECK(!spi_app_queue_idle(&spi3_dev));
+    sim_cpu(2000);
+    TEST_CHECK(spi_app_queue_submit(&spi3_dev, &t[SPI_APP_QUEUE_LEN / 2u], SPI_APP_QUEUE_LEN / 2u) == HAL_OK);
+    TEST_CHECK(sim_idle(q_drained, 0, SIM_CPU_HZ));
+
+    q_check_order(0, SPI_APP_QUEUE_LEN);
+    TEST_CHECK(q_queue.completed == SPI_APP_QUEUE_LEN && q_queue.dropped == 0 && !q_queue.err);
+
+    /* Every device saw its own MOSI, every RX buffer got its device's MISO */
+    for (uint32_t i = 0; i < SPI_APP_QUEUE_LEN; i++)
+    {
+        for (uint32_t k = 0; k < lens[i]; k++)
+            TEST_CHECK(q_rx[i][k] == (uint8_t)((i % Q_DEVS) * 16u + k));
+    }
+    TEST_CHECK(memcmp(q_devs[3].got, q_tx[7], lens[7]) == 0);
+}
+
+/* The callbacks keep the queue going: it must drain only after the last refill */
+static void test_refill(void)
+{
+    SPI_APP_Txn t;
+
+    q_reset();
+    q_queue.completed = 0;
+    q_refill = 40u;
+    q_next = 1u;
+
+    q_txn(&t, 0, 0, 8u);
+    t.cb = q_cb;
+    TEST_CHECK(spi_app_queue_submit(&spi3_dev, &t, 1) == HAL_OK);
+    TEST_CHECK(sim_idle(q_drained, 0, SIM_CPU_HZ));
+
+    q_check_order(0, 41u);
+    TEST_CHECK(q_refill == 0 && q_queue.completed == 41u);
+}
+
+/* A transaction that cannot start (RX buffer in DTCM, out of DMA reach) drops the rest, in order */
+static void test_drop(void)
+{
+    SPI_APP_Txn t[4];
+
+    q_reset();
+    q_queue.completed = q_queue.dropped = 0;
+    for (uint32_t i = 0; i < 4u; i++)
+    {
+        q_txn(&t[i], i, i, 4u);
+        t[i].cb = q_cb;
+    }
+    t[1].rx = (uint8_t *)(uintptr_t)0x20000100u;
+
+    TEST_CHECK(spi_app_queue_submit(&spi3_dev, t, 4) == HAL_OK);
+    TEST_CHECK(sim_idle(q_drained, 0, SIM_CPU_HZ));
+
+    TEST_CHECK(q_queue.err && q_queue.completed == 1u && q_queue.dropped == 3u);
+    TEST_CHECK(q_wire_n == 1u && q_done_n == 4u);
+    TEST_CHECK(q_done[0].dev == 0u && q_done[0].tag == 0u);
+    for (uint32_t i = 1; i < 4u && i < q_done_n; i++)
+        TEST_CHECK(q_done[i].dev == 0xFFu && q_done[i].tag == i);
+    TEST_CHECK(spi3_dev.dma_err);
+
+    /* The queue takes new work after an error */
+    q_reset();
+    q_txn(&t[0], 2, 0, 4u);
+    t[0].cb = q_cb;
+    TEST_CHECK(spi_app_queue_submit(&spi3_dev, t, 1) == HAL_OK);
+    TEST_CHECK(sim_idle(q_drained, 0, SIM_CPU_HZ));
+    TEST_CHECK(!q_queue.err && q_wire_n == 1u && q_done_n == 1u);
+}
+
+/* Same Q_RUN transactions from a main loop that services the SPI between slices of other work
+   (Q_SLICE cycles): topping up the queue, then one spi_app_transfer_dma() at a time started
+   once the previous one is seen done */
+static void test_throughput(void)
+{
+    SPI_APP_Txn t[SPI_APP_QUEUE_LEN];
+    uint64_t q_time, s_time, q_gap, s_gap, q_cpu, s_cpu, c0;
+    uint32_t submitted = 0;
+
+    q_reset();
+    q_refill = 0;
+    c0 = sim_clock.busy - sim_clock.app;
+    while (submitted < Q_RUN)
+    {
+        uint32_t n = 0;
+
+        while (n < SPI_APP_QUEUE_LEN - q_queue.count && submitted + n < Q_RUN)
+        {
+            q_txn(&t[n], (submitted + n) % Q_DEVS, (submitted + n) % Q_LOG, Q_LEN);
+            n++;
+        }
+        if (n && spi_app_queue_submit(&spi3_dev, t, (uint8_t)n) == HAL_OK)
+            submitted += n;
+        sim_cpu(Q_SLICE);
+    }
+    while (!q_queue.done)
+        sim_cpu(Q_SLICE);
+    q_time = q_last_sck - q_first_sck;
+    q_gap = q_idle;
+    q_cpu = sim_clock.busy - sim_clock.app - c0;
+    TEST_CHECK(q_wire_n == Q_RUN && q_overlaps == 0);
+
+    /* Plain DMA transfers on the device CS, moved to the PD0 device for the run */
+    q_reset();
+    spi3_dev.queue = 0;
+    spi3_dev.CS_Port = GPIOD;
+    spi3_dev.CS_Pin = GPIO_PIN_0;
+    c0 = sim_clock.busy - sim_clock.app;
+    for (uint32_t i = 0; i < Q_RUN;)
+    {
+        if (spi3_dev.dma_done)
+        {
+            q_txn(&t[0], 0, i % Q_LOG, Q_LEN);
+            TEST_CHECK(spi_app_transfer_dma(&spi3_dev, t[0].tx, t[0].rx, Q_LEN) == HAL_OK);
+            i++;
+        }
+        sim_cpu(Q_SLICE);
+    }
+    while (!spi3_dev.dma_done)
+        sim_cpu(Q_SLICE);
+    s_time = q_last_sck - q_first_sck;
+    s_gap = q_idle;
+    s_cpu = sim_clock.busy - sim_clock.app - c0;
+    TEST_CHECK(q_wire_n == Q_RUN && q_overlaps == 0);
+
+    spi3_dev.CS_Port = SPI3_CS_GPIO_Port;
+    spi3_dev.CS_Pin = SPI3_CS_Pin;
+    spi3_dev.queue = &q_queue;
+
+    printf("%u transactions of %u bytes: queue %.1f us on the bus (%.1f kB/s), %.2f us gap each, %.1f us CPU;"
+           " one by one %.1f us (%.1f kB/s), %.2f us gap each, %.1f us CPU\n",
+           (unsigned)Q_RUN, (unsigned)Q_LEN, sim_us(q_time), sim_rate((uint64_t)Q_RUN * Q_LEN, q_time) / 1000.0,
+           sim_us(q_gap) / (Q_RUN - 1u), sim_us(q_cpu), sim_us(s_time),
+           sim_rate((uint64_t)Q_RUN * Q_LEN, s_time) / 1000.0, sim_us(s_gap) / (Q_RUN - 1u), sim_us(s_cpu));
+
+    TEST_CHECK(q_time < s_time && q_gap < s_gap);
+}
+
+int main(void)
+{
+    GPIO_InitTypeDef gpio = {0};
+
+    board_init();
+
+    /* Four chip selects on PD0..PD3, idle high */
+    __HAL_RCC_GPIOD_CLK_ENABLE();
+    HAL_GPIO_WritePin(GPIOD, GPIO_PIN_0 | GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3, GPIO_PIN_SET);
+    gpio.Pin = GPIO_PIN_0 | GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3;
+    gpio.Mode = GPIO_MODE_OUTPUT_PP;
+    gpio.Speed = GPIO_SPEED_FREQ_HIGH;
+    HAL_GPIO_Init(GPIOD, &gpio);
+
+    for (uint32_t i = 0; i < Q_DEVS; i++)
+    {
+        q_devs[i].id = i;
+        q_devs[i].peer.cs_port = GPIOD;
+        q_devs[i].peer.cs_pin = (uint16_t)(GPIO_PIN_0 << i);
+        q_devs[i].peer.xfer = q_xfer;
+        q_devs[i].peer.cs = q_cs;
+        q_devs[i].peer.ctx = &q_devs[i];
+        sim_spi_attach(SPI3, &q_devs[i].peer);
+    }
+
+    spi_app_queue_attach(&spi3_dev, &q_queue);
+
+    test_order();
+    test_refill();
+    test_drop();
+    test_throughput();
+
+    return test_done("test_queue");
+}
@@ -0,0 +1,268 @@
+/**
+  ******************************************************************************
+  * @file           : test_slave.c
+  * @author         : Luca Cassi
+  ******************************************************************************
+  * SPI_SLAVE_Rx on SPI2 (8-bit, NSS on PB12, circular RX DMA on a 64-frame
+  * ring) fed by a simulated master: NSS driven on the pin and frames clocked
+  * in with sim_spi_slave_frame() from timed events. Checks the NSS framing of
+  * packets shorter and longer than the ring and ending exactly on the half and
+  * full ring boundaries, and the overrun accounting when the ring IRQ is held
+  * off too long or the DMA stops emptying the RX FIFO: the packet hit is
+  * dropped, the ones around it arrive intact and in order.
+*/
+
+#include "board.h"
+#include "spi_slave.h"
+#include "test.h"
+#include <string.h>
+
+#define S_RING              64u        // frames
+#define S_PKT_MAX           512u
+#define S_PKTS_MAX          32u
+#define S_FRAME             320u       // master frame period (cycles: 8 bits at 12 MHz)
+#define S_SETUP             96u        // NSS low to first SCK (cycles)
+#define S_GAP               1920u      // NSS high between packets (cycles)
+
+/* Simulated master: sends packet n with n in its first byte */
+static struct {
+    const uint16_t *len;
+    uint32_t count;
+    uint32_t pkt;                      // packet in progress
+    uint32_t index;                    // next frame of it
+    uint8_t selected;
+} s_master;
+
+/* Consumer: packet being reassembled and the log of the complete ones */
+static struct {
+    uint8_t buf[S_PKT_MAX];
+    uint32_t len;
+    uint32_t pieces;                   // pieces of the packet being reassembled
+    uint32_t max_pieces;
+    uint32_t ids[S_PKTS_MAX];
+    uint32_t count;
+    uint32_t bad;                      // wrong length or content
+    uint32_t drops;                    // SPI_SLAVE_PKT_DROP callbacks
+} s_rx;
+
+static SPI_SLAVE_Rx s_slv;
+static uint8_t s_ring[S_RING] SPI_APP_DMA_BUFFER;
+
+static uint8_t s_byte(uint32_t pkt, uint32_t i)
+{
+    return (uint8_t)(i ? pkt * 31u + i : pkt);
+}
+
+static void s_master_step(void *ctx)
+{
+    (void)ctx;
+    if (s_master.pkt == s_master.count)
+        return;
+
+    if (!s_master.selected)
+    {
+        sim_gpio_drive(SPI2_CS_GPIO_Port, SPI2_CS_Pin, 0);
+        s_master.selected = 1;
+        s_master.index = 0;
+        sim_at(sim_now() + S_SETUP, s_master_step, 0);
+    }
+    else if (s_master.index < s_master.len[s_master.pkt])
+    {
+        (void)sim_spi_slave_frame(SPI2, s_byte(s_master.pkt, s_master.index), 8u);
+        s_master.index++;
+        sim_at(sim_now() + S_FRAME, s_master_step, 0);
+    }
+    else
+    {
+        sim_gpio_drive(SPI2_CS_GPIO_Port, SPI2_CS_Pin, 1);
+        s_master.selected = 0;
+        s_master.pkt++;
+        sim_at(sim_now() + S_GAP, s_master_step, 0);
+    }
+}
+
+static void s_cb(SPI_SLAVE_Rx *slv, const uint8_t *data, uint32_t len, uint8_t flags, void *ctx)
+{
+    uint32_t id;
+    uint8_t ok;
+
+    (void)slv;
+    (void)ctx;
+    if (flags & SPI_SLAVE_PKT_DROP)
+    {
+        s_rx.drops++;
+        s_rx.len = 0;
+        s_rx.pieces = 0;
+        return;
+    }
+
+    if (s_rx.len + len <= S_PKT_MAX)
+        memcpy(&s_rx.buf[s_rx.len], data, len);
+    s_rx.len += len;
+    s_rx.pieces++;
+    if (!(flags & SPI_SLAVE_PKT_END))
+        return;
+
+    id = s_rx.buf[0];
+    ok = (s_rx.len <= S_PKT_MAX && id < s_master.count && s_rx.len == s_master.len[id]);
+    for (uint32_t i = 0; ok && i < s_rx.len; i++)
+        ok = (s_rx.buf[i] == s_byte(id, i));
+    if (!ok)
+        s_rx.bad++;
+    if (s_rx.count < S_PKTS_MAX)
+        s_rx.ids[s_rx.count++] = id;
+    if (s_rx.pieces > s_rx.max_pieces)
+        s_rx.max_pieces = s_rx.pieces;
+    s_rx.len = 0;
+    s_rx.pieces = 0;
+}
+
+static void s_exti(uint16_t pin)
+{
+    if (pin == SPI2_CS_Pin)
+        spi_slave_nss_edge(&s_slv);
+}
+
+static void s_half(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+    spi_slave_half_cplt(&s_slv);
+}
+
+static void s_cplt(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+    spi_slave_cplt(&s_slv);
+}
+
+static void s_error(SPI_HandleTypeDef *hspi)
+{
+    (void)hspi;
+    spi_slave_error(&s_slv);
+}
+
+static const BOARD_SpiHooks s_hooks = { s_half, s_cplt, s_error };
+
+static int s_master_done(void *ctx)
+{
+    (void)ctx;
+    return s_master.pkt == s_master.count;
+}
+
+/* Master inside packet pkt, frame index sent */
+static int s_master_at(void *ctx)
+{
+    const uint32_t *at = ctx;
+
+    return s_master.pkt > at[0] || (s_master.pkt == at[0] && s_master.index >= at[1]);
+}
+
+/* Restart the receiver and the master on a script of packet lengths */
+static void s_run(const uint16_t *len, uint32_t count)
+{
+    (void)spi_slave_stop(&s_slv);
+    memset(&s_rx, 0, sizeof(s_rx));
+    memset(&s_master, 0, sizeof(s_master));
+    s_master.len = len;
+    s_master.count = count;
+    TEST_CHECK(spi_slave_start(&s_slv, s_ring, S_RING, s_cb, 0) == HAL_OK);
+    sim_at(sim_now() + S_GAP, s_master_step, 0);
+}
+
+static void s_finish(void)
+{
+    TEST_CHECK(sim_idle(s_master_done, 0, SIM_CPU_HZ / 10u));
+    sim_cpu(S_GAP);
+}
+
+static uint32_t s_frames(const uint16_t *len, uint32_t count)
+{
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        n += len[i];
+    return n;
+}
+
+/* Packets end on the half and full ring boundaries (32, 64, then 16 + 16), wrap, span the ring */
+static void test_framing(void)
+{
+    static const uint16_t len[] = { 32, 32, 16, 16, 32, 1, 63, 64, 65, 200, 5, 31, 33, 128, 2 };
+    uint32_t n = sizeof(len) / sizeof(len[0]);
+    uint32_t in_order = 1;
+
+    s_run(len, n);
+    s_finish();
+
+    for (uint32_t i = 0; i < s_rx.count; i++)
+        in_order &= (s_rx.ids[i] == i);
+    TEST_CHECK(s_rx.count == n && in_order && s_rx.bad == 0 && s_rx.drops == 0);
+    TEST_CHECK(s_slv.packets == n && s_slv.frames == s_frames(len, n));
+    TEST_CHECK(s_slv.dropped == 0 && s_slv.ring_overruns == 0 && s_slv.fifo_overruns == 0 && s_slv.errors == 0);
+    TEST_CHECK(s_rx.max_pieces >= 200u / (S_RING / 2u));   // the 200-frame packet in half-ring pieces
+
+    printf("framing: %lu packets, %lu frames, up to %lu pieces per packet\n", (unsigned long)s_slv.packets,
+           (unsigned long)s_slv.frames, (unsigned long)s_rx.max_pieces);
+}
+
+/* Interrupts masked for 100 frames in the middle of packet 1, after its first piece: the DMA laps
+   the delivery point */
+static void test_ring_overrun(void)
+{
+    static const uint16_t len[] = { 10, 300, 10, 10 };
+    static const uint32_t at[] = { 1, 40 };   // past the half ring: a piece is out
+
+    s_run(len, 4);
+    TEST_CHECK(sim_idle(s_master_at, (void *)at, SIM_CPU_HZ / 10u));
+    __disable_irq();
+    sim_cpu(100u * S_FRAME);
+    __enable_irq();
+    s_finish();
+
+    TEST_CHECK(s_rx.count == 3 && s_rx.ids[0] == 0 && s_rx.ids[1] == 2 && s_rx.ids[2] == 3 && s_rx.bad == 0);
+    TEST_CHECK(s_rx.drops == 1 && s_slv.dropped == 1 && s_slv.packets == 3);
+    TEST_CHECK(s_slv.ring_overruns >= 1 && s_slv.fifo_overruns == 0);
+
+    printf("ring overrun: %lu delivered, %lu dropped, %lu ring overrun(s)\n", (unsigned long)s_slv.packets,
+           (unsigned long)s_slv.dropped, (unsigned long)s_slv.ring_overruns);
+}
+
+/* RX DMA requests off (a stalled bus master) in the middle of packet 1, after its first piece: the
+   RX FIFO overruns, the HAL stops the reception and the receiver re-arms */
+static void test_fifo_overrun(void)
+{
+    static const uint16_t len[] = { 10, 100, 10 };
+    static const uint32_t at[] = { 1, 40 };   // past the half ring: a piece is out
+
+    s_run(len, 3);
+    TEST_CHECK(sim_idle(s_master_at, (void *)at, SIM_CPU_HZ / 10u));
+    CLEAR_BIT(SPI2->CFG1, SPI_CFG1_RXDMAEN);
+    s_finish();
+
+    TEST_CHECK(s_rx.count == 2 && s_rx.ids[0] == 0 && s_rx.ids[1] == 2 && s_rx.bad == 0);
+    TEST_CHECK(s_rx.drops == 1 && s_slv.dropped == 1 && s_slv.packets == 2);
+    TEST_CHECK(s_slv.fifo_overruns == 1 && s_slv.ring_overruns == 0 && sim_spi_stats(SPI2)->ovr > 0);
+
+    printf("FIFO overrun: %lu delivered, %lu dropped, %lu FIFO overrun(s)\n", (unsigned long)s_slv.packets,
+           (unsigned long)s_slv.dropped, (unsigned long)s_slv.fifo_overruns);
+}
+
+int main(void)
+{
+    board_init();
+    board_spi_dma(&hspi2);
+    board_spi_hooks(&hspi2, &s_hooks);
+    board_exti_hook(s_exti);
+
+    /* 16-bit in the .ioc; the board DMA streams move bytes */
+    hspi2.Init.DataSize = SPI_DATASIZE_8BIT;
+    TEST_CHECK(spi_slave_init(&s_slv, &hspi2, SPI2_CS_GPIO_Port, SPI2_CS_Pin, GPIO_AF5_SPI2) == HAL_OK);
+    HAL_NVIC_SetPriority(EXTI15_10_IRQn, 0, 0);    // same priority as the RX DMA IRQ
+    HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
+
+    test_framing();
+    test_ring_overrun();
+    test_fifo_overrun();
+
+    return test_done("test_slave");
+}